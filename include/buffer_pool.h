@@ -0,0 +1,58 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <unistd.h>
+
+/* Alignment of the pool buffers, a cache line */
+#define BUFFER_POOL_ALIGN 64
+
+/*
+ * The buffers of a context, kept from one operation to the next one, so that
+ * the frames and blocks of the reads and writes are allocated only once.
+ * A pool is used by one thread at a time, as its context.
+ */
+struct buffer_pool;
+
+/**
+ * buffer_get - get a buffer from the pool
+ * @pool: the pool, NULL while empty
+ * @size: the size of the buffer
+ *
+ * The smallest free buffer big enough is reused. Otherwise, the biggest free
+ * buffer is replaced by a bigger one, so that the pool holds no more buffers
+ * than the most ever used at once. The buffer content is undefined.
+ *
+ * Returns a buffer aligned on BUFFER_POOL_ALIGN, or NULL if out of memory
+ */
+void *buffer_get(struct buffer_pool **pool, size_t size);
+
+/**
+ * buffer_put - give a buffer back to the pool
+ * @pool: the pool
+ * @buf: the buffer got from buffer_get(), or NULL
+ */
+void buffer_put(struct buffer_pool **pool, void *buf);
+
+/**
+ * buffer_pool_release - free all the buffers of the pool
+ * @pool: the pool, none of its buffers being in use
+ */
+void buffer_pool_release(struct buffer_pool **pool);
+
+#endif
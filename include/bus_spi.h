@@ -35,6 +35,19 @@ struct spi_command {
 	unsigned int readcnt;
 	const unsigned char *writearr;
 	unsigned char *readarr;
+	/* Time to wait after the command, in microseconds */
+	unsigned int delay_us;
+};
+
+enum spi_transfer {
+	SPI_TRANSFER_READ,
+	SPI_TRANSFER_WRITE,
+};
+
+/* A part of the chip carried by one read or page program command */
+struct spi_extent {
+	off_t start;
+	size_t len;
 };
 
 int spi_send_command(struct context *flash, unsigned int writecnt,
@@ -46,13 +59,41 @@ size_t spi_nbyte_read(struct context *flash, off_t address, uint8_t *bytes,
 		   size_t len);
 size_t spi_chip_write_256(struct context *flash, const uint8_t *buf,
 			  off_t start, size_t len);
+size_t spi_aai_write(struct context *flash, const uint8_t *buf, off_t start,
+		     size_t len);
 size_t spi_chip_read(struct context *flash, uint8_t *buf, off_t start, size_t len);
 size_t spi_read_chunked(struct context *flash, uint8_t *buf, off_t start,
-			size_t len, size_t chunksize);
+			size_t len);
 size_t spi_write_chunked(struct context *flash, const uint8_t *buf,
-			 off_t start, size_t len, size_t chunksize);
+			 off_t start, size_t len);
+unsigned int spi_max_data(struct context *flash, enum spi_transfer dir);
+size_t spi_transfer_len(struct context *flash, enum spi_transfer dir,
+			off_t pos, off_t end);
+
+/**
+ * spi_plan_transfers - split a part of the chip into transfers
+ * @flash: the context of the chip and its programmer
+ * @dir: whether the part is to be read or written
+ * @start: the chip address of the part
+ * @len: the length of the part
+ * @extents: where to store the transfers, may be NULL if max_extents is 0
+ * @max_extents: the number of transfers @extents can hold
+ *
+ * The transfers are the biggest the chip page size and the programmer
+ * max_data_read and max_data_write allow, reads being never cut at page
+ * boundaries.
+ *
+ * Returns the number of transfers of the part, even if more than max_extents
+ */
+int spi_plan_transfers(struct context *flash, enum spi_transfer dir,
+		       off_t start, size_t len, struct spi_extent *extents,
+		       int max_extents);
 
 int default_spi_send_multicommand(struct context *flash,
 				  struct spi_command *cmds);
+int default_spi_read(struct context *flash, uint8_t *buf, off_t start,
+		     size_t len);
+int default_spi_write_256(struct context *flash, const uint8_t *buf,
+			  off_t start, size_t len);
 
 #endif
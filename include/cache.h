@@ -0,0 +1,67 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <unistd.h>
+
+/**
+ * cache_path - build the path of a file in flashrom2 cache directory
+ * @path: the buffer to store the path into
+ * @size: the size of path buffer
+ * @name: the file name within the cache directory
+ *
+ * The cache directory is $XDG_CACHE_HOME/flashrom2, or $HOME/.cache/flashrom2
+ * if XDG_CACHE_HOME is not set. It is created if it doesn't exist yet.
+ *
+ * Returns 0 on success, or < 0 if no cache directory is available
+ */
+int cache_path(char *path, size_t size, const char *name);
+
+/**
+ * cache_get_value - lookup a value in a cache file
+ * @name: the file name within the cache directory
+ * @key: the key, without any whitespace
+ * @value: the value found
+ *
+ * Cache files hold one "key value" pair per line.
+ *
+ * Returns 0 if the key was found, < 0 otherwise
+ */
+int cache_get_value(const char *name, const char *key, long *value);
+
+/**
+ * cache_set_value - store a value in a cache file
+ * @name: the file name within the cache directory
+ * @key: the key, without any whitespace
+ * @value: the value to store
+ *
+ * The previous value of key, if any, is replaced.
+ *
+ * Returns 0 on success, < 0 otherwise
+ */
+int cache_set_value(const char *name, const char *key, long value);
+
+/*
+ * Same as cache_get_value() and cache_set_value(), for values which are
+ * strings without any whitespace.
+ */
+int cache_get_string(const char *name, const char *key, char *value,
+		     size_t size);
+int cache_set_string(const char *name, const char *key, const char *value);
+
+#endif
@@ -89,6 +89,10 @@ struct flashchip {
 	unsigned int total_size_kb;
 	/* Chip page size in bytes */
 	unsigned int page_size;
+	/* AAI word program time in microseconds, 0 if the status must be polled */
+	unsigned int word_program_us;
+	/* Typical page program time in microseconds, 0 if unknown */
+	unsigned int page_program_us;
 	int feature_bits;
 
 	int (*probe)(struct context *ctxt, const char *chip_args);
@@ -129,15 +133,64 @@ extern struct list_head chips;
 #define for_each_chip(chip)	list_for_each_entry(chip, &chips, list)
 void register_chip(const char *chip_name, struct flashchip *chip);
 void print_available_chips();
+/* The size of the smallest erase block of the chip, 0 if it can't erase */
+size_t chip_smallest_erase_block(struct flashchip *chip);
+/* The size of the biggest erase block smaller than the chip, 0 if none */
+size_t chip_biggest_erase_block(struct flashchip *chip);
 
 int chip_read(struct context *context, unsigned char *buf,
 	      off_t where, size_t len);
+/**
+ * chip_read_back - read the chip to check its content
+ * @context: the context
+ * @buf: the buffer to read into
+ * @where: the address on the chip where to read
+ * @len: the length to read
+ *
+ * Unlike chip_read(), the blocks cached from erases and writes are read from
+ * the chip, and only the ones read from the chip during the run are taken
+ * from the cache. With the context verify_uncached, nothing is.
+ *
+ * Returns the number of bytes read, or < 0 if an error occurred
+ */
+int chip_read_back(struct context *context, unsigned char *buf,
+		   off_t where, size_t len);
+int chip_read_uncached(struct context *context, unsigned char *buf,
+		       off_t where, size_t len);
 int chip_write(struct context *context, const unsigned char *buf,
 	       off_t where, size_t len);
+/**
+ * chip_erase_block - erase with one eraser, keeping the block cache coherent
+ * @ctx: the context
+ * @eraser: the eraser
+ * @start: the address of the erase block
+ * @len: the erase block size
+ *
+ * Returns 0 on success, or the eraser error
+ */
+int chip_erase_block(struct context *ctx, struct block_eraser *eraser,
+		     off_t start, size_t len);
 int chip_erase(struct context *ctx, off_t start, size_t len,
 	       int required_exact_fit, off_t *real_start, off_t *real_len);
 int compute_list_erases(struct block_eraser erasers[],
 			off_t start, size_t len, struct list_head *ops);
+void free_list_erases(struct list_head *ops);
+
+/* Default memory of the block cache of a run */
+#define BLOCK_CACHE_DEFAULT_KB	(64 * 1024)
+
+/**
+ * block_cache_drop - forget the cached chip content
+ * @ctx: the context, whose chip may have changed
+ */
+void block_cache_drop(struct context *ctx);
+
+/**
+ * block_cache_report - print the block cache hit rate, and reset it
+ * @ctx: the context
+ */
+void block_cache_report(struct context *ctx);
+void block_cache_release(struct context *ctx);
 
 /*
  * Register function for each chip.
@@ -0,0 +1,98 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Compressed images are handled by the gzip, xz and zstd tools, through pipes.
+ */
+enum compression {
+	COMPRESSION_NONE = 0,
+	COMPRESSION_GZIP,
+	COMPRESSION_XZ,
+	COMPRESSION_ZSTD,
+};
+
+/**
+ * compression_detect - find the compression of a file from its first bytes
+ * @head: the first bytes of the file
+ * @len: the number of bytes in head
+ */
+enum compression compression_detect(const unsigned char *head, size_t len);
+
+/**
+ * compression_from_suffix - find the compression of a file to create
+ * @filename: the file, ending in .gz, .xz or .zst if it is to be compressed
+ */
+enum compression compression_from_suffix(const char *filename);
+
+/**
+ * compression_length - get the uncompressed length of a compressed file
+ * @fd: the compressed file
+ * @c: its compression
+ * @len: the uncompressed length
+ *
+ * The length is taken from the gzip trailer, the xz index, or the zstd frame
+ * header, without decompressing anything. Only single stream files are
+ * supported, as the tools make them.
+ *
+ * Returns 0 on success, or < 0 if the length isn't known
+ */
+int compression_length(int fd, enum compression c, uint64_t *len);
+
+/**
+ * compression_count - get the uncompressed length by decompressing a file
+ * @filename: the compressed file
+ * @c: its compression
+ * @len: the uncompressed length
+ *
+ * The fallback of compression_length(), for the files which don't record
+ * their length, such as the ones compressed from a pipe by zstd.
+ *
+ * Returns 0 on success, or < 0 if the file couldn't be decompressed
+ */
+int compression_count(const char *filename, enum compression c,
+		      uint64_t *len);
+
+/**
+ * compression_pipe - run the tool compressing or decompressing a file
+ * @filename: the compressed file
+ * @c: its compression
+ * @compress: 1 to create filename, 0 to read it
+ * @pid: the pid of the tool
+ *
+ * To compress, the multi-threaded compressors are used : pigz if available,
+ * xz -T0, and zstd -T0.
+ *
+ * Returns the pipe to write the content to compress into, or to read the
+ * decompressed content from, or < 0 if an error occurred
+ */
+int compression_pipe(const char *filename, enum compression c, int compress,
+		     pid_t *pid);
+
+/**
+ * compression_wait - wait for the end of a compression tool
+ * @pid: its pid
+ *
+ * Returns 0 if the tool succeeded, or < 0 otherwise
+ */
+int compression_wait(pid_t pid);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include <stdint.h>
+
+#include <list.h>
+
+/*
+ * Daemon protocol, over a local UNIX socket, in host byte order.
+ *
+ * A client sends one request : a struct daemon_request, followed by nb_ops
+ * operations, each being a struct daemon_op followed by arglen bytes of
+ * argument. String arguments are not NUL terminated, enumerated arguments are
+ * a uint32_t.
+ *
+ * The daemon answers with a stream of struct daemon_msg, each followed by len
+ * bytes : DAEMON_MSG_LOG carry the messages printed while running the
+ * operations, and a final DAEMON_MSG_STATUS carries the int32_t result.
+ */
+#define DAEMON_MAGIC		0x44325246
+#define DAEMON_MAX_OPS		256
+
+enum daemon_msg_type {
+	DAEMON_MSG_LOG = 1,
+	DAEMON_MSG_STATUS,
+};
+
+struct daemon_request {
+	uint32_t magic;
+	uint16_t nb_ops;
+} __attribute__((packed));
+
+struct daemon_op {
+	uint8_t op;
+	uint16_t arglen;
+} __attribute__((packed));
+
+struct daemon_msg {
+	uint8_t type;
+	uint32_t len;
+} __attribute__((packed));
+
+int daemon_serve(const char *socket_path, struct list_head *ops);
+int daemon_submit(const char *socket_path, struct list_head *ops);
+
+#endif
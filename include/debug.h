@@ -53,5 +53,12 @@ static inline void dbg_level_inc(void)
 void print_leveled(const char *debug_module, enum msglevel level,
 		   const char *format, ...);
 
+/**
+ * print_set_hook - redirect the printed messages
+ * @hook: the function receiving each formatted message, NULL for stdout
+ * @data: the cookie passed to hook
+ */
+void print_set_hook(void (*hook)(void *data, const char *msg), void *data);
+
 #endif
 
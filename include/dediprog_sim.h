@@ -0,0 +1,49 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __DEDIPROG_SIM_H__
+#define __DEDIPROG_SIM_H__
+
+#include <usb_util.h>
+
+/**
+ * sf100_sim_open - plug a simulated Dediprog SF100
+ * @image1: the file holding the content of the target 1 chip
+ * @image2: the file holding the content of the target 2 chip, or NULL
+ * @firmware: the firmware version the device tells, such as "6.0.0"
+ * @latency_us: the delay of each USB transfer
+ *
+ * The SF100 is modelled in-process, and carries the USB transfers until it is
+ * closed : Command A, the device string, the LEDs, the SPI speed and voltage,
+ * the SPI commands, and the page reads and writes of the firmwares before and
+ * after 5.5.0. Each target is the first known SPI chip of its image size,
+ * holding the image content. A target without image is an erased copy of the
+ * target 1 chip.
+ *
+ * Returns the device handle, or NULL if an error occurred
+ */
+usb_dev_handle *sf100_sim_open(const char *image1, const char *image2,
+			       const char *firmware, unsigned int latency_us);
+
+/**
+ * sf100_sim_close - unplug the simulated SF100, and save the chip contents
+ * @dev: the device handle
+ *
+ * Returns 0 on success, or < 0 if a chip content couldn't be saved
+ */
+int sf100_sim_close(usb_dev_handle *dev);
+
+#endif
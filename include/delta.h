@@ -0,0 +1,99 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+#include <stdint.h>
+
+#define DELTA_MAGIC "FR2DELT"
+#define DELTA_VERSION 2
+
+/* Number of unchanged blocks checked on the chip to recognize the base image */
+#define DELTA_MAX_CHECKS 16
+
+/* The new content of the block is all 0xff, and isn't stored */
+#define DELTA_BLANK (1 << 0)
+/* The block is unchanged, and only checked on the chip */
+#define DELTA_CHECK (1 << 1)
+
+/*
+ * Delta layout : a header, then a record per changed or checked block, by
+ * increasing block index. Each record of a changed and not blank block is
+ * followed by the new content of the block. The CRC32C of the base and new
+ * content of the block let the chip be checked block by block.
+ *
+ * The checked blocks are blank ones only where their slice of the image has
+ * no other unchanged block. The header base_crc is the CRC32C of all the
+ * unchanged blocks in order, checked when too few non blank blocks could be
+ * sampled to recognize the base image. new_crc is the one of the whole update.
+ */
+struct delta_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint64_t image_len;
+	uint32_t base_crc;
+	uint32_t new_crc;
+	uint32_t nb_records;
+} __attribute__((packed));
+
+struct delta_record {
+	uint32_t index;
+	uint32_t flags;
+	uint32_t base_crc;
+	uint32_t new_crc;
+} __attribute__((packed));
+
+struct delta {
+	struct delta_header hdr;
+	struct delta_record *records;
+	/* The new content of each changed and not blank record, else NULL */
+	unsigned char **data;
+	unsigned char *content;
+};
+
+/**
+ * delta_make - compute the delta between two images of the same size
+ * @base: the image the delta applies to
+ * @update: the image the delta gives
+ * @filename: the delta file to create
+ * @block_size: the size of the blocks compared
+ *
+ * Returns the number of changed blocks, or < 0 if an error occurred
+ */
+int delta_make(const char *base, const char *update, const char *filename,
+	       uint32_t block_size);
+
+/**
+ * delta_load - load a delta file
+ * @filename: the delta file, which may be compressed like an image
+ * @d: the delta, to release with delta_release()
+ *
+ * Returns 0 on success, or < 0 if an error occurred
+ */
+int delta_load(const char *filename, struct delta *d);
+void delta_release(struct delta *d);
+
+static inline uint32_t delta_block_len(const struct delta *d, uint32_t index)
+{
+	uint64_t start = (uint64_t)index * d->hdr.block_size;
+
+	return d->hdr.image_len - start < d->hdr.block_size ?
+		d->hdr.image_len - start : d->hdr.block_size;
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __DIFF_H__
+#define __DIFF_H__
+
+#include <stdint.h>
+#include <unistd.h>
+
+/* The new content of the block is all 0xff : an erase is enough */
+#define DIFF_BLANK		(1 << 0)
+/* The block changed, but only by clearing bits : no erase is needed */
+#define DIFF_BITS_CLEARED	(1 << 1)
+/* The block changed, and some bits go back to 1 : an erase is needed */
+#define DIFF_NEEDS_ERASE	(1 << 2)
+
+struct diff_range {
+	off_t start;
+	size_t len;
+};
+
+struct diff_ranges {
+	struct diff_range *range;
+	int nb;
+	int alloc;
+};
+
+/*
+ * Result of the comparison of one block. The ranges are page aligned, sorted,
+ * and contiguous pages are merged into one range.
+ */
+struct diff_block {
+	int flags;
+	/* Pages which differ between the old and new content */
+	struct diff_ranges changed;
+	/* Pages of the new content which are not blank */
+	struct diff_ranges data;
+};
+
+/**
+ * diff_compute_block - compare the old and new content of a block
+ * @old: the current content of the block
+ * @new: the content the block should have
+ * @base: the address of the block on the chip
+ * @len: the length of the block
+ * @page_size: the size of the chip pages
+ * @diff: the result
+ *
+ * Both contents are scanned once, page by page, with the widest vector
+ * instructions the CPU provides.
+ *
+ * Returns 0 on success, or < 0 if an error occurred
+ */
+int diff_compute_block(const uint8_t *old, const uint8_t *new, off_t base,
+		       size_t len, unsigned int page_size,
+		       struct diff_block *diff);
+
+/**
+ * diff_release_block - free the ranges of a block comparison
+ * @diff: the result of diff_compute_block()
+ */
+void diff_release_block(struct diff_block *diff);
+
+/**
+ * diff_is_blank - check if a buffer is all 0xff
+ * @buf: the buffer
+ * @len: the length of buf
+ *
+ * Returns 1 if buf is blank, 0 otherwise
+ */
+int diff_is_blank(const uint8_t *buf, size_t len);
+
+/**
+ * diff_data_ranges - find the pages which are not blank
+ * @buf: the content of the zone
+ * @base: the address of the zone on the chip
+ * @len: the length of the zone
+ * @page_size: the size of the chip pages
+ * @ranges: the non blank pages, to be released with diff_release_ranges()
+ *
+ * Returns 0 on success, or < 0 if an error occurred
+ */
+int diff_data_ranges(const uint8_t *buf, off_t base, size_t len,
+		     unsigned int page_size, struct diff_ranges *ranges);
+void diff_release_ranges(struct diff_ranges *ranges);
+
+#endif
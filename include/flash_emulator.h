@@ -0,0 +1,94 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __FLASH_EMULATOR_H__
+#define __FLASH_EMULATOR_H__
+
+#include <stdint.h>
+#include <unistd.h>
+
+/*
+ * In-memory model of a SPI NOR chip, answering to the JEDEC commands the SPI
+ * layer issues : RDID, RDSR, WREN, WRDI, READ, PP, AAI and the block/chip
+ * erases. Programming only clears bits, as a real NOR would.
+ */
+struct flash_emulator {
+	uint8_t *mem;
+	size_t size;
+	unsigned int page_size;
+	uint8_t id[3];
+	uint8_t status;
+	int ewsr;
+	int aai;
+	off_t aai_addr;
+	unsigned long nb_commands;
+};
+
+/**
+ * flash_emulator_init - create a blank emulated chip
+ * @emu: the emulator
+ * @size: the chip size in bytes
+ * @page_size: the chip page size in bytes
+ * @manufacture_id: the JEDEC manufacturer answered to RDID
+ * @model_id: the JEDEC model answered to RDID
+ *
+ * Returns 0 on success, or -ENOMEM
+ */
+int flash_emulator_init(struct flash_emulator *emu, size_t size,
+			unsigned int page_size, uint32_t manufacture_id,
+			uint32_t model_id);
+void flash_emulator_release(struct flash_emulator *emu);
+
+/**
+ * flash_emulator_load - emulate the chip holding an image
+ * @emu: the emulator
+ * @image: the image file
+ *
+ * The first known SPI chip of the size of @image is emulated, with the image
+ * content.
+ *
+ * Returns 0 on success, or < 0 if an error occurred
+ */
+int flash_emulator_load(struct flash_emulator *emu, const char *image);
+
+/**
+ * flash_emulator_save - write the emulated chip content into a file
+ * @emu: the emulator
+ * @image: the file to write
+ *
+ * Returns 0 on success, or < 0 if an error occurred
+ */
+int flash_emulator_save(struct flash_emulator *emu, const char *image);
+
+/**
+ * flash_emulator_command - execute one SPI command
+ * @emu: the emulator
+ * @writecnt: the number of bytes of the command
+ * @readcnt: the number of bytes to answer
+ * @writearr: the command bytes
+ * @readarr: the answer bytes
+ *
+ * Returns 0 on success, or -EINVAL for an unknown or malformed command
+ */
+int flash_emulator_command(struct flash_emulator *emu, unsigned int writecnt,
+			   unsigned int readcnt, const unsigned char *writearr,
+			   unsigned char *readarr);
+int flash_emulator_read(struct flash_emulator *emu, uint8_t *buf,
+			off_t start, size_t len);
+int flash_emulator_program(struct flash_emulator *emu, const uint8_t *buf,
+			   off_t start, size_t len);
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stdint.h>
+#include <unistd.h>
+
+/**
+ * crc32c - compute a CRC32C (Castagnoli) checksum
+ * @crc: the checksum of the preceding data, 0 for the first chunk
+ * @buf: the data to checksum
+ * @len: the length of data
+ *
+ * The checksum can be computed incrementally, by feeding back the result of
+ * the previous call as @crc.
+ *
+ * Returns the updated checksum
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <stdint.h>
+#include <unistd.h>
+
+/*
+ * Image files are either raw, sparse containers where only the non blank (not
+ * all 0xff) runs of the image are stored, or raw images compressed by gzip, xz
+ * or zstd. All are read the same way.
+ */
+struct image;
+struct image_cache;
+
+/**
+ * image_open - open an image file for reading
+ * @filename: the image file
+ *
+ * Returns the image, or NULL if an error occurred, errno being set
+ */
+struct image *image_open(const char *filename);
+
+/**
+ * image_length - get the length of the image content
+ * @img: the image
+ *
+ * For a sparse container, this is the length of the expanded image.
+ */
+uint64_t image_length(struct image *img);
+
+/**
+ * image_compressed - tell whether an image file is compressed
+ * @img: the image
+ *
+ * The gzip, xz and zstd files are decompressed on the fly, and are best read
+ * in order : reading backwards restarts the decompression.
+ */
+int image_compressed(struct image *img);
+
+/**
+ * image_read - read a part of an image
+ * @img: the image
+ * @buf: the buffer to read into
+ * @offset: the offset in the image
+ * @len: the number of bytes to read
+ *
+ * Returns 0 on success, or < 0 if an error occurred
+ */
+int image_read(struct image *img, unsigned char *buf, uint64_t offset,
+	       size_t len);
+void image_close(struct image *img);
+
+/**
+ * image_create_sparse - create a sparse container
+ * @filename: the container file
+ * @block_size: the granularity of the blank runs detection
+ *
+ * The content is then added sequentially with image_append(), and the
+ * container is completed by image_finish().
+ *
+ * Returns the image, or NULL if an error occurred, errno being set
+ */
+struct image *image_create_sparse(const char *filename, uint32_t block_size);
+int image_append(struct image *img, const unsigned char *buf, size_t len);
+int image_finish(struct image *img);
+
+/**
+ * image_size - get the length of an image file content
+ * @filename: the image file
+ *
+ * Returns the image length, or < 0 if an error occurred
+ */
+ssize_t image_size(const char *filename);
+
+/**
+ * image_load - load an image file into memory
+ * @filename: the image file
+ * @buf: the buffer to load the image into
+ * @len: the number of bytes to load
+ *
+ * If a raw image has a valid manifest, the blocks it marks as blank are not
+ * read from the file, but filled with 0xff.
+ *
+ * Returns 0 on success, or < 0 if an error occurred
+ */
+int image_load(const char *filename, unsigned char *buf, size_t len);
+
+/* The number of images an image cache keeps */
+#define IMAGE_CACHE_MAX 4
+
+/**
+ * image_cache_get - get the content of an image file, loading it if needed
+ * @cache: the cache, NULL while empty
+ * @filename: the image file
+ * @len: the length of the image content
+ *
+ * The last loaded images are kept in the cache, as long as their file isn't
+ * modified. A compressed image is decompressed by a background thread, and its
+ * content must be waited for with image_cache_wait().
+ *
+ * Returns the image content, valid until the cache is released, or NULL if an
+ * error occurred
+ */
+const unsigned char *image_cache_get(struct image_cache **cache,
+				     const char *filename, size_t *len);
+void image_cache_release(struct image_cache **cache);
+
+/**
+ * image_cache_wait - wait for a part of an image content
+ * @cache: the cache
+ * @p: the start of the part, within an image content of the cache
+ * @len: the length of the part
+ *
+ * Buffers which are not cached images are always available.
+ *
+ * Returns 0 once the part is available, or < 0 if its decompression failed
+ */
+int image_cache_wait(struct image_cache **cache, const unsigned char *p,
+		     size_t len);
+
+/**
+ * image_cache_available - get how much of a part of an image content is there
+ * @cache: the cache
+ * @p: the start of the part, within an image content of the cache
+ * @len: the length of the part
+ *
+ * Returns the length of the beginning of the part already available
+ */
+size_t image_cache_available(struct image_cache **cache,
+			     const unsigned char *p, size_t len);
+
+/**
+ * image_cache_span - get the blocks of the same kind at the start of a part
+ * @cache: the cache
+ * @p: the start of the part, within an image content of the cache
+ * @len: the length of the part
+ * @blank: set if the blocks are blank
+ *
+ * Only the images hashed by the preload have their blank blocks known, the
+ * other buffers being a single span of non blank blocks.
+ *
+ * Returns the length of the span at the start of the part
+ */
+size_t image_cache_span(struct image_cache **cache, const unsigned char *p,
+			size_t len, int *blank);
+
+/* A file to load in the background */
+struct image_preload_file {
+	const char *filename;
+};
+
+struct image_preload;
+
+/**
+ * image_preload_start - prepare image files on a background thread
+ * @files: the files, which must stay valid until image_preload_finish()
+ * @nb_files: the number of files
+ *
+ * The files to load are loaded into a private image cache, along with their
+ * manifest, which is hashed in memory if the file has no valid one. The
+ * errors are left to the operations which use the files.
+ *
+ * Returns the preload, or NULL if it couldn't be started
+ */
+struct image_preload *
+image_preload_start(const struct image_preload_file *files, int nb_files);
+
+/**
+ * image_preload_finish - wait for the preload, and hand over its images
+ * @preload: the preload
+ * @cache: the image cache receiving the loaded images
+ */
+void image_preload_finish(struct image_preload *preload,
+			  struct image_cache **cache);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <list.h>
+
+struct context;
+
+enum journal_mode {
+	JOURNAL_OFF = 0,
+	JOURNAL_ON,
+	JOURNAL_RESUME,
+};
+
+enum journal_state {
+	JOURNAL_PENDING = 0,
+	JOURNAL_ERASED,
+	JOURNAL_PROGRAMMED,
+	JOURNAL_VERIFIED,
+};
+
+struct journal;
+
+/**
+ * journal_open - open the progress journal of a write
+ * @ctx: the context, giving the chip identity
+ * @image: the image to be written
+ * @len: the length of the image
+ * @start: the address on the chip where the image is written
+ * @erases: the list of erase blocks of the write, see compute_list_erases()
+ * @resume: if not 0, reuse the states of an existing matching journal
+ *
+ * The journal is stored in flashrom2 cache directory, under a name made of the
+ * image hash and the chip identity. It holds one state per erase block, and
+ * each state change is synced to disk before the next chip operation.
+ *
+ * Returns the journal, or NULL if it couldn't be created
+ */
+struct journal *journal_open(struct context *ctx, const unsigned char *image,
+			     size_t len, off_t start, struct list_head *erases,
+			     int resume);
+enum journal_state journal_get_state(struct journal *j, int block);
+int journal_set_state(struct journal *j, int block, enum journal_state state);
+int journal_first_incomplete(struct journal *j);
+
+/**
+ * journal_close - close a journal
+ * @j: the journal
+ * @completed: if not 0, the write is finished and the journal is removed
+ */
+void journal_close(struct journal *j, int completed);
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __LIBFLASHROM2_H__
+#define __LIBFLASHROM2_H__
+
+/*
+ * libflashrom2 : drive flashrom2 from another program.
+ *
+ * A context holds one opened programmer and its probed chip. Jobs submitted on
+ * a context are carried out in submission order by a worker thread, on
+ * buffers owned by the caller, which must stay valid until the job completion.
+ *
+ * Completion can be waited for with fr2_job_wait(), polled on the file
+ * descriptor returned by fr2_event_fd(), or notified through the job callback.
+ * Callbacks are called from the worker thread. Probing the chip or changing
+ * the write strategy waits until the running job is over.
+ *
+ * Chips and programmers register themselves through constructors. When
+ * linking against the static library, use -Wl,--whole-archive so that they
+ * are not discarded by the linker.
+ */
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FR2_API_VERSION 1
+
+struct fr2_context;
+struct fr2_job;
+
+enum fr2_event {
+	FR2_EVENT_PROGRESS = 0,
+	FR2_EVENT_DONE,
+};
+
+/**
+ * fr2_callback - job notification
+ * @job: the job
+ * @event: FR2_EVENT_PROGRESS while running, FR2_EVENT_DONE once completed
+ * @done: the number of bytes already processed
+ * @total: the total number of bytes of the job
+ * @data: the cookie given at submission
+ *
+ * The DONE callback is called before the job is marked completed, so that the
+ * job may be freed as soon as fr2_job_wait() returns.
+ */
+typedef void (*fr2_callback)(struct fr2_job *job, enum fr2_event event,
+			     size_t done, size_t total, void *data);
+
+int fr2_api_version(void);
+
+/*
+ * Messages are printed on stdout, unless a log callback is set. The verbosity
+ * goes from 0 (errors only) to 4 (verbose debug), and is 2 by default.
+ */
+void fr2_set_log_callback(void (*log)(void *data, const char *msg),
+			  void *data);
+void fr2_set_verbosity(int level);
+
+/**
+ * fr2_open - open a programmer
+ * @programmer_args: the programmer and its parameters, as for --programmer
+ *
+ * Returns a new context, or NULL if the programmer couldn't be opened
+ */
+struct fr2_context *fr2_open(const char *programmer_args);
+
+/**
+ * fr2_probe - probe the chip behind the programmer
+ * @ctx: the context
+ * @chipname: the chip name, as for --chip, or NULL for automatic
+ *
+ * Returns 0 if the chip was found, < 0 otherwise
+ */
+int fr2_probe(struct fr2_context *ctx, const char *chipname);
+const char *fr2_chip_name(struct fr2_context *ctx);
+size_t fr2_chip_size(struct fr2_context *ctx);
+
+/**
+ * fr2_set_write_strategy - choose how write jobs are carried out
+ * @ctx: the context
+ * @strategy: a strategy name, as for --write-strategy
+ *
+ * Returns 0 on success, < 0 if the strategy is unknown
+ */
+int fr2_set_write_strategy(struct fr2_context *ctx, const char *strategy);
+
+/**
+ * fr2_event_fd - get the completion file descriptor
+ * @ctx: the context
+ *
+ * The file descriptor becomes readable when jobs complete. Reading 8 bytes
+ * from it returns the number of jobs completed since the last read.
+ */
+int fr2_event_fd(struct fr2_context *ctx);
+
+struct fr2_job *fr2_submit_read(struct fr2_context *ctx, void *buf,
+				off_t where, size_t len, fr2_callback cb,
+				void *data);
+struct fr2_job *fr2_submit_write(struct fr2_context *ctx, const void *buf,
+				 off_t where, size_t len, fr2_callback cb,
+				 void *data);
+struct fr2_job *fr2_submit_verify(struct fr2_context *ctx, const void *buf,
+				  off_t where, size_t len, fr2_callback cb,
+				  void *data);
+
+/*
+ * Job results are 0 on success and < 0 on error. A verify job which found a
+ * difference completes with -EIO.
+ */
+int fr2_job_status(struct fr2_job *job);
+int fr2_job_wait(struct fr2_job *job);
+void fr2_job_free(struct fr2_job *job);
+
+/**
+ * fr2_close - close the programmer
+ * @ctx: the context
+ *
+ * The pending jobs are completed before the programmer is shut down.
+ */
+void fr2_close(struct fr2_context *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
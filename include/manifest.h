@@ -0,0 +1,109 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__
+
+#include <stdint.h>
+#include <unistd.h>
+
+/* The manifest of image.bin is stored beside it, in image.bin.blkhash */
+#define MANIFEST_SUFFIX ".blkhash"
+
+/* Default block size, the smallest erase block of SPI NOR chips */
+#define MANIFEST_BLOCK_SIZE (4 * 1024)
+
+/* The block is all 0xff */
+#define MANIFEST_BLANK (1 << 0)
+
+/*
+ * An image manifest : the image is cut into blocks of block_size bytes (the
+ * last one may be shorter), which is the erase block size the manifest was
+ * made for. The CRC32C and the flags of each block are recorded.
+ */
+struct manifest {
+	uint64_t image_len;
+	uint32_t block_size;
+	uint32_t nb_blocks;
+	uint32_t *crc;
+	uint8_t *flags;
+};
+
+/**
+ * manifest_init - allocate an empty manifest
+ * @m: the manifest
+ * @image_len: the length of the image
+ * @block_size: the size of a block
+ *
+ * Returns 0 on success, or < 0 if an error occurred
+ */
+int manifest_init(struct manifest *m, uint64_t image_len,
+		  uint32_t block_size);
+void manifest_release(struct manifest *m);
+
+/**
+ * manifest_hash - fill the hashes of the blocks covered by a buffer
+ * @m: the manifest
+ * @buf: the image data
+ * @offset: the offset of buf in the image, on a block boundary
+ * @len: the length of buf
+ */
+void manifest_hash(struct manifest *m, const uint8_t *buf, uint64_t offset,
+		   size_t len);
+
+static inline int manifest_block_blank(const struct manifest *m, uint32_t i)
+{
+	return m->flags[i] & MANIFEST_BLANK;
+}
+
+/**
+ * manifest_build - compute the manifest of an image file
+ * @image: the path of the image
+ * @block_size: the size of a block
+ * @m: the manifest
+ *
+ * The image is hashed by as many threads as there are online CPUs.
+ *
+ * Returns 0 on success, or < 0 if an error occurred
+ */
+int manifest_build(const char *image, uint32_t block_size,
+		   struct manifest *m);
+
+/**
+ * manifest_load_for_image - load the manifest of an image
+ * @image: the path of the image
+ * @m: the manifest
+ *
+ * The manifest is only loaded if it was made from this very image file : the
+ * same device, inode, size and modification time.
+ *
+ * Returns 0 on success, or < 0 if no valid manifest was found
+ */
+int manifest_load_for_image(const char *image, struct manifest *m);
+
+/**
+ * manifest_save_for_image - store the manifest of an image beside it
+ * @image: the path of the image
+ * @m: the manifest
+ *
+ * The manifest records the identity of the image file at the time it is
+ * stored, which must therefore be the file content m was computed from.
+ *
+ * Returns 0 on success, or < 0 if an error occurred
+ */
+int manifest_save_for_image(const char *image, const struct manifest *m);
+
+#endif
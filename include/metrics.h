@@ -0,0 +1,67 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+#include <unistd.h>
+
+struct metric {
+	const char *name;
+	unsigned long count;
+	uint64_t bytes;
+	uint64_t usecs;
+	/* Bus transfers planned for the bytes, 0 if not known */
+	unsigned long transfers;
+};
+
+/* Lookups of a cache, and the bytes served by the hits */
+struct cache_metric {
+	const char *name;
+	unsigned long hits;
+	unsigned long misses;
+	uint64_t hit_bytes;
+};
+
+/**
+ * metrics_now - get a monotonic timestamp
+ *
+ * Returns the current time in microseconds
+ */
+uint64_t metrics_now(void);
+
+/**
+ * metric_account - account one transfer into a metric
+ * @m: the metric
+ * @bytes: the number of bytes transferred
+ * @since: the timestamp taken with metrics_now() before the transfer
+ */
+void metric_account(struct metric *m, size_t bytes, uint64_t since);
+
+/**
+ * metric_print - print a metric summary
+ * @m: the metric
+ */
+void metric_print(const struct metric *m);
+
+/**
+ * cache_metric_print - print a cache hit rate
+ * @m: the cache metric
+ */
+void cache_metric_print(const struct cache_metric *m);
+
+#endif
@@ -21,6 +21,7 @@
 
 #include <list.h>
 
+#include <journal.h>
 #include <write_strategy.h>
 
 enum operation_type {
@@ -30,6 +31,14 @@ enum operation_type {
 	SET_WRITE_STRATEGY,
 	SET_CHIP,
 	SET_PROGRAMMER,
+	SET_JOURNAL,
+	BENCHMARK,
+	MAKE_MANIFEST,
+	READ_SPARSE,
+	SET_TARGET,
+	SET_BLOCK_CACHE,
+	APPLY_DELTA,
+	MAKE_DELTA,
 	LAST_OPERATION_TYPE,
 };
 
@@ -38,14 +47,51 @@ struct operation {
 	union {
 		char *filename;
 		enum write_strategy write_strategy;
+		enum journal_mode journal_mode;
 		char *programmer;
 		char *chipname;
+		int target;
+		struct {
+			unsigned int max_kb;
+			int verify_uncached;
+		} block_cache;
 	} arg;
 	struct list_head list;
 };
 
+struct context;
+
 void operation_add_tail(struct operation *op);
 void operation_add(struct operation *op);
+
+/*
+ * Before running them, the operations are planned : the consecutive reads and
+ * verifies are fused into one read of the chip, and a write followed by the
+ * verify of the same file verifies the chip against the written image.
+ * operations_explain() prints the plan instead of running it.
+ */
+int operations_run(struct context *ctx, struct list_head *ops);
 int operations_launch(void);
+int operations_explain(void);
+
+/*
+ * Repeat the operations added so far for each target of the comma separated
+ * list targets, each time after selecting the target and probing its chip
+ * with op_chip.
+ */
+int operations_for_targets(const char *targets, struct operation *op_chip);
+
+/*
+ * Daemon mode : operations_serve() runs the operations list once, then keeps
+ * the programmer open and runs the lists submitted by operations_submit().
+ */
+int operations_serve(const char *socket_path);
+int operations_submit(const char *socket_path);
+
+/*
+ * Remote mode : operations_serve_remote() runs the operations list once, then
+ * lends the programmer to the remote programmer of other flashrom2 instances.
+ */
+int operations_serve_remote(const char *address);
 
 #endif
@@ -21,16 +21,166 @@
 
 #include <unistd.h>
 
+#include <image.h>
+#include <manifest.h>
 #include <programmer.h>
 
+/* The verifies read the chip by chunks of this size */
+#define VERIFY_CHUNK_SIZE (64 * 1024)
+
 int op_set_chip(struct context *context, char *programmer_args);
 int op_set_programmer(struct context *context, char *programmer_args);
 int op_read_chip(struct context *context, char *filename,
 		 off_t where, size_t len);
+int op_read_chip_sparse(struct context *context, char *filename,
+			off_t where, size_t len);
 int op_write_chip(struct context *context, char *filename,
 		  off_t where, size_t len);
 int op_verify_chip(struct context *context, char *filename,
 		   off_t where, size_t len);
+int op_set_target(struct context *context, int target);
+int op_benchmark_chip(struct context *context);
+int op_make_manifest(struct context *context, char *filename);
+int op_write_verify_chip(struct context *context, char *filename);
+
+/**
+ * write_parts_composite - tell whether a write is a composite one
+ * @arg: the file argument of the write
+ *
+ * A composite write is a comma separated list of file@offset, such as
+ * "boot.bin@0,kernel.bin@0x20000". An existing file is never taken for one.
+ *
+ * Returns 1 if arg is a composite write, 0 otherwise
+ */
+int write_parts_composite(const char *arg);
+
+/**
+ * op_write_composite - write several files at their offsets in one pass
+ * @context: the context
+ * @arg: the composite write, a comma separated list of file@offset
+ *
+ * The files are merged into zones of the chip, each one erased and programmed
+ * once through the write strategy and journal mode. The chip content between
+ * the files is left untouched.
+ *
+ * Returns 0 on success, -EINVAL if a file doesn't fit in the chip, overlaps
+ * another one, or isn't on erase block boundaries under a journal, or < 0 if
+ * another error occurred.
+ */
+int op_write_composite(struct context *context, char *arg);
+
+/**
+ * op_apply_delta - update the chip with a delta
+ * @context: the context
+ * @filename: the delta file
+ *
+ * The changed blocks, and a few unchanged ones, are read and checked against
+ * the delta hashes of the base image before anything is written. The changed
+ * blocks are then written along with the rest of their erase blocks, following
+ * the write strategy and journal mode, and read back.
+ *
+ * Returns 0 on success, -EINVAL if the chip doesn't hold the base image, or
+ * < 0 if another error occurred.
+ */
+int op_apply_delta(struct context *context, char *filename);
+int op_make_delta(struct context *context, char *files);
+
+/* One of the operations fused into a single read of the chip */
+struct scan_part {
+	char *filename;
+	int verify;
+};
+
+/**
+ * op_scan_chip - read the chip once for several reads and verifies
+ * @context: the context
+ * @parts: the reads and verifies, in their order in the operations list
+ * @nb_parts: the number of parts
+ *
+ * The chip is read from its start, up to the biggest zone of the parts. The
+ * parts are completed in their order, and the first failing one stops the
+ * following ones, the reads of which don't store their file.
+ *
+ * Returns 0 on success, or the error of the failing part.
+ */
+int op_scan_chip(struct context *context, struct scan_part *parts,
+		 int nb_parts);
+
+/**
+ * chip_read_store - store the content read from the chip into a file
+ * @filename: the file
+ * @buf: the chip content
+ * @len: the length of the content
+ *
+ * The manifest of the file is stored beside it.
+ *
+ * Returns 0 on success, or < 0 if an error occurred.
+ */
+int chip_read_store(char *filename, const unsigned char *buf, size_t len);
+
+/*
+ * A verify in progress : the chip content is given chunk by chunk, in order,
+ * each chunk on a block boundary of the manifest.
+ */
+struct chip_verify {
+	char *filename;
+	const unsigned char *image;
+	struct image *img;
+	struct manifest m;
+	int have_manifest;
+	off_t where;
+	size_t len;
+	unsigned int nb_bad;
+};
+
+/**
+ * chip_verify_start - prepare the verify of a zone of the chip
+ * @context: the context
+ * @v: the verify
+ * @filename: the image file
+ * @image: the image content if already loaded, or NULL to read the file
+ * @image_len: the length of image
+ * @where: the address of the zone on the chip
+ * @len: the length of the zone, 0 for the whole image
+ *
+ * Returns 0 on success, or < 0 if an error occurred, in which case the verify
+ * is already finished.
+ */
+int chip_verify_start(struct context *context, struct chip_verify *v,
+		      char *filename, const unsigned char *image,
+		      size_t image_len, off_t where, size_t len);
+int chip_verify_chunk(struct context *context, struct chip_verify *v,
+		      const unsigned char *buf, size_t pos, size_t n);
+
+/**
+ * chip_verify_finish - report the verify result, and release it
+ * @context: the context
+ * @v: the verify
+ * @ret: 0, or the error which interrupted the verify
+ *
+ * Returns 0 if the zone matches the image, or < 0 otherwise.
+ */
+int chip_verify_finish(struct context *context, struct chip_verify *v,
+		       int ret);
+
+static inline size_t chip_verify_chunk_size(struct chip_verify *v)
+{
+	return v->m.block_size * (VERIFY_CHUNK_SIZE / v->m.block_size ? : 1);
+}
+
+/**
+ * chip_write_image - write a buffer into the chip
+ * @context: the context
+ * @buf: the data to write
+ * @where: the address on the chip where to write
+ * @len: the length of data
+ *
+ * The write follows the context write strategy and journal mode.
+ *
+ * Returns >= 0 on success, or < 0 if an error occurred.
+ */
+int chip_write_image(struct context *context, const unsigned char *buf,
+		     off_t where, size_t len);
 
 static inline int op_set_write_strategy(struct context *context,
 					enum write_strategy strategy)
@@ -39,4 +189,19 @@ static inline int op_set_write_strategy(struct context *context,
 	return 0;
 }
 
+static inline int op_set_journal(struct context *context,
+				 enum journal_mode mode)
+{
+	context->journal_mode = mode;
+	return 0;
+}
+
+static inline int op_set_block_cache(struct context *context,
+				     unsigned int max_kb, int verify_uncached)
+{
+	context->block_cache_max = (size_t)max_kb * 1024;
+	context->verify_uncached = verify_uncached;
+	return 0;
+}
+
 #endif
@@ -31,7 +31,8 @@
  * This function return name for param_name = "".
  * If param_name is not found, return NULL.
  *
- * Returns the paramater value if found, or NULL if not
+ * Returns the paramater value if found, to be freed by the caller, or NULL if
+ * not
  */
 char *extract_param(const char *input, const char *param_name,
 		    const char *separators);
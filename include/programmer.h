@@ -19,9 +19,12 @@
 #ifndef __PROGRAMMER_H__
 #define __PROGRAMMER_H__
 
+#include <stdint.h>
+
 #include <list.h>
 
 #include <bus.h>
+#include <journal.h>
 #include <spi_programmer.h>
 #include <write_strategy.h>
 
@@ -30,6 +33,8 @@
 #define for_each_programmer(programmer)	\
 	list_for_each_entry(programmer, &programmers, list)
 
+struct context;
+
 struct programmer {
 	const char *name;
 	const char *desc;
@@ -39,16 +44,36 @@ struct programmer {
 
 	int (*probe)(const char *programmer_args, void **pdata);
 	void (*shutdown)(void *pdata);
+	/* Optional, called once a chip was found behind the programmer */
+	int (*chip_setup)(struct context *ctx);
+	/* Optional, switches to another target chip, numbered from 1 */
+	int (*select_target)(struct context *ctx, int target);
+	/* Optional, USB device behind the programmer, checked before probing */
+	uint16_t usb_vid, usb_pid;
 };
 
 struct chip;
 struct flashchip;
+struct block_cache;
+struct buffer_pool;
+struct image_cache;
 
 struct context {
 	struct flashchip *chip;
 	struct programmer *mst;
+	char *programmer_args;
 	void *programmer_data;
 	enum write_strategy write_strategy;
+	enum journal_mode journal_mode;
+	/* Images loaded by the operations, kept for the next ones */
+	struct image_cache *images;
+	/* Buffers of the reads and writes, kept for the next ones */
+	struct buffer_pool *buffers;
+	/* Chip content met by the operations, up to block_cache_max bytes */
+	struct block_cache *blocks;
+	size_t block_cache_max;
+	/* Read backs never use the block cache */
+	int verify_uncached;
 
 	struct list_head list;
 };
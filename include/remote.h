@@ -0,0 +1,102 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __REMOTE_H__
+#define __REMOTE_H__
+
+#include <stdint.h>
+
+#include <list.h>
+
+/*
+ * Remote programmer protocol, over TCP or a UNIX socket, in network byte
+ * order.
+ *
+ * Each request is a struct remote_msg followed by len bytes of payload, and
+ * is answered by a struct remote_msg of the same type and seq, carrying the
+ * status of the request and followed by len bytes of result. The requests are
+ * carried out and answered in order, so a client sends many of them before
+ * reading the answers.
+ *
+ * REMOTE_HELLO : a struct remote_hello, answered by a struct remote_info
+ * REMOTE_SPI : struct remote_spi_cmd, each followed by its writecnt bytes,
+ *	answered by the readcnt bytes of all the commands
+ * REMOTE_READ : a struct remote_range, answered by the len bytes read
+ * REMOTE_WRITE_256, REMOTE_WRITE_AAI : a struct remote_range followed by the
+ *	len bytes to write
+ * REMOTE_SET_CHIP : the chip driver name, not NUL terminated
+ * REMOTE_SET_TARGET : the target number, a uint32_t
+ */
+#define REMOTE_MAGIC		0x46523252
+#define REMOTE_VERSION		1
+/* Biggest payload of a request or an answer */
+#define REMOTE_MAX_LEN		(1024 * 1024)
+/* Reads and writes are cut in requests of this size */
+#define REMOTE_CHUNK		(64 * 1024)
+
+enum remote_msg_type {
+	REMOTE_HELLO = 1,
+	REMOTE_SPI,
+	REMOTE_READ,
+	REMOTE_WRITE_256,
+	REMOTE_WRITE_AAI,
+	REMOTE_SET_CHIP,
+	REMOTE_SET_TARGET,
+};
+
+struct remote_msg {
+	uint8_t type;
+	uint32_t seq;
+	int32_t status;
+	uint32_t len;
+} __attribute__((packed));
+
+struct remote_hello {
+	uint32_t magic;
+	uint32_t version;
+} __attribute__((packed));
+
+struct remote_info {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t max_data_read;
+	uint32_t max_data_write;
+} __attribute__((packed));
+
+struct remote_spi_cmd {
+	uint32_t writecnt;
+	uint32_t readcnt;
+	uint32_t delay_us;
+} __attribute__((packed));
+
+struct remote_range {
+	uint32_t start;
+	uint32_t len;
+} __attribute__((packed));
+
+/**
+ * remote_serve - expose the programmer of the operations to remote clients
+ * @address: a UNIX socket path, or [host]:port to listen on TCP
+ * @ops: the operations setting up the programmer
+ *
+ * The clients are served one at a time, until SIGINT or SIGTERM.
+ *
+ * Returns 0 once stopped, or < 0 if the programmer or the socket couldn't
+ * be set up
+ */
+int remote_serve(const char *address, struct list_head *ops);
+
+#endif
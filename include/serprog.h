@@ -0,0 +1,91 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __SERPROG_H__
+#define __SERPROG_H__
+
+/*
+ * The serprog protocol, version 1, as spoken by the flashrom serprog devices.
+ * Each command byte is followed by its parameters, and answered by S_ACK and
+ * its return value, or by S_NAK. Multi-bytes values are little endian.
+ */
+#define S_ACK			0x06
+#define S_NAK			0x15
+
+#define S_CMD_NOP		0x00	/* No operation */
+#define S_CMD_Q_IFACE		0x01	/* Query interface version */
+#define S_CMD_Q_CMDMAP		0x02	/* Query supported commands bitmap */
+#define S_CMD_Q_PGMNAME		0x03	/* Query programmer name */
+#define S_CMD_Q_SERBUF		0x04	/* Query serial buffer size */
+#define S_CMD_Q_BUSTYPE		0x05	/* Query supported bustypes */
+#define S_CMD_Q_CHIPSIZE	0x06	/* Query supported chipsize (2^n format) */
+#define S_CMD_Q_OPBUF		0x07	/* Query operation buffer size */
+#define S_CMD_Q_WRNMAXLEN	0x08	/* Query Write to opbuf: Write-N maximum length */
+#define S_CMD_R_BYTE		0x09	/* Read a single byte */
+#define S_CMD_R_NBYTES		0x0a	/* Read n bytes */
+#define S_CMD_O_INIT		0x0b	/* Initialize operation buffer */
+#define S_CMD_O_WRITEB		0x0c	/* Write opbuf: Write byte with address */
+#define S_CMD_O_WRITEN		0x0d	/* Write to opbuf: Write-N */
+#define S_CMD_O_DELAY		0x0e	/* Write opbuf: udelay */
+#define S_CMD_O_EXEC		0x0f	/* Execute operation buffer */
+#define S_CMD_SYNCNOP		0x10	/* Special no-operation that returns NAK+ACK */
+#define S_CMD_Q_RDNMAXLEN	0x11	/* Query read-n maximum length */
+#define S_CMD_S_BUSTYPE		0x12	/* Set used bustype(s) */
+#define S_CMD_O_SPIOP		0x13	/* Perform SPI operation */
+#define S_CMD_S_SPI_FREQ	0x14	/* Set SPI clock frequency */
+#define S_CMD_S_PIN_STATE	0x15	/* Enable/disable output drivers */
+
+#define S_IFACE_VERSION		0x01
+#define S_BUS_SPI		(1 << 3)
+#define S_PGMNAME_LEN		16
+#define S_CMDMAP_LEN		32
+
+struct serprog_standin;
+
+/**
+ * serprog_standin_start - serve the serprog protocol on a pseudo terminal
+ * @image: the file holding the content of the emulated chip
+ * @latency_us: the delay before each answer the host waits for
+ *
+ * A thread answers the serprog commands with an emulated chip, the first
+ * known SPI chip of the size of @image, so that the serprog programmer can be
+ * measured and tested without hardware. The latency models the turnaround of
+ * a USB serial adapter : it is paid each time the stand-in runs out of
+ * commands to execute. The chip content is written back to @image when the
+ * stand-in stops.
+ *
+ * Returns the stand-in, or NULL if an error occurred
+ */
+struct serprog_standin *serprog_standin_start(const char *image,
+					      unsigned int latency_us);
+
+/**
+ * serprog_standin_tty - get the pseudo terminal the stand-in answers on
+ * @sp: the stand-in
+ *
+ * Returns the path of the pseudo terminal to open
+ */
+const char *serprog_standin_tty(struct serprog_standin *sp);
+
+/**
+ * serprog_standin_stop - stop the stand-in, and save the chip content
+ * @sp: the stand-in
+ *
+ * Returns 0 on success, or < 0 if the chip content couldn't be saved
+ */
+int serprog_standin_stop(struct serprog_standin *sp);
+
+#endif
@@ -0,0 +1,38 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __SOCKET_H__
+#define __SOCKET_H__
+
+#include <unistd.h>
+
+int unix_listen(const char *path);
+int unix_connect(const char *path);
+/* Connects to host:port, with Nagle's algorithm disabled */
+int tcp_connect(const char *host, const char *port);
+/* Listens on host:port, on all the addresses if host is empty */
+int tcp_listen(const char *host, const char *port);
+/* Accepts a connection, with Nagle's algorithm disabled on TCP ones */
+int socket_accept(int fd);
+
+/*
+ * Blocking transfers of exactly len bytes. They return 0 on success, or < 0
+ * on error or if the peer closed the connection.
+ */
+int read_full(int fd, void *buf, size_t len);
+int write_full(int fd, const void *buf, size_t len);
+
+#endif
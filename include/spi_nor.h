@@ -126,6 +126,7 @@
 /* Status Register Bits */
 #define SPI_SR_WIP	(0x01 << 0)
 #define SPI_SR_WEL	(0x01 << 1)
+#define SPI_SR_BP_MASK	(0x0f << 2)
 #define SPI_SR_AAI	(0x01 << 6)
 
 /* Write Status Enable */
@@ -146,6 +147,8 @@
 /* Write memory byte */
 #define JEDEC_BYTE_PROGRAM		0x02
 #define JEDEC_BYTE_PROGRAM_OUTSIZE	0x05
+/* Most data a page program command carries */
+#define JEDEC_PAGE_PROGRAM_MAX_DATA	256
 #define JEDEC_BYTE_PROGRAM_INSIZE	0x00
 
 /* Write AAI word (SST25VF080B) */
@@ -202,5 +205,8 @@ size_t spi_nbyte_program(struct context *flash, off_t addr,
 		      const uint8_t *bytes, size_t len);
 size_t spi_nbyte_read(struct context *flash, off_t addr, uint8_t *bytes,
 		   size_t len);
+int default_spi_write_aai(struct context *flash, const uint8_t *buf,
+			  off_t start, size_t len);
+int spi_disable_blockprotect(struct context *flash);
 
 #endif		/* !__SPI_H__ */
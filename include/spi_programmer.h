@@ -22,12 +22,16 @@
 
 #define kHz (1000)
 #define MHz (1000 * 1000)
+/* hz=auto : the programmer chooses the fastest reliable SPI clock */
+#define SPI_HZ_AUTO 0
 
 #include <bus_spi.h>
 
 struct spi_programmer {
 	unsigned int max_data_read;
 	unsigned int max_data_write;
+	/* Limits of the opened device, overriding the two above if set */
+	unsigned int (*max_data)(struct context *flash, enum spi_transfer dir);
 	int (*command)(struct context *flash, unsigned int writecnt,
 		       unsigned int readcnt, const unsigned char *writearr,
 		       unsigned char *readarr);
@@ -18,10 +18,83 @@
 #ifndef __USB_UTIL_H__
 #define __USB_UTIL_H__
 
-#include <usb.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <libusb.h>
+
+/*
+ * The drivers are written against the libusb-0.1 names, which map onto
+ * libusb-1.0.
+ */
+typedef libusb_device_handle usb_dev_handle;
+#define USB_ENDPOINT_IN		LIBUSB_ENDPOINT_IN
+#define USB_ENDPOINT_OUT	LIBUSB_ENDPOINT_OUT
+#define USB_TYPE_VENDOR		LIBUSB_REQUEST_TYPE_VENDOR
+#define USB_RECIP_ENDPOINT	LIBUSB_RECIPIENT_ENDPOINT
+
+/**
+ * usb_scan - enumerate the USB busses and devices
+ *
+ * Enumerations are serialized, and skipped while frozen by
+ * usb_scan_freeze(1), so that the devices found by a previous scan stay valid
+ * while several programmers are probed concurrently.
+ */
+void usb_scan(void);
+void usb_scan_freeze(int freeze);
+libusb_device *get_device_by_vid_pid(uint16_t vid, uint16_t pid,
+				     unsigned int device);
+
+/**
+ * usb_open_device - open a device, and claim one of its interfaces
+ * @dev: the device, as found by get_device_by_vid_pid()
+ * @configuration: the configuration to set
+ * @interface: the interface to claim
+ *
+ * Returns the device handle, or NULL if an error occurred
+ */
+usb_dev_handle *usb_open_device(libusb_device *dev, int configuration,
+				int interface);
+void usb_close_device(usb_dev_handle *dev, int interface);
+
+/**
+ * usb_strerror - describe the last failed USB call of the calling thread
+ *
+ * Returns the libusb name of the error
+ */
+const char *usb_strerror(void);
+
+/*
+ * The transfers of the do_usb_*() functions are carried out by a backend :
+ * libusb by default, or an in-process model of a device, so that a driver can
+ * be run and measured without the device. They return the number of bytes
+ * transferred, or < 0 if an error occurred.
+ */
+struct usb_backend {
+	const char *name;
+	int (*control_msg)(usb_dev_handle *dev, int requesttype, int request,
+			   int value, int idx, unsigned char *bytes,
+			   size_t size, int timeout);
+	int (*bulk_read)(usb_dev_handle *dev, int endpoint, unsigned char *buf,
+			 size_t len, int timeout);
+	int (*bulk_write)(usb_dev_handle *dev, int endpoint,
+			  unsigned char *buf, size_t len, int timeout);
+	/* Optional, memory the device reaches without a kernel copy */
+	unsigned char *(*mem_alloc)(usb_dev_handle *dev, size_t len);
+	void (*mem_free)(usb_dev_handle *dev, unsigned char *buf, size_t len);
+};
+
+/**
+ * usb_set_backend - choose the backend of the USB transfers of a device
+ * @dev: the device handle
+ * @backend: the backend, or NULL for libusb
+ *
+ * The backend only carries the transfers of dev, the other handles keep
+ * theirs. It must be reset to NULL before the handle is released.
+ *
+ * Returns 0 on success, or -ENOMEM
+ */
+int usb_set_backend(usb_dev_handle *dev, const struct usb_backend *backend);
 
-struct usb_device *get_device_by_vid_pid(uint16_t vid, uint16_t pid,
-					 unsigned int device);
 int do_usb_control_msg(usb_dev_handle *dev, int requesttype, int request,
 		       int value, int idx, unsigned char *bytes, size_t size,
 		       int timeout);
@@ -34,4 +107,30 @@ int do_usb_bulk_read(usb_dev_handle *dev, int endpoint, unsigned char *buf,
 int do_usb_bulk_write(usb_dev_handle *dev, int endpoint, unsigned char *buf,
 		      size_t len, int timeout);
 
+/*
+ * A bulk transfer buffer. When the kernel supports it, it is usbfs memory
+ * mapped into the process, which the device reads and writes without the
+ * kernel copying it from or to user memory.
+ */
+struct usb_buffer {
+	unsigned char *data;
+	size_t len;
+	int dma;
+	/* The backend the buffer was allocated by, which frees it */
+	const struct usb_backend *backend;
+};
+
+/**
+ * usb_buffer_alloc - allocate a bulk transfer buffer for a device
+ * @dev: the device handle
+ * @ubuf: the buffer
+ * @len: the buffer length
+ *
+ * The buffer is usbfs memory if possible, plain memory otherwise.
+ *
+ * Returns 0 on success, or -ENOMEM
+ */
+int usb_buffer_alloc(usb_dev_handle *dev, struct usb_buffer *ubuf, size_t len);
+void usb_buffer_free(usb_dev_handle *dev, struct usb_buffer *ubuf);
+
 #endif
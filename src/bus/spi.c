@@ -24,6 +24,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <sys/param.h>
 #include <unistd.h>
@@ -78,6 +79,8 @@ int default_spi_send_multicommand(struct context *flash,
 	for (; (cmds->writecnt || cmds->readcnt) && !result; cmds++) {
 		result = spi_send_command(flash, cmds->writecnt, cmds->readcnt,
 					  cmds->writearr, cmds->readarr);
+		if (!result && cmds->delay_us)
+			programmer_delay(cmds->delay_us);
 	}
 	return result;
 }
@@ -96,118 +99,211 @@ size_t spi_nbyte_read(struct context *flash, off_t address, uint8_t *bytes,
 	return spi_send_command(flash, sizeof(cmd), len, cmd, bytes);
 }
 
+/* A 3 bytes address wraps around at 16 MB */
+#define SPI_3BA_SPACE (1 << 24)
+
+/* Biggest transfer of the programmer, or MAX_DATA_UNSPECIFIED */
+unsigned int spi_max_data(struct context *flash, enum spi_transfer dir)
+{
+	const struct spi_programmer *spi = &flash->mst->spi;
+
+	if (spi->max_data)
+		return spi->max_data(flash, dir);
+	return dir == SPI_TRANSFER_READ ? spi->max_data_read :
+		spi->max_data_write;
+}
+
 /*
- * Read a part of the flash chip.
- * FIXME: Use the chunk code from Michael Karcher instead.
- * Each page is read separately in chunks with a maximum size of chunksize.
+ * Length of the transfer starting at pos, and ending at most at end.
+ * Reads are only cut by the programmer max_data_read and the address space of
+ * the read command. Writes are also cut at the chip page boundaries, and by
+ * the page program command size.
  */
-size_t spi_read_chunked(struct context *flash, uint8_t *buf,
-			off_t start, size_t len,
-			size_t chunksize)
+size_t spi_transfer_len(struct context *flash, enum spi_transfer dir,
+			off_t pos, off_t end)
 {
-	int rc = 0;
-	unsigned int i, j, starthere, lenhere, toread;
 	unsigned int page_size = flash->chip->page_size;
+	size_t len = end - pos, max_data;
 
-	/* Warning: This loop has a very unusual condition and body.
-	 * The loop needs to go through each page with at least one affected
-	 * byte. The lowest page number is (start / page_size) since that
-	 * division rounds down. The highest page number we want is the page
-	 * where the last byte of the range lives. That last byte has the
-	 * address (start + len - 1), thus the highest page number is
-	 * (start + len - 1) / page_size. Since we want to include that last
-	 * page as well, the loop condition uses <=.
-	 */
-	for (i = start / page_size; i <= (start + len - 1) / page_size; i++) {
-		/* Byte position of the first byte in the range in this page. */
-		/* starthere is an offset to the base address of the chip. */
-		starthere = MAX(start, i * page_size);
-		/* Length of bytes in the range in this page. */
-		lenhere = MIN(start + len, (i + 1) * page_size) - starthere;
-		for (j = 0; j < lenhere; j += chunksize) {
-			toread = MIN(chunksize, lenhere - j);
-			rc = spi_nbyte_read(flash, starthere + j, buf + starthere - start + j, toread);
-			if (rc)
-				break;
+	len = MIN(len, SPI_3BA_SPACE - pos % SPI_3BA_SPACE);
+	if (dir == SPI_TRANSFER_WRITE) {
+		len = MIN(len, page_size - pos % page_size);
+		len = MIN(len, JEDEC_PAGE_PROGRAM_MAX_DATA);
+	}
+	max_data = spi_max_data(flash, dir);
+	if (max_data != MAX_DATA_UNSPECIFIED)
+		len = MIN(len, max_data);
+	return len;
+}
+
+int spi_plan_transfers(struct context *flash, enum spi_transfer dir,
+		       off_t start, size_t len, struct spi_extent *extents,
+		       int max_extents)
+{
+	off_t pos = start, end = start + len;
+	int n;
+
+	for (n = 0; pos < end; n++) {
+		len = spi_transfer_len(flash, dir, pos, end);
+		if (n < max_extents) {
+			extents[n].start = pos;
+			extents[n].len = len;
 		}
+		pos += len;
+	}
+	return n;
+}
+
+/*
+ * Read a part of the flash chip, in as few read commands as the programmer
+ * allows.
+ *
+ * Returns the number of bytes read, or < 0 if an error occurred.
+ */
+size_t spi_read_chunked(struct context *flash, uint8_t *buf,
+			off_t start, size_t len)
+{
+	off_t pos = start, end = start + len;
+	size_t toread;
+	int rc;
+
+	while (pos < end) {
+		toread = spi_transfer_len(flash, SPI_TRANSFER_READ, pos, end);
+		rc = spi_nbyte_read(flash, pos, buf + pos - start, toread);
 		if (rc)
-			break;
+			return rc < 0 ? rc : SPI_GENERIC_ERROR;
+		pos += toread;
 	}
 
-	return rc;
+	return len;
+}
+
+#define PP_BATCH_CHUNKS 16
+
+static const unsigned char wren_cmd[] = { JEDEC_WREN };
+static const unsigned char rdsr_cmd[] = { JEDEC_RDSR };
+
+/*
+ * Queue the program of the chunks of a run of pages in one multicommand.
+ * Each chunk is a WREN and a page program, followed by a status register read
+ * after the chip page program time, instead of polling the status after each
+ * chunk. Returns the number of chunks queued.
+ */
+static int spi_queue_pages(struct context *flash, struct spi_command *cmds,
+			   unsigned char (*pp)[JEDEC_BYTE_PROGRAM_OUTSIZE - 1 +
+				     JEDEC_PAGE_PROGRAM_MAX_DATA],
+			   uint8_t *status, const uint8_t *buf, off_t start,
+			   off_t pos, off_t end, int batch)
+{
+	size_t towrite;
+	int n, c = 0;
+
+	for (n = 0; n < batch && pos < end; n++, pos += towrite) {
+		towrite = spi_transfer_len(flash, SPI_TRANSFER_WRITE, pos, end);
+		pp[n][0] = JEDEC_BYTE_PROGRAM;
+		pp[n][1] = (pos >> 16) & 0xff;
+		pp[n][2] = (pos >> 8) & 0xff;
+		pp[n][3] = pos & 0xff;
+		memcpy(&pp[n][JEDEC_BYTE_PROGRAM_OUTSIZE - 1], buf + pos - start,
+		       towrite);
+
+		cmds[c].writecnt = JEDEC_WREN_OUTSIZE;
+		cmds[c].writearr = wren_cmd;
+		c++;
+		cmds[c].writecnt = JEDEC_BYTE_PROGRAM_OUTSIZE - 1 + towrite;
+		cmds[c].writearr = pp[n];
+		cmds[c].delay_us = flash->chip->page_program_us;
+		c++;
+		cmds[c].writecnt = JEDEC_RDSR_OUTSIZE;
+		cmds[c].writearr = rdsr_cmd;
+		cmds[c].readcnt = JEDEC_RDSR_INSIZE;
+		cmds[c].readarr = &status[n];
+		c++;
+	}
+	return n;
 }
 
 /*
  * Write a part of the flash chip.
- * FIXME: Use the chunk code from Michael Karcher instead.
  * Each page is written separately in chunks with a maximum size of chunksize.
+ *
+ * The chunks are sent in multicommands of PP_BATCH_CHUNKS, each chunk followed
+ * by the chip page program time and a status register read, instead of
+ * polling the status until each chunk is programmed. While a chunk is still
+ * being programmed, the chip ignores the next ones : if a status read shows
+ * the chip busy, the chip is polled until ready, the write resumes right after
+ * that chunk, and the batch is halved. It grows back after a few multicommands
+ * without a busy chip. If the chip doesn't tell its page program time, the
+ * chunks are sent one by one and the status is polled after each of them.
+ *
+ * Returns the number of bytes written, or < 0 if an error occurred.
  */
 size_t spi_write_chunked(struct context *flash, const uint8_t *buf,
-			 off_t start, size_t len,
-			 size_t chunksize)
+			 off_t start, size_t len)
 {
-	int rc = 0;
-	unsigned int i, j, starthere, lenhere, towrite;
-	/* FIXME: page_size is the wrong variable. We need max_writechunk_size
-	 * in struct context to do this properly. All chips using
-	 * spi_chip_write_256 have page_size set to max_writechunk_size, so
-	 * we're OK for now.
-	 */
-	unsigned int page_size = flash->chip->page_size;
+	unsigned char pp[PP_BATCH_CHUNKS][JEDEC_BYTE_PROGRAM_OUTSIZE - 1 +
+				     JEDEC_PAGE_PROGRAM_MAX_DATA];
+	struct spi_command cmds[3 * PP_BATCH_CHUNKS + 1];
+	uint8_t status[PP_BATCH_CHUNKS];
+	int i, n, rc, batch = PP_BATCH_CHUNKS, ok = 0;
+	off_t pos = start, end = start + len;
 
-	/* Warning: This loop has a very unusual condition and body.
-	 * The loop needs to go through each page with at least one affected
-	 * byte. The lowest page number is (start / page_size) since that
-	 * division rounds down. The highest page number we want is the page
-	 * where the last byte of the range lives. That last byte has the
-	 * address (start + len - 1), thus the highest page number is
-	 * (start + len - 1) / page_size. Since we want to include that last
-	 * page as well, the loop condition uses <=.
-	 */
-	for (i = start / page_size; i <= (start + len - 1) / page_size; i++) {
-		/* Byte position of the first byte in the range in this page. */
-		/* starthere is an offset to the base address of the chip. */
-		starthere = MAX(start, i * page_size);
-		/* Length of bytes in the range in this page. */
-		lenhere = MIN(start + len, (i + 1) * page_size) - starthere;
-		for (j = 0; j < lenhere; j += chunksize) {
-			towrite = MIN(chunksize, lenhere - j);
-			rc = spi_nbyte_program(flash, starthere + j, buf + starthere - start + j, towrite);
-			if (rc)
+	if (!flash->chip->page_program_us)
+		batch = 1;
+	while (pos < end) {
+		memset(cmds, 0, sizeof(cmds));
+		n = spi_queue_pages(flash, cmds, pp, status, buf, start, pos,
+				    end, batch);
+		rc = spi_send_multicommand(flash, cmds);
+		if (rc) {
+			pr_err("%s failed to program at 0x%06lx: %d\n",
+			       __func__, (long)pos, rc);
+			return rc < 0 ? rc : SPI_GENERIC_ERROR;
+		}
+
+		for (i = 0; i < n; i++) {
+			pos += spi_transfer_len(flash, SPI_TRANSFER_WRITE, pos,
+						end);
+			if (status[i] & SPI_SR_WIP)
 				break;
+		}
+		if (i < n) {
+			pr_vdbg("%s: chip busy at 0x%06lx, resuming there\n",
+				__func__, (long)pos);
 			while (spi_read_status_register(flash) & SPI_SR_WIP)
 				programmer_delay(10);
+			batch = MAX(batch / 2, 1);
+			ok = 0;
+		} else if (++ok == 4 && flash->chip->page_program_us) {
+			batch = MIN(batch * 2, PP_BATCH_CHUNKS);
+			ok = 0;
 		}
-		if (rc)
-			break;
 	}
 
-	return rc;
+	return len;
 }
 
-size_t default_spi_read(struct context *flash, uint8_t *buf, off_t start,
-			size_t len)
+int default_spi_read(struct context *flash, uint8_t *buf, off_t start,
+		     size_t len)
 {
-	unsigned int max_data = flash->mst->spi.max_data_read;
-	if (max_data == MAX_DATA_UNSPECIFIED) {
-		pr_err("%s called, but SPI read chunk size not defined "
-			 "on this hardware. Please report a bug at "
-			 "flashrom@flashrom.org\n", __func__);
-		return 1;
-	}
-	return spi_read_chunked(flash, buf, start, len, max_data);
+	/* Planning walks the whole transfer, only done for the messages */
+	if (debug_level >= MSG_VDEBUG)
+		pr_vdbg("%s(0x%06lx, %zu): %d read commands\n", __func__,
+			(long)start, len,
+			spi_plan_transfers(flash, SPI_TRANSFER_READ, start,
+					   len, NULL, 0));
+	return spi_read_chunked(flash, buf, start, len);
 }
 
-size_t default_spi_write_256(struct context *flash, const uint8_t *buf, off_t start, size_t len)
+int default_spi_write_256(struct context *flash, const uint8_t *buf,
+			  off_t start, size_t len)
 {
-	unsigned int max_data = flash->mst->spi.max_data_write;
-	if (max_data == MAX_DATA_UNSPECIFIED) {
-		pr_err("%s called, but SPI write chunk size not defined "
-			 "on this hardware. Please report a bug at "
-			 "flashrom@flashrom.org\n", __func__);
-		return 1;
-	}
-	return spi_write_chunked(flash, buf, start, len, max_data);
+	if (debug_level >= MSG_VDEBUG)
+		pr_vdbg("%s(0x%06lx, %zu): %d page programs\n", __func__,
+			(long)start, len,
+			spi_plan_transfers(flash, SPI_TRANSFER_WRITE, start,
+					   len, NULL, 0));
+	return spi_write_chunked(flash, buf, start, len);
 }
 
 size_t spi_chip_read(struct context *flash, uint8_t *buf, off_t start,
@@ -245,9 +341,15 @@ size_t spi_chip_write_256(struct context *flash, const uint8_t *buf, off_t start
 	return flash->mst->spi.write_256(flash, buf, start, len);
 }
 
+/*
+ * Program chip using AAI word programming, with the programmer native AAI
+ * transfers if it has some.
+ */
 size_t spi_aai_write(struct context *flash, const uint8_t *buf, off_t start,
-		  size_t len)
+		     size_t len)
 {
+	if (!flash->mst->spi.write_aai)
+		return default_spi_write_aai(flash, buf, start, len);
 	return flash->mst->spi.write_aai(flash, buf, start, len);
 }
 
@@ -857,8 +857,9 @@ size_t spi_nbyte_program(struct context *flash, off_t addr, const uint8_t *bytes
 			 size_t len)
 {
 	int result;
-	/* FIXME: Switch to malloc based on len unless that kills speed. */
-	unsigned char cmd[JEDEC_BYTE_PROGRAM_OUTSIZE - 1 + 256] = {
+	/* len is capped by the page program size, the stack holds the command */
+	unsigned char cmd[JEDEC_BYTE_PROGRAM_OUTSIZE - 1 +
+			  JEDEC_PAGE_PROGRAM_MAX_DATA] = {
 		JEDEC_BYTE_PROGRAM,
 		(addr >> 16) & 0xff,
 		(addr >> 8) & 0xff,
@@ -886,7 +887,7 @@ size_t spi_nbyte_program(struct context *flash, off_t addr, const uint8_t *bytes
 		pr_err("%s called for zero-length write\n", __func__);
 		return 1;
 	}
-	if (len > 256) {
+	if (len > JEDEC_PAGE_PROGRAM_MAX_DATA) {
 		pr_err("%s called for too long a write\n", __func__);
 		return 1;
 	}
@@ -925,109 +926,109 @@ size_t spi_chip_write_1(struct context *flash, const uint8_t *buf, off_t start,
 	return 0;
 }
 
-int default_spi_write_aai(struct context *flash, const uint8_t *buf, off_t start, unsigned int len)
+#define AAI_BATCH_WORDS 64
+
+static void spi_wait_wip(struct context *flash)
 {
-	uint32_t pos = start;
-	int result;
-	unsigned char cmd[JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE] = {
-		JEDEC_AAI_WORD_PROGRAM,
-	};
-	struct spi_command cmds[] = {
-	{
-		.writecnt	= JEDEC_WREN_OUTSIZE,
-		.writearr	= (const unsigned char[]){ JEDEC_WREN },
-		.readcnt	= 0,
-		.readarr	= NULL,
-	}, {
-		.writecnt	= JEDEC_AAI_WORD_PROGRAM_OUTSIZE,
-		.writearr	= (const unsigned char[]){
-					JEDEC_AAI_WORD_PROGRAM,
-					(start >> 16) & 0xff,
-					(start >> 8) & 0xff,
-					(start & 0xff),
-					buf[0],
-					buf[1]
-				},
-		.readcnt	= 0,
-		.readarr	= NULL,
-	}, {
-		.writecnt	= 0,
-		.writearr	= NULL,
-		.readcnt	= 0,
-		.readarr	= NULL,
-	}};
+	while (spi_read_status_register(flash) & SPI_SR_WIP)
+		programmer_delay(10);
+}
+
+/*
+ * Program chip using AAI word programming.
+ *
+ * After the first word, which carries the address, each word is a 3 bytes
+ * command. The words are sent in multicommands of AAI_BATCH_WORDS, each word
+ * followed by the chip word program time instead of a status register poll.
+ * If the chip doesn't tell its word program time, the status register is
+ * polled after each word. An odd first or last byte is byte programmed.
+ *
+ * Returns the number of bytes written, or < 0 if an error occurred.
+ */
+int default_spi_write_aai(struct context *flash, const uint8_t *buf,
+			  off_t start, size_t len)
+{
+	unsigned int word_us = flash->chip->word_program_us;
+	unsigned char first[JEDEC_AAI_WORD_PROGRAM_OUTSIZE];
+	unsigned char words[AAI_BATCH_WORDS][JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE];
+	struct spi_command cmds[AAI_BATCH_WORDS + 2];
+	off_t pos = start, end = start + len, aai_end;
+	int i, n, batch = word_us ? AAI_BATCH_WORDS : 1;
+	int result, aai;
 
-	/* The even start address and even length requirements can be either
-	 * honored outside this function, or we can call spi_byte_program
-	 * for the first and/or last byte and use AAI for the rest.
-	 * FIXME: Move this to generic code.
-	 */
 	/* The data sheet requires a start address with the low bit cleared. */
-	if (start % 2) {
-		pr_err("%s: start address not even! Please report a bug at "
-			 "flashrom@flashrom.org\n", __func__);
-		if (spi_chip_write_1(flash, buf, start, start % 2))
+	if (pos % 2 && pos < end) {
+		if (spi_chip_write_1(flash, buf, pos, 1))
 			return SPI_GENERIC_ERROR;
-		pos += start % 2;
-		cmds[1].writearr = (const unsigned char[]){
-					JEDEC_AAI_WORD_PROGRAM,
-					(pos >> 16) & 0xff,
-					(pos >> 8) & 0xff,
-					(pos & 0xff),
-					buf[pos - start],
-					buf[pos - start + 1]
-				};
-		/* Do not return an error for now. */
-		//return SPI_GENERIC_ERROR;
+		pos++;
 	}
 	/* The data sheet requires total AAI write length to be even. */
-	if (len % 2) {
-		pr_err("%s: total write length not even! Please report a "
-			 "bug at flashrom@flashrom.org\n", __func__);
-		/* Do not return an error for now. */
-		//return SPI_GENERIC_ERROR;
+	aai_end = pos + ((end - pos) & ~1);
+	aai = pos < aai_end;
+
+	if (aai) {
+		first[0] = JEDEC_AAI_WORD_PROGRAM;
+		first[1] = (pos >> 16) & 0xff;
+		first[2] = (pos >> 8) & 0xff;
+		first[3] = pos & 0xff;
+		first[4] = buf[pos - start];
+		first[5] = buf[pos - start + 1];
+		memset(cmds, 0, 3 * sizeof(cmds[0]));
+		cmds[0].writecnt = JEDEC_WREN_OUTSIZE;
+		cmds[0].writearr = (const unsigned char[]){ JEDEC_WREN };
+		cmds[1].writecnt = JEDEC_AAI_WORD_PROGRAM_OUTSIZE;
+		cmds[1].writearr = first;
+		cmds[1].delay_us = word_us;
+		result = spi_send_multicommand(flash, cmds);
+		if (result != 0) {
+			pr_err("%s failed during start command execution: %d\n",
+			       __func__, result);
+			goto bailout;
+		}
+		if (!word_us)
+			spi_wait_wip(flash);
+		pos += 2;
 	}
 
-
-	result = spi_send_multicommand(flash, cmds);
-	if (result != 0) {
-		pr_err("%s failed during start command execution: %d\n", __func__, result);
-		goto bailout;
-	}
-	while (spi_read_status_register(flash) & SPI_SR_WIP)
-		programmer_delay(10);
-
-	/* We already wrote 2 bytes in the multicommand step. */
-	pos += 2;
-
-	/* Are there at least two more bytes to write? */
-	while (pos < start + len - 1) {
-		cmd[1] = buf[pos++ - start];
-		cmd[2] = buf[pos++ - start];
-		result = spi_send_command(flash, JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE, 0, cmd, NULL);
+	while (pos < aai_end) {
+		n = (aai_end - pos) / 2;
+		if (n > batch)
+			n = batch;
+		memset(cmds, 0, (n + 1) * sizeof(cmds[0]));
+		for (i = 0; i < n; i++) {
+			words[i][0] = JEDEC_AAI_WORD_PROGRAM;
+			words[i][1] = buf[pos + 2 * i - start];
+			words[i][2] = buf[pos + 2 * i + 1 - start];
+			cmds[i].writecnt = JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE;
+			cmds[i].writearr = words[i];
+			cmds[i].delay_us = word_us;
+		}
+		result = spi_send_multicommand(flash, cmds);
 		if (result != 0) {
-			pr_err("%s failed during followup AAI command execution: %d\n", __func__, result);
+			pr_err("%s failed during followup AAI command execution: %d\n",
+			       __func__, result);
 			goto bailout;
 		}
-		while (spi_read_status_register(flash) & SPI_SR_WIP)
-			programmer_delay(10);
+		if (!word_us)
+			spi_wait_wip(flash);
+		pos += 2 * n;
 	}
 
 	/* Use WRDI to exit AAI mode. This needs to be done before issuing any other non-AAI command. */
-	result = spi_write_disable(flash);
-	if (result != 0) {
-		pr_err("%s failed to disable AAI mode.\n", __func__);
-		return SPI_GENERIC_ERROR;
+	if (aai) {
+		spi_wait_wip(flash);
+		result = spi_write_disable(flash);
+		if (result != 0) {
+			pr_err("%s failed to disable AAI mode.\n", __func__);
+			return SPI_GENERIC_ERROR;
+		}
 	}
 
 	/* Write remaining byte (if any). */
-	if (pos < start + len) {
-		if (spi_chip_write_1(flash, buf + pos - start, pos, pos % 2))
-			return SPI_GENERIC_ERROR;
-		pos += pos % 2;
-	}
+	if (pos < end && spi_chip_write_1(flash, buf + pos - start, pos, 1))
+		return SPI_GENERIC_ERROR;
 
-	return 0;
+	return len;
 
 bailout:
 	result = spi_write_disable(flash);
@@ -1035,3 +1036,43 @@ bailout:
 		pr_err("%s failed to disable AAI mode.\n", __func__);
 	return SPI_GENERIC_ERROR;
 }
+
+static int spi_write_status_register(struct context *flash, uint8_t status)
+{
+	struct spi_command cmds[] = {
+	{
+		.writecnt	= JEDEC_EWSR_OUTSIZE,
+		.writearr	= (const unsigned char[]){ JEDEC_EWSR },
+	}, {
+		.writecnt	= JEDEC_WRSR_OUTSIZE,
+		.writearr	= (const unsigned char[]){ JEDEC_WRSR, status },
+	}, {
+		.writecnt	= 0,
+	}};
+
+	if (flash->chip->feature_bits & FEATURE_WRSR_WREN)
+		cmds[0].writearr = (const unsigned char[]){ JEDEC_WREN };
+	return spi_send_multicommand(flash, cmds);
+}
+
+/* Clear the block protect bits BP0..BP3 of the status register. */
+int spi_disable_blockprotect(struct context *flash)
+{
+	uint8_t status = spi_read_status_register(flash);
+	int result;
+
+	if (!(status & SPI_SR_BP_MASK))
+		return 0;
+	pr_info("Disabling block protection, status 0x%02x\n", status);
+	result = spi_write_status_register(flash, status & ~SPI_SR_BP_MASK);
+	if (result) {
+		pr_err("%s failed to write the status register\n", __func__);
+		return result;
+	}
+	spi_wait_wip(flash);
+	if (spi_read_status_register(flash) & SPI_SR_BP_MASK) {
+		pr_err("Block protection could not be disabled\n");
+		return SPI_GENERIC_ERROR;
+	}
+	return 0;
+}
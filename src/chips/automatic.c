@@ -18,12 +18,9 @@
 #include <chip.h>
 #include <debug.h>
 
-static struct flashchip automatic;
-
 static int auto_probe(struct context *ctxt, const char *chip_args)
 {
 	struct flashchip *chip;
-	struct list_head head;
 	int ret;
 
 	for_each_chip(chip) {
@@ -32,12 +29,8 @@ static int auto_probe(struct context *ctxt, const char *chip_args)
 		ctxt->chip = chip;
 		ret = chip->probe(ctxt, chip_args);
 		pr_dbg("Probing chip %s: %d\n", chip->driver_name, ret);
-		if (ret) {
-			head = automatic.list;
-			automatic = *chip;
-			automatic.list = head;
+		if (ret)
 			return 1;
-		}
 	}
 
 	pr_err("Didn't find automatically any flash chip.\n");
@@ -19,11 +19,50 @@
 #define DEBUG_MODULE "chip-core"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <chip.h>
 #include <debug.h>
 #include <hexdump.h>
 #include <list.h>
+#include <metrics.h>
+
+/*
+ * The block cache holds the chip content met during a run, by blocks of the
+ * smallest eraser. A block holds either what was read from the chip, or what
+ * the erases and writes since should have left in it : erased blocks are
+ * known to be blank, and programming only clears bits. Reads are served from
+ * both, read backs only from the blocks read from the chip.
+ */
+enum block_state {
+	BLOCK_READ,
+	BLOCK_PREDICTED,
+};
+
+enum chip_read_mode {
+	CHIP_READ_CACHED,
+	CHIP_READ_BACK,
+	CHIP_READ_UNCACHED,
+};
+
+struct cached_block {
+	unsigned int index;
+	enum block_state state;
+	struct list_head lru;
+	unsigned char data[];
+};
+
+struct block_cache {
+	struct flashchip *chip;
+	size_t block_size;
+	unsigned int nb_blocks;
+	struct cached_block **blocks;
+	size_t used;
+	/* Least recently used first */
+	struct list_head lru;
+	struct cache_metric metric;
+};
 
 LIST_HEAD(chips);
 
@@ -40,21 +79,259 @@ void print_available_chips(void)
 		       chip->name);
 }
 
-int chip_read(struct context *ctx, unsigned char *buf, off_t start, size_t len)
+size_t chip_smallest_erase_block(struct flashchip *chip)
+{
+	size_t size = 0;
+	int i;
+
+	for (i = 0; i < NUM_ERASEFUNCTIONS; i++)
+		if (chip->erasers[i].block_erase &&
+		    (!size || chip->erasers[i].size < size))
+			size = chip->erasers[i].size;
+	return size;
+}
+
+size_t chip_biggest_erase_block(struct flashchip *chip)
+{
+	size_t size = 0, chip_size = chip->total_size_kb * 1024;
+	int i;
+
+	for (i = 0; i < NUM_ERASEFUNCTIONS; i++)
+		if (chip->erasers[i].block_erase &&
+		    chip->erasers[i].size < chip_size &&
+		    chip->erasers[i].size > size)
+			size = chip->erasers[i].size;
+	return size;
+}
+
+static void block_forget(struct block_cache *cache, unsigned int index)
+{
+	struct cached_block *b = cache->blocks[index];
+
+	if (!b)
+		return;
+	list_del(&b->lru);
+	free(b);
+	cache->blocks[index] = NULL;
+	cache->used -= cache->block_size;
+}
+
+static void block_cache_forget_all(struct block_cache *cache)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->nb_blocks; i++)
+		block_forget(cache, i);
+	free(cache->blocks);
+	cache->blocks = NULL;
+	cache->nb_blocks = 0;
+	cache->chip = NULL;
+}
+
+/*
+ * The cache is set up for the chip of the context on its first use, and
+ * isn't used while the context has no cache memory, or the chip has no
+ * erasers.
+ */
+static struct block_cache *block_cache_get(struct context *ctx)
+{
+	struct block_cache *cache = ctx->blocks;
+	size_t bsize, chip_size = ctx->chip->total_size_kb * 1024;
+
+	if (cache && cache->chip == ctx->chip)
+		return cache;
+	bsize = chip_smallest_erase_block(ctx->chip);
+	if (!bsize || bsize > ctx->block_cache_max || chip_size % bsize)
+		return NULL;
+
+	if (!cache) {
+		cache = calloc(1, sizeof(*cache));
+		if (!cache)
+			return NULL;
+		INIT_LIST_HEAD(&cache->lru);
+		cache->metric.name = "block cache";
+		ctx->blocks = cache;
+	}
+	block_cache_forget_all(cache);
+	cache->blocks = calloc(chip_size / bsize, sizeof(*cache->blocks));
+	if (!cache->blocks)
+		return NULL;
+	cache->chip = ctx->chip;
+	cache->block_size = bsize;
+	cache->nb_blocks = chip_size / bsize;
+	pr_dbg("Caching the chip by %zu bytes blocks, up to %zu bytes\n",
+	       bsize, ctx->block_cache_max);
+	return cache;
+}
+
+/* Only the cache already set up for the chip is updated */
+static struct block_cache *block_cache_current(struct context *ctx)
+{
+	struct block_cache *cache = ctx->blocks;
+
+	return cache && cache->chip == ctx->chip ? cache : NULL;
+}
+
+static struct cached_block *block_alloc(struct context *ctx,
+					struct block_cache *cache,
+					unsigned int index)
+{
+	struct cached_block *b = cache->blocks[index];
+
+	if (b) {
+		list_move_tail(&b->lru, &cache->lru);
+		return b;
+	}
+	while (cache->used + cache->block_size > ctx->block_cache_max &&
+	       !list_empty(&cache->lru))
+		block_forget(cache, list_first_entry(&cache->lru,
+						     struct cached_block,
+						     lru)->index);
+	b = malloc(sizeof(*b) + cache->block_size);
+	if (!b)
+		return NULL;
+	b->index = index;
+	list_add_tail(&b->lru, &cache->lru);
+	cache->blocks[index] = b;
+	cache->used += cache->block_size;
+	return b;
+}
+
+static struct cached_block *block_lookup(struct block_cache *cache,
+					 unsigned int index,
+					 enum chip_read_mode mode)
+{
+	struct cached_block *b = cache->blocks[index];
+
+	if (!b || (mode == CHIP_READ_BACK && b->state != BLOCK_READ))
+		return NULL;
+	return b;
+}
+
+static int chip_read_hw(struct context *ctx, unsigned char *buf, off_t start,
+			size_t len)
 {
 	int ret;
 
 	ret = ctx->chip->read(ctx, buf, start, len);
 	pr_dbg("read chip 0x%06x..0x%06x: %d\n", start, start + len, ret);
 	hexdump_vdbg("\t\t Buf=[", buf, len, "]\n");
+	return ret;
+}
+
+/*
+ * The blocks missing from the cache are read from the chip in runs, as few
+ * requests as possible, and the blocks entirely read are kept.
+ */
+static int chip_read_mode(struct context *ctx, unsigned char *buf,
+			  off_t start, size_t len, enum chip_read_mode mode)
+{
+	struct block_cache *cache = NULL;
+	struct cached_block *b;
+	off_t pos, end = start + len, bstart, run_end;
+	size_t bsize, n;
+	unsigned int i;
+	int ret = len;
 
+	if (mode != CHIP_READ_UNCACHED && ctx->block_cache_max)
+		cache = block_cache_get(ctx);
+	if (!cache) {
+		ret = chip_read_hw(ctx, buf, start, len);
+		goto out;
+	}
+
+	bsize = cache->block_size;
+	for (pos = start; pos < end; pos = run_end) {
+		bstart = pos - pos % bsize;
+		run_end = bstart + bsize < end ? bstart + bsize : end;
+		b = block_lookup(cache, pos / bsize, mode);
+		if (b) {
+			list_move_tail(&b->lru, &cache->lru);
+			memcpy(buf + (pos - start), b->data + (pos - bstart),
+			       run_end - pos);
+			cache->metric.hits++;
+			cache->metric.hit_bytes += run_end - pos;
+			continue;
+		}
+
+		while (run_end < end && !block_lookup(cache, run_end / bsize,
+						      mode))
+			run_end = run_end + bsize < end ? run_end + bsize : end;
+		n = run_end - pos;
+		ret = chip_read_hw(ctx, buf + (pos - start), pos, n);
+		if (ret < (int)n) {
+			if (ret >= 0)
+				ret += pos - start;
+			goto out;
+		}
+		for (i = (pos + bsize - 1) / bsize; (i + 1) * bsize <= run_end;
+		     i++) {
+			b = block_alloc(ctx, cache, i);
+			if (!b)
+				break;
+			memcpy(b->data, buf + (i * bsize - start), bsize);
+			b->state = BLOCK_READ;
+		}
+		cache->metric.misses += (run_end - 1) / bsize - pos / bsize + 1;
+	}
+	ret = len;
+
+out:
 	if (ret < 0)
 		pr_err("Couldn't read the %zd bytes from the chip: %d\n",
 		       len, ret);
-
 	return ret;
 }
 
+int chip_read(struct context *ctx, unsigned char *buf, off_t start, size_t len)
+{
+	return chip_read_mode(ctx, buf, start, len, CHIP_READ_CACHED);
+}
+
+int chip_read_back(struct context *ctx, unsigned char *buf, off_t start,
+		   size_t len)
+{
+	return chip_read_mode(ctx, buf, start, len,
+			      ctx->verify_uncached ? CHIP_READ_UNCACHED :
+			      CHIP_READ_BACK);
+}
+
+int chip_read_uncached(struct context *ctx, unsigned char *buf, off_t start,
+		       size_t len)
+{
+	return chip_read_mode(ctx, buf, start, len, CHIP_READ_UNCACHED);
+}
+
+/*
+ * Programming clears the bits of the cached blocks, a failed write leaves
+ * them unknown.
+ */
+static void block_cache_written(struct context *ctx, const unsigned char *buf,
+				off_t start, size_t len, int success)
+{
+	struct block_cache *cache = block_cache_current(ctx);
+	struct cached_block *b;
+	off_t pos, end = start + len, bstart, bend;
+
+	if (!cache)
+		return;
+	for (pos = start; pos < end; pos = bend) {
+		bstart = pos - pos % cache->block_size;
+		bend = bstart + cache->block_size < end ?
+			bstart + cache->block_size : end;
+		b = cache->blocks[pos / cache->block_size];
+		if (!b)
+			continue;
+		if (!success) {
+			block_forget(cache, b->index);
+			continue;
+		}
+		for (; pos < bend; pos++)
+			b->data[pos - bstart] &= buf[pos - start];
+		b->state = BLOCK_PREDICTED;
+	}
+}
+
 int chip_write(struct context *ctx, const unsigned char *buf,
 	       off_t start, size_t len)
 {
@@ -63,6 +340,7 @@ int chip_write(struct context *ctx, const unsigned char *buf,
 	ret = ctx->chip->write(ctx, buf, start, len);
 	pr_dbg("wrote chip 0x%06x..0x%06x: %d\n", start, start + len, ret);
 	hexdump_vdbg("\t\t Buf=[", buf, len, "]\n");
+	block_cache_written(ctx, buf, start, len, ret >= (int)len);
 
 	if (ret < len)
 		pr_err("Couldn't write the %zd bytes to the chip: %d\n",
@@ -70,3 +348,56 @@ int chip_write(struct context *ctx, const unsigned char *buf,
 
 	return ret;
 }
+
+int chip_erase_block(struct context *ctx, struct block_eraser *eraser,
+		     off_t start, size_t len)
+{
+	struct block_cache *cache = block_cache_current(ctx);
+	struct cached_block *b;
+	unsigned int i;
+	int ret;
+
+	ret = eraser->block_erase(ctx, start, len);
+	if (!cache)
+		return ret;
+	for (i = start / cache->block_size;
+	     i * cache->block_size < start + len; i++) {
+		b = NULL;
+		if (!ret && i * cache->block_size >= start &&
+		    (i + 1) * cache->block_size <= start + len)
+			b = block_alloc(ctx, cache, i);
+		if (!b) {
+			block_forget(cache, i);
+			continue;
+		}
+		memset(b->data, 0xff, cache->block_size);
+		b->state = BLOCK_PREDICTED;
+	}
+	return ret;
+}
+
+void block_cache_drop(struct context *ctx)
+{
+	if (ctx->blocks)
+		block_cache_forget_all(ctx->blocks);
+}
+
+void block_cache_report(struct context *ctx)
+{
+	struct block_cache *cache = ctx->blocks;
+
+	if (!cache || !(cache->metric.hits + cache->metric.misses))
+		return;
+	cache_metric_print(&cache->metric);
+	cache->metric.hits = cache->metric.misses = 0;
+	cache->metric.hit_bytes = 0;
+}
+
+void block_cache_release(struct context *ctx)
+{
+	if (!ctx->blocks)
+		return;
+	block_cache_forget_all(ctx->blocks);
+	free(ctx->blocks);
+	ctx->blocks = NULL;
+}
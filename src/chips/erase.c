@@ -182,9 +182,7 @@ find_smallest_eraser_after_point(struct block_eraser erasers[],
 			start, end, eraser->start + blk * eraser->size,
 			eraser->start + (blk + 1) * eraser->size,
 			eraser->size);
-		if (!((start - eraser->start) % eraser->size))
-			continue;
-		if (eraser->start + blk * eraser->size <= end)
+		if (eraser->start + blk * eraser->size != start)
 			continue;
 		if (!chosen) {
 			chosen = eraser;
@@ -198,18 +196,35 @@ find_smallest_eraser_after_point(struct block_eraser erasers[],
 	return chosen;
 }
 
-static void eraser_add(struct block_eraser *eraser, struct list_head *head)
+/*
+ * Each added entry describes exactly one block : start is the address of the
+ * block on the chip, and count is 1. The list is kept in address order.
+ */
+static void eraser_add(struct block_eraser *eraser, off_t where,
+		       struct list_head *head)
 {
 	struct block_eraser *e;
 
 	e = malloc(sizeof(*e));
 	if (!e) {
-		pr_err("%f(): allocation failed, aborting ...\n");
+		pr_err("%s(): allocation failed, aborting ...\n", __func__);
 		exit(1);
 	}
 
 	*e = *eraser;
-	list_add(&e->list, head);
+	e->start = eraser->start + find_erase_block(eraser, where) * eraser->size;
+	e->count = 1;
+	list_add_tail(&e->list, head);
+}
+
+void free_list_erases(struct list_head *ops)
+{
+	struct block_eraser *eraser, *tmp;
+
+	list_for_each_entry_safe(eraser, tmp, ops, list) {
+		list_del(&eraser->list);
+		free(eraser);
+	}
 }
 
 int compute_list_erases(struct block_eraser erasers[],
@@ -223,7 +238,7 @@ int compute_list_erases(struct block_eraser erasers[],
 	eraser = find_smallest_eraser_before_point(erasers, where, end);
 	if (!eraser)
 		return -EINVAL;
-	eraser_add(eraser, &erases);
+	eraser_add(eraser, where, &erases);
 	where = eraser->start + find_erase_block(eraser, where) * eraser->size
 		+ eraser->size;
 
@@ -231,23 +246,21 @@ int compute_list_erases(struct block_eraser erasers[],
 		eraser = find_biggest_eraser_within(erasers, where, end);
 		if (!eraser)
 			continue;
-		eraser_add(eraser, &erases);
+		eraser_add(eraser, where, &erases);
 		where += eraser->size;
 	}
-	if (where < start + len)
-		return -ENODEV;
-
 	if (where < end) {
 		eraser = find_smallest_eraser_after_point(erasers, where, end);
 		if (eraser) {
-			eraser_add(eraser, &erases);
+			eraser_add(eraser, where, &erases);
 			where += eraser->size;
 		} else {
+			free_list_erases(&erases);
 			return -ENODEV;
 		}
 	}
 
-	list_splice(&erases, ops);
+	list_splice_tail(&erases, ops);
 	return 0;
 }
 
@@ -257,7 +270,6 @@ int chip_erase(struct context *ctx, off_t start, size_t len,
 	struct flashchip *chip = ctx->chip;
 	LIST_HEAD(erases);
 	struct block_eraser *first, *last, *eraser;
-	off_t where;
 	int ret;
 
 	ret = compute_list_erases(chip->erasers, start, len, &erases);
@@ -268,29 +280,27 @@ int chip_erase(struct context *ctx, off_t start, size_t len,
 	first = list_first_entry(&erases, struct block_eraser, list);
 	last = list_last_entry(&erases, struct block_eraser, list);
 
-	if (required_exact_fit &&
-	    (first->start + find_erase_block(first, start) * first->size)
-	    != start)
-		return -ENODEV;
-	if (required_exact_fit &&
-	    (last->start + find_erase_block(last, start + len - 1) * last->size
-	     + last->size != start))
-		return -ENODEV;
+	ret = -ENODEV;
+	if (required_exact_fit && first->start != start)
+		goto out;
+	if (required_exact_fit && last->start + last->size != start + len)
+		goto out;
 
-	where = first->start + find_erase_block(first, start) * first->size;
 	if (real_start)
-		*real_start = where;
+		*real_start = first->start;
 
 	list_for_each_entry(eraser, &erases, list) {
-		ret = eraser->block_erase(ctx, where, eraser->size);
+		ret = chip_erase_block(ctx, eraser, eraser->start,
+				       eraser->size);
 		pr_dbg("Erased 0x%06x..0x%06x: %d\n",
-		       where, where + eraser->size, ret);
+		       eraser->start, eraser->start + eraser->size, ret);
 		if (ret)
 			break;
-		where += eraser->size;
+		if (real_len)
+			*real_len = eraser->start + eraser->size - first->start;
 	}
 
-	if (real_len)
-		*real_len = where - *real_start;
+out:
+	free_list_erases(&erases);
 	return ret;
 }
@@ -29,6 +29,8 @@ static struct flashchip mx25u12835f = {
 	.model_id	= MACRONIX_MX25U6435E,
 	.total_size_kb	= 8192,
 	.page_size	= 256,
+	/* Page program time: 0.5 ms typical */
+	.page_program_us = 500,
 	/* F model supports SFDP */
 	/* OTP: 512B total; enter 0xB1, exit 0xC1 */
 	/* QPI enable 0x35, disable 0xF5 (0xFF et al. work too) */
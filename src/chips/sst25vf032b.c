@@ -0,0 +1,51 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * It is heavily inspired from flashrom project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <chip.h>
+#include <chip_ids.h>
+#include <spi_nor.h>
+
+static struct flashchip sst25vf032b = {
+	.vendor		= "SST",
+	.name		= "SST25VF032B",
+	.bustype	= BUS_SPI,
+	.manufacture_id	= SST_ID,
+	.model_id	= SST_SST25VF032B,
+	.total_size_kb	= 4096,
+	.page_size	= 256,
+	/* Byte and AAI word program time: 10 us max */
+	.word_program_us = 10,
+	.feature_bits	= FEATURE_WRSR_EWSR,
+	.probe		= probe_spi_rdid,
+	.probe_timing	= TIMING_ZERO,
+	.erasers	= {
+		{ 0, 4 * 1024, 1024, spi_block_erase_20 },
+		{ 0, 32 * 1024, 128, spi_block_erase_52 },
+		{ 0, 64 * 1024, 64, spi_block_erase_d8 },
+		{ 0, 4 * 1024 * 1024, 1, spi_block_erase_60 },
+		{ 0, 4 * 1024 * 1024, 1, spi_block_erase_c7 },
+	},
+	/* The block protect bits are all set at power up */
+	.unlock		= spi_disable_blockprotect,
+	.write		= spi_aai_write,
+	.read		= spi_chip_read,
+	.voltage	= {2700, 3600},
+};
+
+DECLARE_CHIP(sst25vf032b);
@@ -29,6 +29,8 @@ static struct flashchip w25q64w = {
 	.model_id	= WINBOND_NEX_W25Q64_W,
 	.total_size_kb	= 8192,
 	.page_size	= 256,
+	/* Page program time: 0.7 ms typical */
+	.page_program_us = 700,
 	/* OTP: 256B total; read 0x48; write 0x42, erase 0x44, read ID 0x4B */
 	/* QPI enable 0x38, disable 0xFF */
 	.feature_bits	= FEATURE_WRSR_WREN | FEATURE_OTP | FEATURE_QPI,
@@ -0,0 +1,99 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "buffer-pool"
+
+#include <stdlib.h>
+
+#include <buffer_pool.h>
+#include <debug.h>
+
+/* The buffer data follows its header, on the next aligned boundary */
+struct buffer_pool {
+	struct buffer_pool *next;
+	size_t size;
+	int in_use;
+};
+
+static inline void *buffer_data(struct buffer_pool *b)
+{
+	return (char *)b + BUFFER_POOL_ALIGN;
+}
+
+static struct buffer_pool *buffer_alloc(size_t size)
+{
+	struct buffer_pool *b;
+
+	if (posix_memalign((void **)&b, BUFFER_POOL_ALIGN,
+			   BUFFER_POOL_ALIGN + size))
+		return NULL;
+	b->size = size;
+	b->in_use = 0;
+	pr_dbg("Allocated a buffer of %zu bytes\n", size);
+	return b;
+}
+
+void *buffer_get(struct buffer_pool **pool, size_t size)
+{
+	struct buffer_pool *b, *best = NULL, *biggest = NULL, **prev;
+
+	for (b = *pool; b; b = b->next) {
+		if (b->in_use)
+			continue;
+		if (b->size >= size && (!best || b->size < best->size))
+			best = b;
+		if (!biggest || b->size > biggest->size)
+			biggest = b;
+	}
+
+	if (!best) {
+		best = buffer_alloc(size);
+		if (!best)
+			return NULL;
+		if (biggest) {
+			for (prev = pool; *prev != biggest; prev = &(*prev)->next)
+				;
+			*prev = biggest->next;
+			free(biggest);
+		}
+		best->next = *pool;
+		*pool = best;
+	}
+	best->in_use = 1;
+	return buffer_data(best);
+}
+
+void buffer_put(struct buffer_pool **pool, void *buf)
+{
+	struct buffer_pool *b;
+
+	if (!buf)
+		return;
+	b = (struct buffer_pool *)((char *)buf - BUFFER_POOL_ALIGN);
+	b->in_use = 0;
+}
+
+void buffer_pool_release(struct buffer_pool **pool)
+{
+	struct buffer_pool *b;
+
+	while ((b = *pool)) {
+		if (b->in_use)
+			pr_warn("Releasing a buffer still in use\n");
+		*pool = b->next;
+		free(b);
+	}
+}
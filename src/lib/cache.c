@@ -0,0 +1,142 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "cache"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cache.h>
+#include <debug.h>
+
+static int mkdir_if_needed(const char *dir)
+{
+	if (mkdir(dir, 0755) && errno != EEXIST) {
+		pr_dbg("Couldn't create directory %s: %d\n", dir, errno);
+		return -errno;
+	}
+	return 0;
+}
+
+int cache_path(char *path, size_t size, const char *name)
+{
+	char dir[PATH_MAX];
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int ret;
+
+	if (xdg && *xdg)
+		snprintf(dir, sizeof(dir), "%s", xdg);
+	else if (home && *home)
+		snprintf(dir, sizeof(dir), "%s/.cache", home);
+	else
+		return -ENOENT;
+	ret = mkdir_if_needed(dir);
+	if (ret)
+		return ret;
+
+	snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir), "/flashrom2");
+	ret = mkdir_if_needed(dir);
+	if (ret)
+		return ret;
+
+	if (snprintf(path, size, "%s/%s", dir, name) >= size)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+#define CACHE_LINE_MAX 256
+
+int cache_get_string(const char *name, const char *key, char *value,
+		     size_t size)
+{
+	char path[PATH_MAX], line[CACHE_LINE_MAX], k[CACHE_LINE_MAX];
+	char v[CACHE_LINE_MAX];
+	FILE *f;
+	int ret = -ENOENT;
+
+	if (cache_path(path, sizeof(path), name))
+		return -ENOENT;
+	f = fopen(path, "r");
+	if (!f)
+		return -ENOENT;
+	while (ret && fgets(line, sizeof(line), f))
+		if (sscanf(line, "%255s %255s", k, v) == 2 && !strcmp(k, key)) {
+			if (snprintf(value, size, "%s", v) < size)
+				ret = 0;
+			else
+				ret = -ENAMETOOLONG;
+		}
+	fclose(f);
+
+	return ret;
+}
+
+int cache_get_value(const char *name, const char *key, long *value)
+{
+	char v[CACHE_LINE_MAX], *end;
+	int ret;
+
+	ret = cache_get_string(name, key, v, sizeof(v));
+	if (ret)
+		return ret;
+	*value = strtol(v, &end, 10);
+	return *end ? -EINVAL : 0;
+}
+
+int cache_set_string(const char *name, const char *key, const char *value)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 4];
+	char line[CACHE_LINE_MAX], k[CACHE_LINE_MAX];
+	FILE *in, *out;
+	int ret;
+
+	ret = cache_path(path, sizeof(path), name);
+	if (ret)
+		return ret;
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+	out = fopen(tmp, "w");
+	if (!out)
+		return -errno;
+
+	in = fopen(path, "r");
+	while (in && fgets(line, sizeof(line), in))
+		if (sscanf(line, "%255s", k) == 1 && strcmp(k, key))
+			fputs(line, out);
+	if (in)
+		fclose(in);
+	fprintf(out, "%s %s\n", key, value);
+
+	if (fclose(out) || rename(tmp, path)) {
+		ret = -errno;
+		pr_dbg("Couldn't update cache file %s: %d\n", path, ret);
+		unlink(tmp);
+	}
+	return ret;
+}
+
+int cache_set_value(const char *name, const char *key, long value)
+{
+	char v[32];
+
+	snprintf(v, sizeof(v), "%ld", value);
+	return cache_set_string(name, key, v);
+}
@@ -0,0 +1,306 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "compress"
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <compress.h>
+#include <debug.h>
+
+struct compressor {
+	const char *suffix;
+	const char *magic;
+	size_t magic_len;
+	/* The decompressor of a file, and the compressors of stdin */
+	const char *decompress[6];
+	const char *compress[2][5];
+};
+
+static const struct compressor compressors[] = {
+	[COMPRESSION_GZIP] = {
+		".gz", "\x1f\x8b", 2,
+		{ "gzip", "-d", "-c", "-q", "--" },
+		{ { "pigz", "-c", "-q" }, { "gzip", "-c", "-q" } },
+	},
+	[COMPRESSION_XZ] = {
+		".xz", "\xfd" "7zXZ\x00", 6,
+		{ "xz", "-d", "-c", "-q", "--" },
+		{ { "xz", "-c", "-q", "-T0" } },
+	},
+	[COMPRESSION_ZSTD] = {
+		".zst", "\x28\xb5\x2f\xfd", 4,
+		{ "zstd", "-d", "-c", "-q", "--" },
+		{ { "zstd", "-c", "-q", "-T0" } },
+	},
+};
+
+#define NB_COMPRESSORS (sizeof(compressors) / sizeof(compressors[0]))
+
+enum compression compression_detect(const unsigned char *head, size_t len)
+{
+	unsigned int c;
+
+	for (c = COMPRESSION_GZIP; c < NB_COMPRESSORS; c++)
+		if (len >= compressors[c].magic_len &&
+		    !memcmp(head, compressors[c].magic,
+			    compressors[c].magic_len))
+			return c;
+	return COMPRESSION_NONE;
+}
+
+enum compression compression_from_suffix(const char *filename)
+{
+	size_t len = strlen(filename), slen;
+	unsigned int c;
+
+	for (c = COMPRESSION_GZIP; c < NB_COMPRESSORS; c++) {
+		slen = strlen(compressors[c].suffix);
+		if (len > slen &&
+		    !strcmp(filename + len - slen, compressors[c].suffix))
+			return c;
+	}
+	return COMPRESSION_NONE;
+}
+
+static uint64_t get_le(const unsigned char *p, int nb)
+{
+	uint64_t v = 0;
+
+	while (nb--)
+		v = v << 8 | p[nb];
+	return v;
+}
+
+static int pread_full(int fd, void *buf, size_t len, off_t offset)
+{
+	return pread(fd, buf, len, offset) == (ssize_t)len ? 0 : -EIO;
+}
+
+/* The gzip trailer holds the length modulo 4 GB */
+static int gzip_length(int fd, off_t size, uint64_t *len)
+{
+	unsigned char isize[4];
+
+	if (size < 18 || pread_full(fd, isize, sizeof(isize), size - 4))
+		return -EINVAL;
+	*len = get_le(isize, 4);
+	return 0;
+}
+
+static int xz_varint(const unsigned char **p, const unsigned char *end,
+		     uint64_t *v)
+{
+	int shift;
+
+	*v = 0;
+	for (shift = 0; *p < end && shift < 63; shift += 7) {
+		*v |= (uint64_t)(**p & 0x7f) << shift;
+		if (!(*(*p)++ & 0x80))
+			return 0;
+	}
+	return -EINVAL;
+}
+
+/*
+ * The stream footer tells the size of the index, which lists the
+ * uncompressed size of each block.
+ */
+static int xz_length(int fd, off_t size, uint64_t *len)
+{
+	unsigned char footer[12], index[64 * 1024];
+	const unsigned char *p, *end;
+	uint64_t nb_records, unpadded, usize;
+	size_t index_size;
+
+	/* Stream padding, in groups of 4 null bytes */
+	do {
+		if (size < 12 + 12 ||
+		    pread_full(fd, footer, sizeof(footer), size - 12))
+			return -EINVAL;
+		size -= 4;
+	} while (!memcmp(footer + 8, "\0\0\0\0", 4));
+	size += 4;
+	if (memcmp(footer + 10, "YZ", 2))
+		return -EINVAL;
+
+	index_size = (get_le(footer + 4, 4) + 1) * 4;
+	if (index_size > sizeof(index) || index_size + 12 + 12 > size ||
+	    pread_full(fd, index, index_size, size - 12 - index_size))
+		return -EINVAL;
+	p = index + 1;
+	end = index + index_size;
+	if (index[0] || xz_varint(&p, end, &nb_records))
+		return -EINVAL;
+	for (*len = 0; nb_records--; *len += usize)
+		if (xz_varint(&p, end, &unpadded) ||
+		    xz_varint(&p, end, &usize))
+			return -EINVAL;
+	return 0;
+}
+
+/* The frame content size is optional, the zstd tool writes it for files */
+static int zstd_length(int fd, off_t size, uint64_t *len)
+{
+	static const int dict_sizes[] = { 0, 1, 2, 4 };
+	static const int fcs_sizes[] = { 0, 2, 4, 8 };
+	unsigned char hdr[18];
+	int fhd, single, pos, fcs_size;
+
+	if (size < 6 || pread_full(fd, hdr, size < 18 ? size : 18, 0))
+		return -EINVAL;
+	fhd = hdr[4];
+	single = fhd & 0x20;
+	pos = 5 + !single + dict_sizes[fhd & 3];
+	fcs_size = fcs_sizes[fhd >> 6];
+	if (!fcs_size && single)
+		fcs_size = 1;
+	if (!fcs_size || pos + fcs_size > size)
+		return -EINVAL;
+	*len = get_le(hdr + pos, fcs_size) + (fcs_size == 2 ? 256 : 0);
+	return 0;
+}
+
+int compression_length(int fd, enum compression c, uint64_t *len)
+{
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return -errno;
+	switch (c) {
+	case COMPRESSION_GZIP:
+		return gzip_length(fd, st.st_size, len);
+	case COMPRESSION_XZ:
+		return xz_length(fd, st.st_size, len);
+	case COMPRESSION_ZSTD:
+		return zstd_length(fd, st.st_size, len);
+	default:
+		return -EINVAL;
+	}
+}
+
+static void compression_exec(const char *const *argv, const char *filename)
+{
+	const char *args[8];
+	int i;
+
+	for (i = 0; argv[i]; i++)
+		args[i] = argv[i];
+	args[i++] = filename;
+	args[i] = NULL;
+	if (!filename)
+		args[i - 1] = NULL;
+	execvp(args[0], (char *const *)args);
+}
+
+/*
+ * The pipes are closed on exec, so that a tool started meanwhile doesn't keep
+ * the pipe of another one opened.
+ */
+int compression_pipe(const char *filename, enum compression c, int compress,
+		     pid_t *pid)
+{
+	const struct compressor *cmp = &compressors[c];
+	int fds[2], fd = -1, ret, i;
+
+	if (c == COMPRESSION_NONE || c >= NB_COMPRESSORS)
+		return -EINVAL;
+	if (compress) {
+		fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			  0666);
+		if (fd < 0)
+			return -errno;
+	}
+	if (pipe2(fds, O_CLOEXEC)) {
+		ret = -errno;
+		goto out;
+	}
+
+	*pid = fork();
+	if (*pid == 0) {
+		if (compress) {
+			dup2(fds[0], STDIN_FILENO);
+			dup2(fd, STDOUT_FILENO);
+			for (i = 0; i < 2 && cmp->compress[i][0]; i++)
+				compression_exec(cmp->compress[i], NULL);
+		} else {
+			dup2(fds[1], STDOUT_FILENO);
+			compression_exec(cmp->decompress, filename);
+		}
+		_exit(127);
+	}
+	if (*pid < 0) {
+		ret = -errno;
+		close(fds[0]);
+		close(fds[1]);
+		goto out;
+	}
+
+	pr_dbg("%s %s with %s\n", compress ? "Compressing" : "Decompressing",
+	       filename, compress ? cmp->compress[0][0] : cmp->decompress[0]);
+	close(compress ? fds[0] : fds[1]);
+	ret = compress ? fds[1] : fds[0];
+out:
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+int compression_wait(pid_t pid)
+{
+	int status;
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			return -errno;
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		pr_err("The compression tool failed, status 0x%x\n", status);
+		return -EIO;
+	}
+	return 0;
+}
+
+int compression_count(const char *filename, enum compression c,
+		      uint64_t *len)
+{
+	unsigned char buf[64 * 1024];
+	ssize_t n;
+	pid_t pid;
+	int fd, ret;
+
+	fd = compression_pipe(filename, c, 0, &pid);
+	if (fd < 0)
+		return fd;
+	*len = 0;
+	while ((n = read(fd, buf, sizeof(buf))) != 0) {
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			break;
+		*len += n;
+	}
+	ret = n < 0 ? -errno : 0;
+	close(fd);
+	if (compression_wait(pid) && !ret)
+		ret = -EIO;
+	return ret;
+}
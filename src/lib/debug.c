@@ -20,17 +20,38 @@
 
 int debug_level = MSG_INFO;
 
+static void (*print_hook)(void *data, const char *msg);
+static void *print_hook_data;
+
+void print_set_hook(void (*hook)(void *data, const char *msg), void *data)
+{
+	print_hook = hook;
+	print_hook_data = data;
+}
+
 void print_leveled(const char *debug_module, enum msglevel level,
 		   const char *format, ...)
 {
 	va_list ap;
+	char msg[1024];
+	int len = 0;
 
 	if (level > debug_level)
 		return;
 
+	if (!print_hook) {
+		if (*debug_module)
+			printf("[%s]", debug_module);
+		va_start(ap, format);
+		vprintf(format, ap);
+		va_end(ap);
+		return;
+	}
+
 	if (*debug_module)
-		printf("[%s]", debug_module);
+		len = snprintf(msg, sizeof(msg), "[%s]", debug_module);
 	va_start(ap, format);
-	vprintf(format, ap);
+	vsnprintf(msg + len, sizeof(msg) - len, format, ap);
 	va_end(ap);
+	print_hook(print_hook_data, msg);
 }
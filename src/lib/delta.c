@@ -0,0 +1,252 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "delta"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <debug.h>
+#include <delta.h>
+#include <diff.h>
+#include <hash.h>
+#include <image.h>
+
+/* While the delta is made, marks the changed blocks */
+#define DELTA_CHANGED (1U << 31)
+
+static unsigned char *delta_load_image(const char *filename, uint64_t *len)
+{
+	struct image *img;
+	unsigned char *buf;
+
+	img = image_open(filename);
+	if (!img) {
+		pr_err("Cannot open file %s\n", filename);
+		return NULL;
+	}
+	*len = image_length(img);
+	buf = malloc(*len ? : 1);
+	if (buf && image_read(img, buf, 0, *len)) {
+		pr_err("Couldn't read %ju bytes from %s\n", (uintmax_t)*len,
+		       filename);
+		free(buf);
+		buf = NULL;
+	}
+	image_close(img);
+	return buf;
+}
+
+/*
+ * The checked blocks are the first unchanged block of each of DELTA_MAX_CHECKS
+ * slices of the image, so that they spread over the whole chip. Blank blocks,
+ * which tell apart no image, are only picked when the slice has nothing else.
+ */
+static void delta_pick_checks(struct delta_record *records, uint32_t nb_blocks,
+			      const unsigned char *base, uint64_t len,
+			      uint32_t block_size)
+{
+	uint32_t slice, i, end, blank, blen;
+	uint64_t pos;
+
+	for (slice = 0; slice < DELTA_MAX_CHECKS; slice++) {
+		i = (uint64_t)nb_blocks * slice / DELTA_MAX_CHECKS;
+		end = (uint64_t)nb_blocks * (slice + 1) / DELTA_MAX_CHECKS;
+		for (blank = end; i < end; i++) {
+			if (records[i].flags)
+				continue;
+			pos = (uint64_t)i * block_size;
+			blen = len - pos < block_size ? len - pos : block_size;
+			if (!diff_is_blank(base + pos, blen))
+				break;
+			if (blank == end)
+				blank = i;
+		}
+		if (i < end)
+			records[i].flags = DELTA_CHECK;
+		else if (blank < end)
+			records[blank].flags = DELTA_CHECK | DELTA_BLANK;
+	}
+}
+
+static int delta_write(const char *filename, struct delta_header *hdr,
+		       struct delta_record *records, uint32_t nb_blocks,
+		       const unsigned char *update)
+{
+	struct delta_record r;
+	uint32_t i, len;
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(filename, "w");
+	if (!f) {
+		pr_err("Cannot create delta %s\n", filename);
+		return -errno;
+	}
+	if (fwrite(hdr, sizeof(*hdr), 1, f) < 1)
+		ret = -EIO;
+	for (i = 0; !ret && i < nb_blocks; i++) {
+		r = records[i];
+		if (!r.flags)
+			continue;
+		len = r.flags == DELTA_CHANGED ? hdr->block_size : 0;
+		if ((uint64_t)i * hdr->block_size + len > hdr->image_len)
+			len = hdr->image_len - (uint64_t)i * hdr->block_size;
+		r.flags &= ~DELTA_CHANGED;
+		if (fwrite(&r, sizeof(r), 1, f) < 1 ||
+		    (len && fwrite(update + (uint64_t)i * hdr->block_size, len,
+				   1, f) < 1))
+			ret = -EIO;
+	}
+	if (fclose(f) && !ret)
+		ret = -errno;
+	if (ret)
+		pr_err("Couldn't write delta %s\n", filename);
+	return ret;
+}
+
+int delta_make(const char *base, const char *update, const char *filename,
+	       uint32_t block_size)
+{
+	struct delta_header hdr;
+	struct delta_record *records = NULL;
+	unsigned char *old, *new = NULL;
+	uint64_t old_len, new_len, pos;
+	uint32_t i, len, nb_blocks, nb_changed = 0;
+	int ret = -ENOMEM;
+
+	old = delta_load_image(base, &old_len);
+	if (!old)
+		return -ENOENT;
+	new = delta_load_image(update, &new_len);
+	if (!new) {
+		ret = -ENOENT;
+		goto out;
+	}
+	if (old_len != new_len) {
+		pr_err("Images %s and %s differ in size\n", base, update);
+		ret = -EINVAL;
+		goto out;
+	}
+	nb_blocks = (new_len + block_size - 1) / block_size;
+	records = calloc(nb_blocks ? : 1, sizeof(*records));
+	if (!records)
+		goto out;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, DELTA_MAGIC, sizeof(hdr.magic));
+	hdr.version = DELTA_VERSION;
+	hdr.block_size = block_size;
+	hdr.image_len = new_len;
+	hdr.new_crc = crc32c(0, new, new_len);
+	for (i = 0; i < nb_blocks; i++) {
+		pos = (uint64_t)i * block_size;
+		len = new_len - pos < block_size ? new_len - pos : block_size;
+		records[i].index = i;
+		records[i].base_crc = crc32c(0, old + pos, len);
+		records[i].new_crc = crc32c(0, new + pos, len);
+		if (!memcmp(old + pos, new + pos, len)) {
+			hdr.base_crc = crc32c(hdr.base_crc, old + pos, len);
+			continue;
+		}
+		records[i].flags = diff_is_blank(new + pos, len) ?
+			DELTA_CHANGED | DELTA_BLANK : DELTA_CHANGED;
+		nb_changed++;
+	}
+	delta_pick_checks(records, nb_blocks, old, old_len, block_size);
+	for (i = 0; i < nb_blocks; i++)
+		if (records[i].flags)
+			hdr.nb_records++;
+
+	ret = delta_write(filename, &hdr, records, nb_blocks, new);
+	if (!ret)
+		ret = nb_changed;
+out:
+	free(records);
+	free(new);
+	free(old);
+	return ret;
+}
+
+int delta_load(const char *filename, struct delta *d)
+{
+	struct image *img;
+	uint64_t pos, content_len;
+	uint32_t i, len;
+	int ret = -EINVAL;
+
+	memset(d, 0, sizeof(*d));
+	img = image_open(filename);
+	if (!img) {
+		pr_err("Cannot open delta %s\n", filename);
+		return -ENOENT;
+	}
+	content_len = image_length(img);
+	if (content_len < sizeof(d->hdr) ||
+	    image_read(img, (void *)&d->hdr, 0, sizeof(d->hdr)) ||
+	    memcmp(d->hdr.magic, DELTA_MAGIC, sizeof(d->hdr.magic)) ||
+	    d->hdr.version != DELTA_VERSION || !d->hdr.block_size ||
+	    d->hdr.nb_records > content_len / sizeof(*d->records))
+		goto err;
+
+	ret = -ENOMEM;
+	d->records = calloc(d->hdr.nb_records ? : 1, sizeof(*d->records));
+	d->data = calloc(d->hdr.nb_records ? : 1, sizeof(*d->data));
+	d->content = malloc(content_len);
+	if (!d->records || !d->data || !d->content)
+		goto err;
+
+	ret = -EINVAL;
+	pos = sizeof(d->hdr);
+	for (i = 0; i < d->hdr.nb_records; i++) {
+		if (pos + sizeof(d->records[i]) > content_len ||
+		    image_read(img, (void *)&d->records[i], pos,
+			       sizeof(d->records[i])))
+			goto err;
+		pos += sizeof(d->records[i]);
+		if ((uint64_t)d->records[i].index * d->hdr.block_size >=
+		    d->hdr.image_len ||
+		    (i && d->records[i].index <= d->records[i - 1].index))
+			goto err;
+		if (d->records[i].flags & (DELTA_BLANK | DELTA_CHECK))
+			continue;
+		len = delta_block_len(d, d->records[i].index);
+		if (pos + len > content_len ||
+		    image_read(img, d->content + pos, pos, len))
+			goto err;
+		d->data[i] = d->content + pos;
+		pos += len;
+	}
+	image_close(img);
+	return 0;
+
+err:
+	if (ret == -EINVAL)
+		pr_err("Invalid delta %s\n", filename);
+	image_close(img);
+	delta_release(d);
+	return ret;
+}
+
+void delta_release(struct delta *d)
+{
+	free(d->records);
+	free(d->data);
+	free(d->content);
+	memset(d, 0, sizeof(*d));
+}
@@ -0,0 +1,220 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "diff"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <debug.h>
+#include <diff.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DIFF_X86
+#endif
+
+/*
+ * Summary of one page : whether old and new differ, whether a bit of new is
+ * set where it is cleared in old, and whether new is all 0xff.
+ */
+struct page_diff {
+	int changed;
+	int sets_bits;
+	int blank;
+};
+
+static void diff_page_scalar(const uint8_t *old, const uint8_t *new,
+			     size_t len, struct page_diff *pd)
+{
+	uint8_t x = 0, s = 0, b = 0xff;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		x |= old[i] ^ new[i];
+		s |= new[i] & ~old[i];
+		b &= new[i];
+	}
+	pd->changed = x != 0;
+	pd->sets_bits = s != 0;
+	pd->blank = b == 0xff;
+}
+
+#ifdef DIFF_X86
+static void __attribute__((target("sse2")))
+diff_page_sse2(const uint8_t *old, const uint8_t *new, size_t len,
+	       struct page_diff *pd)
+{
+	__m128i x = _mm_setzero_si128(), s = x, b = _mm_set1_epi8(-1);
+	__m128i o, n;
+	struct page_diff tail;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		o = _mm_loadu_si128((const __m128i *)(old + i));
+		n = _mm_loadu_si128((const __m128i *)(new + i));
+		x = _mm_or_si128(x, _mm_xor_si128(o, n));
+		s = _mm_or_si128(s, _mm_andnot_si128(o, n));
+		b = _mm_and_si128(b, n);
+	}
+	diff_page_scalar(old + i, new + i, len - i, &tail);
+	pd->changed = tail.changed ||
+		_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())) != 0xffff;
+	pd->sets_bits = tail.sets_bits ||
+		_mm_movemask_epi8(_mm_cmpeq_epi8(s, _mm_setzero_si128())) != 0xffff;
+	pd->blank = tail.blank &&
+		_mm_movemask_epi8(_mm_cmpeq_epi8(b, _mm_set1_epi8(-1))) == 0xffff;
+}
+
+static void __attribute__((target("avx2")))
+diff_page_avx2(const uint8_t *old, const uint8_t *new, size_t len,
+	       struct page_diff *pd)
+{
+	__m256i x = _mm256_setzero_si256(), s = x, b = _mm256_set1_epi8(-1);
+	__m256i o, n;
+	struct page_diff tail;
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		o = _mm256_loadu_si256((const __m256i *)(old + i));
+		n = _mm256_loadu_si256((const __m256i *)(new + i));
+		x = _mm256_or_si256(x, _mm256_xor_si256(o, n));
+		s = _mm256_or_si256(s, _mm256_andnot_si256(o, n));
+		b = _mm256_and_si256(b, n);
+	}
+	diff_page_scalar(old + i, new + i, len - i, &tail);
+	pd->changed = tail.changed || !_mm256_testz_si256(x, x);
+	pd->sets_bits = tail.sets_bits || !_mm256_testz_si256(s, s);
+	pd->blank = tail.blank &&
+		_mm256_testc_si256(b, _mm256_set1_epi8(-1));
+}
+#endif
+
+static void (*diff_page)(const uint8_t *old, const uint8_t *new, size_t len,
+			 struct page_diff *pd) = diff_page_scalar;
+
+static void __attribute__((constructor)) diff_select_kernel(void)
+{
+#ifdef DIFF_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		diff_page = diff_page_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		diff_page = diff_page_sse2;
+#endif
+}
+
+static int ranges_add(struct diff_ranges *ranges, off_t start, size_t len)
+{
+	struct diff_range *last = ranges->nb ? &ranges->range[ranges->nb - 1]
+		: NULL, *r;
+
+	if (last && last->start + last->len == start) {
+		last->len += len;
+		return 0;
+	}
+	if (ranges->nb == ranges->alloc) {
+		r = realloc(ranges->range,
+			    (ranges->alloc + 16) * sizeof(*r));
+		if (!r)
+			return -ENOMEM;
+		ranges->range = r;
+		ranges->alloc += 16;
+	}
+	ranges->range[ranges->nb].start = start;
+	ranges->range[ranges->nb].len = len;
+	ranges->nb++;
+	return 0;
+}
+
+int diff_compute_block(const uint8_t *old, const uint8_t *new, off_t base,
+		       size_t len, unsigned int page_size,
+		       struct diff_block *diff)
+{
+	struct page_diff pd;
+	size_t pos, plen;
+	int changed = 0, sets_bits = 0, blank = 1, ret = 0;
+
+	memset(diff, 0, sizeof(*diff));
+	for (pos = 0; !ret && pos < len; pos += plen) {
+		plen = page_size - (base + pos) % page_size;
+		if (plen > len - pos)
+			plen = len - pos;
+		diff_page(old + pos, new + pos, plen, &pd);
+
+		changed |= pd.changed;
+		sets_bits |= pd.sets_bits;
+		blank &= pd.blank;
+		if (pd.changed)
+			ret = ranges_add(&diff->changed, base + pos, plen);
+		if (!ret && !pd.blank)
+			ret = ranges_add(&diff->data, base + pos, plen);
+	}
+	if (ret) {
+		diff_release_block(diff);
+		return ret;
+	}
+
+	if (blank)
+		diff->flags |= DIFF_BLANK;
+	if (changed)
+		diff->flags |= sets_bits ? DIFF_NEEDS_ERASE : DIFF_BITS_CLEARED;
+	pr_vdbg("block 0x%06x..0x%06x: flags=0x%x, %d changed ranges\n",
+		base, base + len, diff->flags, diff->changed.nb);
+	return 0;
+}
+
+void diff_release_block(struct diff_block *diff)
+{
+	diff_release_ranges(&diff->changed);
+	diff_release_ranges(&diff->data);
+	diff->flags = 0;
+}
+
+/* Comparing a buffer with itself only computes its blank state. */
+int diff_is_blank(const uint8_t *buf, size_t len)
+{
+	struct page_diff pd;
+
+	diff_page(buf, buf, len, &pd);
+	return pd.blank;
+}
+
+int diff_data_ranges(const uint8_t *buf, off_t base, size_t len,
+		     unsigned int page_size, struct diff_ranges *ranges)
+{
+	size_t pos, plen;
+	int ret = 0;
+
+	memset(ranges, 0, sizeof(*ranges));
+	for (pos = 0; !ret && pos < len; pos += plen) {
+		plen = page_size - (base + pos) % page_size;
+		if (plen > len - pos)
+			plen = len - pos;
+		if (!diff_is_blank(buf + pos, plen))
+			ret = ranges_add(ranges, base + pos, plen);
+	}
+	if (ret)
+		diff_release_ranges(ranges);
+	return ret;
+}
+
+void diff_release_ranges(struct diff_ranges *ranges)
+{
+	free(ranges->range);
+	memset(ranges, 0, sizeof(*ranges));
+}
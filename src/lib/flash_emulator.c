@@ -0,0 +1,222 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "flash-emulator"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chip.h>
+#include <debug.h>
+#include <flash_emulator.h>
+#include <image.h>
+#include <spi_nor.h>
+
+int flash_emulator_init(struct flash_emulator *emu, size_t size,
+			unsigned int page_size, uint32_t manufacture_id,
+			uint32_t model_id)
+{
+	memset(emu, 0, sizeof(*emu));
+	emu->mem = malloc(size);
+	if (!emu->mem)
+		return -ENOMEM;
+	memset(emu->mem, 0xff, size);
+	emu->size = size;
+	emu->page_size = page_size;
+	emu->id[0] = manufacture_id & 0xff;
+	emu->id[1] = (model_id >> 8) & 0xff;
+	emu->id[2] = model_id & 0xff;
+
+	return 0;
+}
+
+void flash_emulator_release(struct flash_emulator *emu)
+{
+	free(emu->mem);
+	emu->mem = NULL;
+}
+
+int flash_emulator_load(struct flash_emulator *emu, const char *image)
+{
+	struct flashchip *chip;
+	ssize_t size;
+	int ret;
+
+	size = image_size(image);
+	if (size < 0)
+		return size;
+	for_each_chip(chip)
+		if (chip->bustype == BUS_SPI &&
+		    chip->total_size_kb * 1024 == size)
+			break;
+	if (&chip->list == &chips) {
+		pr_err("No known SPI chip of %zd bytes to emulate\n", size);
+		return -EINVAL;
+	}
+
+	ret = flash_emulator_init(emu, size, chip->page_size,
+				  chip->manufacture_id, chip->model_id);
+	if (ret)
+		return ret;
+	ret = image_load(image, emu->mem, size);
+	if (ret) {
+		flash_emulator_release(emu);
+		return ret;
+	}
+	pr_info("Emulating a %s %s with %s\n", chip->vendor, chip->name,
+		image);
+	return 0;
+}
+
+int flash_emulator_save(struct flash_emulator *emu, const char *image)
+{
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(image, "w");
+	if (!f || fwrite(emu->mem, emu->size, 1, f) != 1) {
+		pr_err("Couldn't save the emulated chip into %s\n", image);
+		ret = -EIO;
+	}
+	if (f && fclose(f))
+		ret = -EIO;
+	return ret;
+}
+
+static off_t cmd_addr(const unsigned char *writearr)
+{
+	return (writearr[1] << 16) | (writearr[2] << 8) | writearr[3];
+}
+
+int flash_emulator_read(struct flash_emulator *emu, uint8_t *buf,
+			off_t start, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = emu->mem[(start + i) % emu->size];
+	return len;
+}
+
+int flash_emulator_program(struct flash_emulator *emu, const uint8_t *buf,
+			   off_t start, size_t len)
+{
+	off_t page = start - start % emu->page_size;
+	size_t i;
+
+	/* A page program wraps around within its page, as on real chips. */
+	for (i = 0; i < len; i++)
+		emu->mem[(page + (start - page + i) % emu->page_size) %
+			 emu->size] &= buf[i];
+	return len;
+}
+
+static int flash_emulator_erase(struct flash_emulator *emu, off_t addr,
+				size_t blocklen)
+{
+	if (!(emu->status & SPI_SR_WEL) || emu->status & SPI_SR_BP_MASK)
+		return 0;
+	addr -= addr % blocklen;
+	if (addr + blocklen > emu->size)
+		return -EINVAL;
+	memset(emu->mem + addr, 0xff, blocklen);
+	emu->status &= ~SPI_SR_WEL;
+	return 0;
+}
+
+int flash_emulator_command(struct flash_emulator *emu, unsigned int writecnt,
+			   unsigned int readcnt, const unsigned char *writearr,
+			   unsigned char *readarr)
+{
+	if (!writecnt)
+		return -EINVAL;
+	emu->nb_commands++;
+	memset(readarr, 0xff, readcnt);
+
+	switch (writearr[0]) {
+	case JEDEC_RDID:
+		memcpy(readarr, emu->id, readcnt < 3 ? readcnt : 3);
+		break;
+	case JEDEC_RDSR:
+		if (readcnt)
+			readarr[0] = emu->status;
+		break;
+	case JEDEC_WREN:
+		emu->status |= SPI_SR_WEL;
+		break;
+	case JEDEC_EWSR:
+		emu->ewsr = 1;
+		break;
+	case JEDEC_WRSR:
+		if (writecnt < JEDEC_WRSR_OUTSIZE)
+			return -EINVAL;
+		if (emu->ewsr || emu->status & SPI_SR_WEL)
+			emu->status = writearr[1] & ~(SPI_SR_WIP | SPI_SR_WEL);
+		emu->ewsr = 0;
+		break;
+	case JEDEC_WRDI:
+		emu->status &= ~(SPI_SR_WEL | SPI_SR_AAI);
+		emu->aai = 0;
+		break;
+	case JEDEC_READ:
+		if (writecnt < JEDEC_READ_OUTSIZE)
+			return -EINVAL;
+		flash_emulator_read(emu, readarr, cmd_addr(writearr), readcnt);
+		break;
+	case JEDEC_BYTE_PROGRAM:
+		if (writecnt < JEDEC_BYTE_PROGRAM_OUTSIZE)
+			return -EINVAL;
+		if (!(emu->status & SPI_SR_WEL) ||
+		    emu->status & SPI_SR_BP_MASK)
+			break;
+		flash_emulator_program(emu, writearr + 4, cmd_addr(writearr),
+				       writecnt - 4);
+		emu->status &= ~SPI_SR_WEL;
+		break;
+	case JEDEC_AAI_WORD_PROGRAM:
+		if (!emu->aai) {
+			if (writecnt < JEDEC_AAI_WORD_PROGRAM_OUTSIZE ||
+			    !(emu->status & SPI_SR_WEL) ||
+			    emu->status & SPI_SR_BP_MASK)
+				return -EINVAL;
+			emu->aai = 1;
+			emu->status |= SPI_SR_AAI;
+			emu->aai_addr = cmd_addr(writearr);
+			writearr += 3;
+		} else if (writecnt < JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE) {
+			return -EINVAL;
+		}
+		emu->mem[emu->aai_addr++ % emu->size] &= writearr[1];
+		emu->mem[emu->aai_addr++ % emu->size] &= writearr[2];
+		break;
+	case JEDEC_SE:
+		return flash_emulator_erase(emu, cmd_addr(writearr), 4 * 1024);
+	case JEDEC_BE_52:
+		return flash_emulator_erase(emu, cmd_addr(writearr), 32 * 1024);
+	case JEDEC_BE_D8:
+		return flash_emulator_erase(emu, cmd_addr(writearr), 64 * 1024);
+	case JEDEC_CE_60:
+	case JEDEC_CE_C7:
+		return flash_emulator_erase(emu, 0, emu->size);
+	default:
+		pr_dbg("unhandled SPI opcode 0x%02x\n", writearr[0]);
+		return -EINVAL;
+	}
+
+	return 0;
+}
@@ -0,0 +1,825 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "image"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <compress.h>
+#include <debug.h>
+#include <diff.h>
+#include <image.h>
+#include <manifest.h>
+#include <socket.h>
+
+#define SPARSE_MAGIC "FR2SPRS"
+#define SPARSE_VERSION 1
+
+/*
+ * Sparse container layout : a header, then the data of each run, then the run
+ * table. Everything outside of the runs is blank.
+ */
+struct sparse_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint64_t image_len;
+	uint64_t runs_offset;
+	uint32_t nb_runs;
+} __attribute__((packed));
+
+struct sparse_run {
+	uint64_t start;
+	uint64_t len;
+	uint64_t data_offset;
+} __attribute__((packed));
+
+struct image {
+	int fd;
+	uint64_t len;
+	int sparse;
+	/* Compressed images only, read through the decompressor pipe */
+	enum compression compression;
+	char *filename;
+	int pipe;
+	pid_t pid;
+	uint64_t pos;
+	/* Sparse containers only */
+	uint32_t block_size;
+	uint32_t nb_runs, alloc_runs;
+	struct sparse_run *runs;
+	uint64_t data_offset;
+};
+
+static int image_pread(int fd, void *buf, size_t len, off_t offset)
+{
+	ssize_t n;
+
+	while (len) {
+		n = pread(fd, buf, len, offset);
+		if (n <= 0)
+			return n < 0 ? -errno : -EIO;
+		buf = (char *)buf + n;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int image_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+	ssize_t n;
+
+	while (len) {
+		n = pwrite(fd, buf, len, offset);
+		if (n <= 0)
+			return n < 0 ? -errno : -EIO;
+		buf = (const char *)buf + n;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * The runs are checked to be sorted, disjoint and within the image, as
+ * sparse_find_run() and image_read() expect them.
+ */
+static int sparse_load(struct image *img, const struct sparse_header *hdr)
+{
+	const struct sparse_run *run;
+	size_t runs_len;
+	uint64_t end = 0;
+	uint32_t i;
+	int ret;
+
+	if (hdr->version != SPARSE_VERSION ||
+	    hdr->nb_runs > SIZE_MAX / sizeof(*img->runs))
+		return -EINVAL;
+	runs_len = hdr->nb_runs * sizeof(*img->runs);
+	img->sparse = 1;
+	img->len = hdr->image_len;
+	img->block_size = hdr->block_size;
+	img->nb_runs = hdr->nb_runs;
+	img->runs = malloc(runs_len ? : 1);
+	if (!img->runs)
+		return -ENOMEM;
+	ret = image_pread(img->fd, img->runs, runs_len, hdr->runs_offset);
+	if (ret)
+		return ret;
+	for (i = 0; i < img->nb_runs; i++) {
+		run = &img->runs[i];
+		if (run->start < end || run->start > img->len ||
+		    run->len > img->len - run->start)
+			return -EINVAL;
+		end = run->start + run->len;
+	}
+	return 0;
+}
+
+static int image_open_compressed(struct image *img, const char *filename)
+{
+	img->filename = strdup(filename);
+	if (!img->filename)
+		return -ENOMEM;
+	img->pipe = -1;
+	if (compression_length(img->fd, img->compression, &img->len)) {
+		pr_dbg("No uncompressed size in %s, decompressing it\n",
+		       filename);
+		if (compression_count(filename, img->compression,
+				      &img->len)) {
+			pr_err("Couldn't decompress %s\n", filename);
+			return -EINVAL;
+		}
+	}
+	pr_dbg("Compressed image %s: %ju bytes\n", filename,
+	       (uintmax_t)img->len);
+	return 0;
+}
+
+struct image *image_open(const char *filename)
+{
+	struct sparse_header hdr;
+	struct image *img;
+	struct stat st;
+
+	img = calloc(1, sizeof(*img));
+	if (!img)
+		return NULL;
+	img->fd = open(filename, O_RDONLY);
+	if (img->fd < 0 || fstat(img->fd, &st))
+		goto err;
+	img->len = st.st_size;
+
+	if (st.st_size >= sizeof(hdr) &&
+	    !image_pread(img->fd, &hdr, sizeof(hdr), 0)) {
+		img->compression = compression_detect((void *)&hdr,
+						      sizeof(hdr));
+		if (img->compression &&
+		    image_open_compressed(img, filename))
+			goto err;
+	}
+	if (!img->compression && st.st_size >= sizeof(hdr) &&
+	    !memcmp(hdr.magic, SPARSE_MAGIC, sizeof(hdr.magic))) {
+		if (sparse_load(img, &hdr)) {
+			pr_err("Invalid sparse image %s\n", filename);
+			goto err;
+		}
+		pr_dbg("Sparse image %s: %u runs\n", filename, img->nb_runs);
+	}
+	return img;
+
+err:
+	if (img->fd >= 0)
+		close(img->fd);
+	free(img->filename);
+	free(img->runs);
+	free(img);
+	return NULL;
+}
+
+uint64_t image_length(struct image *img)
+{
+	return img->len;
+}
+
+int image_compressed(struct image *img)
+{
+	return img->compression != COMPRESSION_NONE;
+}
+
+/*
+ * A decompressor stopped before the end of its output is killed. Otherwise its
+ * status tells whether the content passed the integrity checks of the format.
+ */
+static int compressed_stop(struct image *img)
+{
+	int ret = 0;
+
+	if (img->pipe < 0)
+		return 0;
+	close(img->pipe);
+	img->pipe = -1;
+	if (img->pos < img->len) {
+		kill(img->pid, SIGTERM);
+		waitpid(img->pid, NULL, 0);
+		return 0;
+	}
+	ret = compression_wait(img->pid);
+	if (ret)
+		pr_err("Decompression of %s failed\n", img->filename);
+	return ret;
+}
+
+/* Reading backwards restarts the decompression from the start */
+static int compressed_read(struct image *img, unsigned char *buf,
+			   uint64_t offset, size_t len)
+{
+	unsigned char skip[16 * 1024];
+	size_t n;
+	int ret;
+
+	if (img->pipe >= 0 && offset < img->pos)
+		compressed_stop(img);
+	if (img->pipe < 0) {
+		img->pipe = compression_pipe(img->filename, img->compression, 0,
+					     &img->pid);
+		if (img->pipe < 0)
+			return img->pipe;
+		img->pos = 0;
+	}
+	for (ret = 0; !ret && img->pos < offset; img->pos += n) {
+		n = offset - img->pos < sizeof(skip) ? offset - img->pos :
+			sizeof(skip);
+		ret = read_full(img->pipe, skip, n);
+	}
+	if (!ret)
+		ret = read_full(img->pipe, buf, len);
+	if (ret) {
+		pr_err("Couldn't decompress %s\n", img->filename);
+		return ret;
+	}
+	img->pos += len;
+	if (img->pos == img->len)
+		ret = compressed_stop(img);
+	return ret;
+}
+
+/* Index of the first run ending after offset. */
+static uint32_t sparse_find_run(struct image *img, uint64_t offset)
+{
+	uint32_t lo = 0, hi = img->nb_runs, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (img->runs[mid].start + img->runs[mid].len <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int image_read(struct image *img, unsigned char *buf, uint64_t offset,
+	       size_t len)
+{
+	struct sparse_run *run;
+	uint64_t from, to, end = offset + len;
+	uint32_t i;
+	int ret;
+
+	if (end > img->len)
+		return -EINVAL;
+	if (img->compression)
+		return compressed_read(img, buf, offset, len);
+	if (!img->sparse)
+		return image_pread(img->fd, buf, len, offset);
+
+	memset(buf, 0xff, len);
+	for (i = sparse_find_run(img, offset); i < img->nb_runs; i++) {
+		run = &img->runs[i];
+		if (run->start >= end)
+			break;
+		from = run->start > offset ? run->start : offset;
+		to = run->start + run->len < end ? run->start + run->len : end;
+		ret = image_pread(img->fd, buf + (from - offset), to - from,
+				  run->data_offset + (from - run->start));
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+void image_close(struct image *img)
+{
+	if (!img)
+		return;
+	if (img->compression)
+		compressed_stop(img);
+	close(img->fd);
+	free(img->filename);
+	free(img->runs);
+	free(img);
+}
+
+struct image *image_create_sparse(const char *filename, uint32_t block_size)
+{
+	struct image *img;
+	int err;
+
+	img = calloc(1, sizeof(*img));
+	if (!img)
+		return NULL;
+	img->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (img->fd < 0) {
+		err = errno;
+		free(img);
+		errno = err;
+		return NULL;
+	}
+	img->sparse = 1;
+	img->block_size = block_size;
+	img->data_offset = sizeof(struct sparse_header);
+	return img;
+}
+
+static int sparse_add_data(struct image *img, uint64_t start, size_t len)
+{
+	struct sparse_run *run = img->nb_runs ? &img->runs[img->nb_runs - 1]
+		: NULL;
+
+	if (run && run->start + run->len == start) {
+		run->len += len;
+		return 0;
+	}
+	if (img->nb_runs == img->alloc_runs) {
+		run = realloc(img->runs,
+			      (img->alloc_runs + 64) * sizeof(*run));
+		if (!run)
+			return -ENOMEM;
+		img->runs = run;
+		img->alloc_runs += 64;
+	}
+	run = &img->runs[img->nb_runs++];
+	run->start = start;
+	run->len = len;
+	run->data_offset = img->data_offset;
+	return 0;
+}
+
+int image_append(struct image *img, const unsigned char *buf, size_t len)
+{
+	size_t pos, blen;
+	int ret;
+
+	for (pos = 0; pos < len; pos += blen) {
+		blen = img->block_size - (img->len + pos) % img->block_size;
+		if (blen > len - pos)
+			blen = len - pos;
+		if (diff_is_blank(buf + pos, blen))
+			continue;
+		ret = sparse_add_data(img, img->len + pos, blen);
+		if (!ret)
+			ret = image_pwrite(img->fd, buf + pos, blen,
+					   img->data_offset);
+		if (ret)
+			return ret;
+		img->data_offset += blen;
+	}
+	img->len += len;
+	return 0;
+}
+
+int image_finish(struct image *img)
+{
+	struct sparse_header hdr;
+	int ret;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SPARSE_MAGIC, sizeof(hdr.magic));
+	hdr.version = SPARSE_VERSION;
+	hdr.block_size = img->block_size;
+	hdr.image_len = img->len;
+	hdr.runs_offset = img->data_offset;
+	hdr.nb_runs = img->nb_runs;
+
+	ret = image_pwrite(img->fd, img->runs,
+			   img->nb_runs * sizeof(*img->runs), img->data_offset);
+	if (!ret)
+		ret = image_pwrite(img->fd, &hdr, sizeof(hdr), 0);
+	pr_dbg("Sparse image: %u runs, %ju bytes stored out of %ju\n",
+	       img->nb_runs, (uintmax_t)(img->data_offset - sizeof(hdr)),
+	       (uintmax_t)img->len);
+	if (close(img->fd) && !ret)
+		ret = -errno;
+	free(img->runs);
+	free(img);
+	return ret;
+}
+
+ssize_t image_size(const char *filename)
+{
+	struct image *img;
+	ssize_t len;
+
+	img = image_open(filename);
+	if (!img)
+		return -ENOENT;
+	len = image_length(img);
+	image_close(img);
+	return len;
+}
+
+int image_load(const char *filename, unsigned char *buf, size_t len)
+{
+	struct image *img;
+	struct manifest m;
+	uint64_t pos, end;
+	unsigned int skipped = 0;
+	int ret, blank;
+
+	img = image_open(filename);
+	if (!img) {
+		pr_err("Cannot open file %s\n", filename);
+		return -ENOENT;
+	}
+	if (img->sparse || img->compression ||
+	    manifest_load_for_image(filename, &m)) {
+		ret = image_read(img, buf, 0, len);
+		goto out;
+	}
+
+	/* Contiguous blocks of the same kind are handled at once. */
+	ret = 0;
+	for (pos = 0; !ret && pos < len; pos = end) {
+		blank = manifest_block_blank(&m, pos / m.block_size);
+		for (end = pos; end < len; end += m.block_size) {
+			if (manifest_block_blank(&m, end / m.block_size) != blank)
+				break;
+			skipped += blank ? 1 : 0;
+		}
+		if (end > len)
+			end = len;
+		if (blank)
+			memset(buf + pos, 0xff, end - pos);
+		else
+			ret = image_read(img, buf + pos, pos, end - pos);
+	}
+	pr_dbg("Loaded %s, %u blank blocks skipped\n", filename, skipped);
+	manifest_release(&m);
+out:
+	if (ret)
+		pr_err("Couldn't read %zd bytes from %s\n", len, filename);
+	image_close(img);
+	return ret;
+}
+
+struct image_cache {
+	char *filename;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	unsigned char *buf;
+	size_t len;
+	/* A compressed image is decompressed into buf by a producer thread */
+	int streaming;
+	struct image *img;
+	pthread_t producer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	size_t avail;
+	int done, stop, error;
+	/* The manifest of the content, when the preload hashed it */
+	struct manifest manifest;
+	int hashed;
+	struct image_cache *next;
+};
+
+#define IMAGE_STREAM_CHUNK (64 * 1024)
+
+static void *image_cache_produce(void *arg)
+{
+	struct image_cache *entry = arg;
+	size_t pos, n;
+	int ret = 0, stop = 0;
+
+	for (pos = 0; !ret && !stop && pos < entry->len; pos += n) {
+		n = entry->len - pos < IMAGE_STREAM_CHUNK ? entry->len - pos :
+			IMAGE_STREAM_CHUNK;
+		ret = image_read(entry->img, entry->buf + pos, pos, n);
+		pthread_mutex_lock(&entry->lock);
+		if (!ret)
+			entry->avail = pos + n;
+		stop = entry->stop;
+		pthread_cond_broadcast(&entry->cond);
+		pthread_mutex_unlock(&entry->lock);
+	}
+	image_close(entry->img);
+	entry->img = NULL;
+
+	pthread_mutex_lock(&entry->lock);
+	entry->error = ret;
+	entry->done = 1;
+	pthread_cond_broadcast(&entry->cond);
+	pthread_mutex_unlock(&entry->lock);
+	return NULL;
+}
+
+static int image_cache_stream(struct image_cache *entry, struct image *img)
+{
+	entry->img = img;
+	pthread_mutex_init(&entry->lock, NULL);
+	pthread_cond_init(&entry->cond, NULL);
+	if (pthread_create(&entry->producer, NULL, image_cache_produce,
+			   entry)) {
+		pthread_mutex_destroy(&entry->lock);
+		pthread_cond_destroy(&entry->cond);
+		return -EAGAIN;
+	}
+	entry->streaming = 1;
+	return 0;
+}
+
+static void image_cache_free(struct image_cache *entry)
+{
+	if (entry->streaming) {
+		pthread_mutex_lock(&entry->lock);
+		entry->stop = 1;
+		pthread_mutex_unlock(&entry->lock);
+		pthread_join(entry->producer, NULL);
+		pthread_mutex_destroy(&entry->lock);
+		pthread_cond_destroy(&entry->cond);
+	}
+	if (entry->hashed)
+		manifest_release(&entry->manifest);
+	free(entry->filename);
+	free(entry->buf);
+	free(entry);
+}
+
+static int image_cache_failed(struct image_cache *entry)
+{
+	int error;
+
+	if (!entry->streaming)
+		return 0;
+	pthread_mutex_lock(&entry->lock);
+	error = entry->error;
+	pthread_mutex_unlock(&entry->lock);
+	return error;
+}
+
+static int image_cache_match(struct image_cache *entry, const char *filename,
+			     const struct stat *st)
+{
+	return !strcmp(entry->filename, filename) &&
+		entry->dev == st->st_dev && entry->ino == st->st_ino &&
+		entry->size == st->st_size &&
+		entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+		entry->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+		!image_cache_failed(entry);
+}
+
+/* Only the IMAGE_CACHE_MAX most recently used images are kept */
+static void image_cache_trim(struct image_cache **cache)
+{
+	struct image_cache *entry, **prev;
+	int nb = 0;
+
+	for (prev = cache; (entry = *prev); ) {
+		if (++nb <= IMAGE_CACHE_MAX) {
+			prev = &entry->next;
+			continue;
+		}
+		*prev = entry->next;
+		image_cache_free(entry);
+	}
+}
+
+const unsigned char *image_cache_get(struct image_cache **cache,
+				     const char *filename, size_t *len)
+{
+	struct image_cache *entry, **prev;
+	struct image *img;
+	struct stat st;
+	size_t size;
+	int ret;
+
+	if (stat(filename, &st))
+		return NULL;
+	for (prev = cache; (entry = *prev); prev = &entry->next) {
+		if (!image_cache_match(entry, filename, &st))
+			continue;
+		/* Most recently used first */
+		*prev = entry->next;
+		entry->next = *cache;
+		*cache = entry;
+		pr_dbg("Using cached image %s\n", filename);
+		*len = entry->len;
+		return entry->buf;
+	}
+
+	img = image_open(filename);
+	if (!img)
+		return NULL;
+	size = image_length(img);
+	entry = calloc(1, sizeof(*entry));
+	if (!entry) {
+		image_close(img);
+		return NULL;
+	}
+	entry->filename = strdup(filename);
+	entry->buf = malloc(size ? : 1);
+	entry->len = size;
+	if (!entry->filename || !entry->buf) {
+		image_close(img);
+		image_cache_free(entry);
+		return NULL;
+	}
+	if (image_compressed(img)) {
+		ret = image_cache_stream(entry, img);
+		if (ret)
+			image_close(img);
+	} else {
+		image_close(img);
+		ret = image_load(filename, entry->buf, size);
+	}
+	if (ret) {
+		image_cache_free(entry);
+		return NULL;
+	}
+	entry->dev = st.st_dev;
+	entry->ino = st.st_ino;
+	entry->size = st.st_size;
+	entry->mtime = st.st_mtim;
+	entry->next = *cache;
+	*cache = entry;
+	image_cache_trim(cache);
+
+	*len = size;
+	return (*cache)->buf;
+}
+
+static struct image_cache *image_cache_find(struct image_cache *cache,
+					    const unsigned char *p)
+{
+	for (; cache; cache = cache->next)
+		if (p >= cache->buf && p <= cache->buf + cache->len)
+			return cache;
+	return NULL;
+}
+
+size_t image_cache_available(struct image_cache **cache,
+			     const unsigned char *p, size_t len)
+{
+	struct image_cache *entry = image_cache_find(*cache, p);
+	size_t avail;
+
+	if (!entry || !entry->streaming)
+		return len;
+	pthread_mutex_lock(&entry->lock);
+	avail = entry->avail;
+	pthread_mutex_unlock(&entry->lock);
+	avail = avail > p - entry->buf ? avail - (p - entry->buf) : 0;
+	return avail < len ? avail : len;
+}
+
+int image_cache_wait(struct image_cache **cache, const unsigned char *p,
+		     size_t len)
+{
+	struct image_cache *entry = image_cache_find(*cache, p);
+	size_t end;
+	int ret;
+
+	if (!entry || !entry->streaming)
+		return 0;
+	end = (p - entry->buf) + len;
+	pthread_mutex_lock(&entry->lock);
+	while (entry->avail < end && !entry->done)
+		pthread_cond_wait(&entry->cond, &entry->lock);
+	ret = entry->avail >= end ? 0 : entry->error ? : -EIO;
+	pthread_mutex_unlock(&entry->lock);
+	return ret;
+}
+
+size_t image_cache_span(struct image_cache **cache, const unsigned char *p,
+			size_t len, int *blank)
+{
+	struct image_cache *entry = image_cache_find(*cache, p);
+	const struct manifest *m;
+	uint64_t off, end;
+
+	*blank = 0;
+	if (!entry || !entry->hashed || !len)
+		return len;
+	m = &entry->manifest;
+	off = p - entry->buf;
+	*blank = manifest_block_blank(m, off / m->block_size);
+	for (end = off - off % m->block_size; end < off + len;
+	     end += m->block_size)
+		if (manifest_block_blank(m, end / m->block_size) != *blank)
+			break;
+	return end < off + len ? end - off : len;
+}
+
+void image_cache_release(struct image_cache **cache)
+{
+	struct image_cache *entry;
+
+	while ((entry = *cache)) {
+		*cache = entry->next;
+		image_cache_free(entry);
+	}
+}
+
+struct image_preload {
+	pthread_t thread;
+	const struct image_preload_file *files;
+	int nb_files;
+	struct image_cache *cache;
+};
+
+/*
+ * The manifest of a loaded image is kept with its content : it is loaded if
+ * the image has a valid one, or else hashed from memory.
+ */
+static void image_preload_file(struct image_preload *preload,
+			       const struct image_preload_file *file)
+{
+	struct image_cache *entry;
+	const unsigned char *buf;
+	size_t len;
+
+	buf = image_cache_get(&preload->cache, file->filename, &len);
+	if (!buf)
+		return;
+	entry = image_cache_find(preload->cache, buf);
+	if (entry->hashed)
+		return;
+	if (!manifest_load_for_image(file->filename, &entry->manifest)) {
+		if (entry->manifest.image_len == len) {
+			entry->hashed = 1;
+			return;
+		}
+		manifest_release(&entry->manifest);
+	}
+	if (image_cache_wait(&preload->cache, buf, len) ||
+	    manifest_init(&entry->manifest, len, MANIFEST_BLOCK_SIZE))
+		return;
+	manifest_hash(&entry->manifest, buf, 0, len);
+	entry->hashed = 1;
+}
+
+static void *image_preload_run(void *arg)
+{
+	struct image_preload *preload = arg;
+	int i;
+
+	for (i = 0; i < preload->nb_files; i++)
+		image_preload_file(preload, &preload->files[i]);
+	return NULL;
+}
+
+struct image_preload *
+image_preload_start(const struct image_preload_file *files, int nb_files)
+{
+	struct image_preload *preload;
+
+	preload = calloc(1, sizeof(*preload));
+	if (!preload)
+		return NULL;
+	preload->files = files;
+	preload->nb_files = nb_files;
+	if (pthread_create(&preload->thread, NULL, image_preload_run,
+			   preload)) {
+		free(preload);
+		return NULL;
+	}
+	pr_dbg("Preloading %d image files\n", nb_files);
+	return preload;
+}
+
+void image_preload_finish(struct image_preload *preload,
+			  struct image_cache **cache)
+{
+	struct image_cache *entry, **prev, **last;
+
+	pthread_join(preload->thread, NULL);
+
+	/* The preloaded images go first, replacing the older ones */
+	for (last = &preload->cache; *last; last = &(*last)->next) {
+		for (prev = cache; (entry = *prev); ) {
+			if (strcmp(entry->filename, (*last)->filename)) {
+				prev = &entry->next;
+				continue;
+			}
+			*prev = entry->next;
+			image_cache_free(entry);
+		}
+	}
+	*last = *cache;
+	*cache = preload->cache;
+	image_cache_trim(cache);
+	free(preload);
+}
@@ -0,0 +1,411 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "libflashrom2"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <buffer_pool.h>
+#include <chip.h>
+#include <debug.h>
+#include <libflashrom2.h>
+#include <list.h>
+#include <operations.h>
+#include <programmer.h>
+#include <write_strategy.h>
+
+/* Granularity of progress notifications. */
+#define FR2_CHUNK_SIZE (64 * 1024)
+
+enum fr2_job_type {
+	FR2_JOB_READ = 0,
+	FR2_JOB_WRITE,
+	FR2_JOB_VERIFY,
+};
+
+struct fr2_job {
+	enum fr2_job_type type;
+	unsigned char *buf;
+	off_t where;
+	size_t len;
+	fr2_callback cb;
+	void *data;
+
+	int done;
+	int status;
+	pthread_cond_t cond;
+	struct fr2_context *ctx;
+	struct list_head list;
+};
+
+struct fr2_context {
+	struct context ctx;
+	int event_fd;
+	int stop;
+	pthread_t worker;
+	pthread_mutex_t lock;
+	/*
+	 * Held while a job runs on ctx, and while ctx is used or changed. It
+	 * is recursive, so that the progress callbacks may use the context.
+	 */
+	pthread_mutex_t run_lock;
+	pthread_cond_t cond;
+	struct list_head jobs;
+};
+
+int fr2_api_version(void)
+{
+	return FR2_API_VERSION;
+}
+
+void fr2_set_log_callback(void (*log)(void *data, const char *msg),
+			  void *data)
+{
+	print_set_hook(log, data);
+}
+
+void fr2_set_verbosity(int level)
+{
+	debug_level = level;
+}
+
+static void job_progress(struct fr2_job *job, size_t done)
+{
+	if (job->cb)
+		job->cb(job, FR2_EVENT_PROGRESS, done, job->len, job->data);
+}
+
+static int job_read(struct context *ctx, struct fr2_job *job)
+{
+	size_t done, chunk;
+	int ret;
+
+	for (done = 0; done < job->len; done += chunk) {
+		chunk = job->len - done;
+		if (chunk > FR2_CHUNK_SIZE)
+			chunk = FR2_CHUNK_SIZE;
+		ret = chip_read(ctx, job->buf + done, job->where + done, chunk);
+		if (ret < (int)chunk)
+			return ret < 0 ? ret : -EIO;
+		job_progress(job, done + chunk);
+	}
+	return 0;
+}
+
+static int job_verify(struct context *ctx, struct fr2_job *job)
+{
+	unsigned char *tmp;
+	size_t done, chunk;
+	int ret = 0;
+
+	tmp = buffer_get(&ctx->buffers, FR2_CHUNK_SIZE);
+	if (!tmp)
+		return -ENOMEM;
+	for (done = 0; !ret && done < job->len; done += chunk) {
+		chunk = job->len - done;
+		if (chunk > FR2_CHUNK_SIZE)
+			chunk = FR2_CHUNK_SIZE;
+		ret = chip_read(ctx, tmp, job->where + done, chunk);
+		if (ret < (int)chunk)
+			ret = ret < 0 ? ret : -EIO;
+		else if (memcmp(tmp, job->buf + done, chunk))
+			ret = -EIO;
+		else
+			ret = 0;
+		job_progress(job, done + chunk);
+	}
+	buffer_put(&ctx->buffers, tmp);
+	return ret;
+}
+
+/*
+ * Writes are cut in pieces of at least FR2_CHUNK_SIZE bytes, aligned on the
+ * biggest erase block the write strategies can use below the whole chip, so
+ * that no erase block is shared by two pieces planned and erased on their own.
+ */
+static int job_write(struct context *ctx, struct fr2_job *job)
+{
+	off_t pos = job->where, end = job->where + job->len;
+	size_t chunk, piece = chip_biggest_erase_block(ctx->chip);
+	int ret;
+
+	if (piece < FR2_CHUNK_SIZE)
+		piece = piece ? piece * ((FR2_CHUNK_SIZE + piece - 1) / piece) :
+			FR2_CHUNK_SIZE;
+	while (pos < end) {
+		chunk = piece - pos % piece;
+		if (chunk > end - pos)
+			chunk = end - pos;
+		ret = chip_write_image(ctx, job->buf + (pos - job->where), pos,
+				       chunk);
+		if (ret < 0)
+			return ret;
+		pos += chunk;
+		job_progress(job, pos - job->where);
+	}
+	return 0;
+}
+
+static void *fr2_worker(void *arg)
+{
+	struct fr2_context *fctx = arg;
+	struct fr2_job *job;
+	uint64_t one = 1;
+	int ret;
+
+	pthread_mutex_lock(&fctx->lock);
+	while (1) {
+		while (!fctx->stop && list_empty(&fctx->jobs))
+			pthread_cond_wait(&fctx->cond, &fctx->lock);
+		if (list_empty(&fctx->jobs))
+			break;
+		job = list_first_entry(&fctx->jobs, struct fr2_job, list);
+		list_del(&job->list);
+		pthread_mutex_unlock(&fctx->lock);
+
+		pthread_mutex_lock(&fctx->run_lock);
+		switch (job->type) {
+		case FR2_JOB_READ:
+			ret = job_read(&fctx->ctx, job);
+			break;
+		case FR2_JOB_WRITE:
+			ret = job_write(&fctx->ctx, job);
+			break;
+		case FR2_JOB_VERIFY:
+			ret = job_verify(&fctx->ctx, job);
+			break;
+		default:
+			ret = -EINVAL;
+		}
+		pthread_mutex_unlock(&fctx->run_lock);
+		pr_dbg("job %p done: %d\n", job, ret);
+
+		/*
+		 * Once done, the job may be freed by its waiter : it isn't
+		 * touched anymore, and the completion is signaled last.
+		 */
+		if (job->cb)
+			job->cb(job, FR2_EVENT_DONE, job->len, job->len,
+				job->data);
+		pthread_mutex_lock(&fctx->lock);
+		job->status = ret;
+		job->done = 1;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&fctx->lock);
+		if (write(fctx->event_fd, &one, sizeof(one)) != sizeof(one))
+			pr_err("Couldn't signal job completion\n");
+		pthread_mutex_lock(&fctx->lock);
+	}
+	pthread_mutex_unlock(&fctx->lock);
+
+	return NULL;
+}
+
+struct fr2_context *fr2_open(const char *programmer_args)
+{
+	struct fr2_context *fctx;
+	pthread_mutexattr_t attr;
+
+	fctx = calloc(1, sizeof(*fctx));
+	if (!fctx)
+		return NULL;
+	INIT_LIST_HEAD(&fctx->jobs);
+	fctx->ctx.write_strategy = WIPE_BY_BIGGEST_ERASES;
+	fctx->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fctx->event_fd < 0)
+		goto err;
+	if (op_set_programmer(&fctx->ctx, (char *)programmer_args))
+		goto err_fd;
+
+	pthread_mutex_init(&fctx->lock, NULL);
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&fctx->run_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_cond_init(&fctx->cond, NULL);
+	if (pthread_create(&fctx->worker, NULL, fr2_worker, fctx))
+		goto err_programmer;
+
+	return fctx;
+
+err_programmer:
+	programmer_shutdown(&fctx->ctx);
+	free(fctx->ctx.programmer_args);
+err_fd:
+	close(fctx->event_fd);
+err:
+	free(fctx);
+	return NULL;
+}
+
+int fr2_probe(struct fr2_context *fctx, const char *chipname)
+{
+	int ret;
+
+	pthread_mutex_lock(&fctx->run_lock);
+	ret = op_set_chip(&fctx->ctx, (char *)(chipname ? : "automatic"));
+	if (ret)
+		fctx->ctx.chip = NULL;
+	pthread_mutex_unlock(&fctx->run_lock);
+	return ret;
+}
+
+const char *fr2_chip_name(struct fr2_context *fctx)
+{
+	const char *name;
+
+	pthread_mutex_lock(&fctx->run_lock);
+	name = fctx->ctx.chip ? fctx->ctx.chip->name : NULL;
+	pthread_mutex_unlock(&fctx->run_lock);
+	return name;
+}
+
+size_t fr2_chip_size(struct fr2_context *fctx)
+{
+	size_t size;
+
+	pthread_mutex_lock(&fctx->run_lock);
+	size = fctx->ctx.chip ? fctx->ctx.chip->total_size_kb * 1024 : 0;
+	pthread_mutex_unlock(&fctx->run_lock);
+	return size;
+}
+
+int fr2_set_write_strategy(struct fr2_context *fctx, const char *strategy)
+{
+	enum write_strategy s = parse_write_strategy(strategy);
+
+	if (s == UNKNOWN)
+		return -EINVAL;
+	pthread_mutex_lock(&fctx->run_lock);
+	fctx->ctx.write_strategy = s;
+	pthread_mutex_unlock(&fctx->run_lock);
+	return 0;
+}
+
+int fr2_event_fd(struct fr2_context *fctx)
+{
+	return fctx->event_fd;
+}
+
+static struct fr2_job *fr2_submit(struct fr2_context *fctx,
+				  enum fr2_job_type type, const void *buf,
+				  off_t where, size_t len, fr2_callback cb,
+				  void *data)
+{
+	struct fr2_job *job;
+	size_t size = fr2_chip_size(fctx);
+
+	if (!size || where + len > size) {
+		pr_err("Job 0x%06llx..0x%06llx outside of the chip\n",
+		       (unsigned long long)where,
+		       (unsigned long long)(where + len));
+		return NULL;
+	}
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return NULL;
+	job->type = type;
+	job->buf = (unsigned char *)buf;
+	job->where = where;
+	job->len = len;
+	job->cb = cb;
+	job->data = data;
+	job->ctx = fctx;
+	pthread_cond_init(&job->cond, NULL);
+
+	pthread_mutex_lock(&fctx->lock);
+	list_add_tail(&job->list, &fctx->jobs);
+	pthread_cond_signal(&fctx->cond);
+	pthread_mutex_unlock(&fctx->lock);
+
+	return job;
+}
+
+struct fr2_job *fr2_submit_read(struct fr2_context *fctx, void *buf,
+				off_t where, size_t len, fr2_callback cb,
+				void *data)
+{
+	return fr2_submit(fctx, FR2_JOB_READ, buf, where, len, cb, data);
+}
+
+struct fr2_job *fr2_submit_write(struct fr2_context *fctx, const void *buf,
+				 off_t where, size_t len, fr2_callback cb,
+				 void *data)
+{
+	return fr2_submit(fctx, FR2_JOB_WRITE, buf, where, len, cb, data);
+}
+
+struct fr2_job *fr2_submit_verify(struct fr2_context *fctx, const void *buf,
+				  off_t where, size_t len, fr2_callback cb,
+				  void *data)
+{
+	return fr2_submit(fctx, FR2_JOB_VERIFY, buf, where, len, cb, data);
+}
+
+int fr2_job_status(struct fr2_job *job)
+{
+	int ret;
+
+	pthread_mutex_lock(&job->ctx->lock);
+	ret = job->done ? job->status : -EINPROGRESS;
+	pthread_mutex_unlock(&job->ctx->lock);
+	return ret;
+}
+
+int fr2_job_wait(struct fr2_job *job)
+{
+	int ret;
+
+	pthread_mutex_lock(&job->ctx->lock);
+	while (!job->done)
+		pthread_cond_wait(&job->cond, &job->ctx->lock);
+	ret = job->status;
+	pthread_mutex_unlock(&job->ctx->lock);
+	return ret;
+}
+
+void fr2_job_free(struct fr2_job *job)
+{
+	if (!job)
+		return;
+	fr2_job_wait(job);
+	pthread_cond_destroy(&job->cond);
+	free(job);
+}
+
+void fr2_close(struct fr2_context *fctx)
+{
+	pthread_mutex_lock(&fctx->lock);
+	fctx->stop = 1;
+	pthread_cond_signal(&fctx->cond);
+	pthread_mutex_unlock(&fctx->lock);
+	pthread_join(fctx->worker, NULL);
+
+	programmer_shutdown(&fctx->ctx);
+	buffer_pool_release(&fctx->ctx.buffers);
+	free(fctx->ctx.programmer_args);
+	close(fctx->event_fd);
+	pthread_mutex_destroy(&fctx->lock);
+	pthread_mutex_destroy(&fctx->run_lock);
+	pthread_cond_destroy(&fctx->cond);
+	free(fctx);
+}
@@ -0,0 +1,297 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "manifest"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <debug.h>
+#include <diff.h>
+#include <hash.h>
+#include <image.h>
+#include <manifest.h>
+
+#define MANIFEST_MAGIC "FR2MANI"
+#define MANIFEST_VERSION 3
+
+/*
+ * On disk layout : a header, then the CRC32C of each block, then its flags.
+ * The header identifies the image file the manifest was made from, which an
+ * older modification time alone wouldn't, as a copy keeping the times of
+ * another image would look older than its manifest.
+ */
+struct manifest_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint64_t image_len;
+	uint32_t nb_blocks;
+	uint64_t file_dev;
+	uint64_t file_ino;
+	uint64_t file_size;
+	int64_t file_mtime_sec;
+	int64_t file_mtime_nsec;
+} __attribute__((packed));
+
+static void manifest_header_file(struct manifest_header *hdr,
+				 const struct stat *st)
+{
+	hdr->file_dev = st->st_dev;
+	hdr->file_ino = st->st_ino;
+	hdr->file_size = st->st_size;
+	hdr->file_mtime_sec = st->st_mtim.tv_sec;
+	hdr->file_mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+int manifest_init(struct manifest *m, uint64_t image_len, uint32_t block_size)
+{
+	memset(m, 0, sizeof(*m));
+	if (!block_size)
+		return -EINVAL;
+	m->image_len = image_len;
+	m->block_size = block_size;
+	m->nb_blocks = (image_len + block_size - 1) / block_size;
+	m->crc = calloc(m->nb_blocks ? : 1, sizeof(*m->crc));
+	m->flags = calloc(m->nb_blocks ? : 1, sizeof(*m->flags));
+	if (!m->crc || !m->flags) {
+		manifest_release(m);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void manifest_release(struct manifest *m)
+{
+	free(m->crc);
+	free(m->flags);
+	m->crc = NULL;
+	m->flags = NULL;
+}
+
+void manifest_hash(struct manifest *m, const uint8_t *buf, uint64_t offset,
+		   size_t len)
+{
+	uint64_t pos;
+	uint32_t i;
+	size_t blen;
+
+	for (pos = 0; pos < len; pos += blen) {
+		blen = m->block_size;
+		if (blen > len - pos)
+			blen = len - pos;
+		i = (offset + pos) / m->block_size;
+		m->crc[i] = crc32c(0, buf + pos, blen);
+		m->flags[i] = diff_is_blank(buf + pos, blen) ? MANIFEST_BLANK : 0;
+	}
+}
+
+struct manifest_job {
+	const char *image;
+	struct manifest *m;
+	uint64_t start, end;
+	int ret;
+};
+
+#define MANIFEST_CHUNK_SIZE (1024 * 1024)
+
+static void *manifest_build_range(void *arg)
+{
+	struct manifest_job *job = arg;
+	struct manifest *m = job->m;
+	uint64_t pos;
+	size_t n, chunk;
+	struct image *img;
+	uint8_t *buf;
+
+	chunk = m->block_size * (MANIFEST_CHUNK_SIZE / m->block_size ? : 1);
+	buf = malloc(chunk);
+	img = image_open(job->image);
+	job->ret = (!buf || !img) ? -EIO : 0;
+	for (pos = job->start; !job->ret && pos < job->end; pos += n) {
+		n = job->end - pos < chunk ? job->end - pos : chunk;
+		job->ret = image_read(img, buf, pos, n);
+		if (!job->ret)
+			manifest_hash(m, buf, pos, n);
+	}
+	if (img)
+		image_close(img);
+	free(buf);
+	return NULL;
+}
+
+int manifest_build(const char *image, uint32_t block_size,
+		   struct manifest *m)
+{
+	struct manifest_job *jobs;
+	struct image *img;
+	pthread_t *threads;
+	ssize_t len;
+	uint32_t per_job;
+	long nb_jobs, i, started;
+	int ret, compressed;
+
+	img = image_open(image);
+	if (!img)
+		return -ENOENT;
+	len = image_length(img);
+	compressed = image_compressed(img);
+	image_close(img);
+	ret = manifest_init(m, len, block_size);
+	if (ret)
+		return ret;
+
+	/* A compressed image can only be decompressed from its start */
+	nb_jobs = compressed ? 1 : sysconf(_SC_NPROCESSORS_ONLN);
+	if (nb_jobs < 1)
+		nb_jobs = 1;
+	if (nb_jobs > m->nb_blocks)
+		nb_jobs = m->nb_blocks ? : 1;
+	per_job = (m->nb_blocks + nb_jobs - 1) / nb_jobs;
+	jobs = calloc(nb_jobs, sizeof(*jobs));
+	threads = calloc(nb_jobs, sizeof(*threads));
+	if (!jobs || !threads) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	pr_dbg("Hashing %s with %ld threads\n", image, nb_jobs);
+	for (started = 0; started < nb_jobs; started++) {
+		jobs[started].image = image;
+		jobs[started].m = m;
+		jobs[started].start = (uint64_t)started * per_job * block_size;
+		jobs[started].end = (uint64_t)(started + 1) * per_job * block_size;
+		if (jobs[started].end > m->image_len)
+			jobs[started].end = m->image_len;
+		if (pthread_create(&threads[started], NULL,
+				   manifest_build_range, &jobs[started]))
+			break;
+	}
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+		if (jobs[i].ret)
+			ret = jobs[i].ret;
+	}
+	if (started < nb_jobs)
+		ret = -EAGAIN;
+
+out:
+	free(threads);
+	free(jobs);
+	if (ret)
+		manifest_release(m);
+	return ret;
+}
+
+static void manifest_path(char *path, size_t size, const char *image)
+{
+	snprintf(path, size, "%s%s", image, MANIFEST_SUFFIX);
+}
+
+int manifest_load_for_image(const char *image, struct manifest *m)
+{
+	struct manifest_header hdr, file;
+	struct stat image_st;
+	char path[PATH_MAX];
+	size_t crc_len;
+	int fd, ret = -EINVAL;
+
+	manifest_path(path, sizeof(path), image);
+	if (stat(image, &image_st))
+		return -ENOENT;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    memcmp(hdr.magic, MANIFEST_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != MANIFEST_VERSION)
+		goto out;
+	manifest_header_file(&file, &image_st);
+	if (hdr.file_dev != file.file_dev || hdr.file_ino != file.file_ino ||
+	    hdr.file_size != file.file_size ||
+	    hdr.file_mtime_sec != file.file_mtime_sec ||
+	    hdr.file_mtime_nsec != file.file_mtime_nsec) {
+		pr_info("Ignoring %s, made from another file than the image\n",
+			path);
+		ret = -ESTALE;
+		goto out;
+	}
+	if (hdr.image_len != image_size(image))
+		goto out;
+	ret = manifest_init(m, hdr.image_len, hdr.block_size);
+	if (ret)
+		goto out;
+	ret = -EINVAL;
+	crc_len = m->nb_blocks * sizeof(*m->crc);
+	if (hdr.nb_blocks != m->nb_blocks ||
+	    read(fd, m->crc, crc_len) != crc_len ||
+	    read(fd, m->flags, m->nb_blocks) != m->nb_blocks) {
+		manifest_release(m);
+		goto out;
+	}
+	ret = 0;
+	pr_dbg("Loaded %s: %u blocks of %u bytes\n", path, m->nb_blocks,
+	       m->block_size);
+out:
+	if (ret == -EINVAL)
+		pr_info("Ignoring invalid manifest %s\n", path);
+	close(fd);
+	return ret;
+}
+
+int manifest_save_for_image(const char *image, const struct manifest *m)
+{
+	struct manifest_header hdr;
+	struct stat image_st;
+	char path[PATH_MAX], tmp[PATH_MAX + 4];
+	size_t crc_len = m->nb_blocks * sizeof(*m->crc);
+	int fd, ret = 0;
+
+	if (stat(image, &image_st))
+		return -ENOENT;
+	memset(&hdr, 0, sizeof(hdr));
+	manifest_header_file(&hdr, &image_st);
+	memcpy(hdr.magic, MANIFEST_MAGIC, sizeof(hdr.magic));
+	hdr.version = MANIFEST_VERSION;
+	hdr.block_size = m->block_size;
+	hdr.image_len = m->image_len;
+	hdr.nb_blocks = m->nb_blocks;
+
+	manifest_path(path, sizeof(path), image);
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -errno;
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write(fd, m->crc, crc_len) != crc_len ||
+	    write(fd, m->flags, m->nb_blocks) != m->nb_blocks)
+		ret = -EIO;
+	if (close(fd) && !ret)
+		ret = -errno;
+	if (!ret && rename(tmp, path))
+		ret = -errno;
+	if (ret) {
+		pr_dbg("Couldn't store manifest %s: %d\n", path, ret);
+		unlink(tmp);
+	}
+	return ret;
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "metrics"
+
+#include <time.h>
+
+#include <debug.h>
+#include <metrics.h>
+
+uint64_t metrics_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void metric_account(struct metric *m, size_t bytes, uint64_t since)
+{
+	m->count++;
+	m->bytes += bytes;
+	m->usecs += metrics_now() - since;
+}
+
+void metric_print(const struct metric *m)
+{
+	uint64_t usecs = m->usecs ? m->usecs : 1;
+
+	pr_warn("%s: %lu calls, %llu bytes in %llu.%03llu s, %llu kB/s\n",
+		m->name, m->count, (unsigned long long)m->bytes,
+		(unsigned long long)(m->usecs / 1000000),
+		(unsigned long long)(m->usecs % 1000000 / 1000),
+		(unsigned long long)(m->bytes * 1000000 / 1024 / usecs));
+	if (m->transfers)
+		pr_warn("%s: %lu bus transfers, %llu bytes each on average\n",
+			m->name, m->transfers,
+			(unsigned long long)(m->bytes / m->transfers));
+}
+
+void cache_metric_print(const struct cache_metric *m)
+{
+	unsigned long lookups = m->hits + m->misses;
+
+	pr_info("%s: %lu hits, %lu misses, %lu%% hit rate, %llu kB served\n",
+		m->name, m->hits, m->misses,
+		lookups ? m->hits * 100 / lookups : 0,
+		(unsigned long long)(m->hit_bytes / 1024));
+}
@@ -20,28 +20,24 @@
 #include <stdlib.h>
 #include <string.h>
 
-/*
- * It is common knowledge that this function leaks memory. As it is called only
- * upon initialization a finite number of times, it's a known ... liberty.
- */
 char *extract_param(const char *input, const char *param_name,
 		    const char *separators)
 {
-	char *s = strdup(input);
+	char *s = strdup(input), *tok, *value = NULL;
 	int parlen = strlen(param_name);
 
-	strtok(s, separators);
-	do {
+	if (!s)
+		return NULL;
+	for (tok = strtok(s, separators); tok && !value;
+	     tok = strtok(NULL, separators)) {
 		if (parlen == 0)
-			return s;
-		if ((strlen(s) > parlen + 2) &&
-		    !strncmp(param_name, s, parlen) &&
-		    s[parlen] == '=') {
-			return &s[parlen + 1];
-		}
-		s = strtok(NULL, separators);
-	} while (s);
+			value = strdup(tok);
+		else if ((strlen(tok) > parlen + 1) &&
+			 !strncmp(param_name, tok, parlen) &&
+			 tok[parlen] == '=')
+			value = strdup(&tok[parlen + 1]);
+	}
 
 	free(s);
-	return NULL;
+	return value;
 }
@@ -0,0 +1,201 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "socket"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <debug.h>
+#include <socket.h>
+
+static int unix_address(struct sockaddr_un *addr, const char *path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		pr_err("Socket path %s is too long\n", path);
+		return -ENAMETOOLONG;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+int unix_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd, ret;
+
+	ret = unix_address(&addr, path);
+	if (ret)
+		return ret;
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -errno;
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd, 8)) {
+		ret = -errno;
+		pr_err("Cannot listen on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return ret;
+	}
+	return fd;
+}
+
+int unix_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd, ret;
+
+	ret = unix_address(&addr, path);
+	if (ret)
+		return ret;
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -errno;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		ret = -errno;
+		pr_err("Cannot connect to %s: %s\n", path, strerror(errno));
+		close(fd);
+		return ret;
+	}
+	return fd;
+}
+
+int tcp_connect(const char *host, const char *port)
+{
+	struct addrinfo hints, *res, *ai;
+	int fd = -1, ret, one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret) {
+		pr_err("Cannot resolve %s:%s: %s\n", host, port,
+		       gai_strerror(ret));
+		return -EHOSTUNREACH;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (!connect(fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		ret = -errno;
+		pr_err("Cannot connect to %s:%s: %s\n", host, port,
+		       strerror(errno));
+		return ret;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+int tcp_listen(const char *host, const char *port)
+{
+	struct addrinfo hints, *res, *ai;
+	int fd = -1, ret, one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	ret = getaddrinfo(host && *host ? host : NULL, port, &hints, &res);
+	if (ret) {
+		pr_err("Cannot resolve %s:%s: %s\n", host, port,
+		       gai_strerror(ret));
+		return -EADDRNOTAVAIL;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, 8))
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		ret = -errno;
+		pr_err("Cannot listen on %s:%s: %s\n", host, port,
+		       strerror(errno));
+		return ret;
+	}
+	return fd;
+}
+
+int socket_accept(int fd)
+{
+	int cfd, one = 1;
+
+	cfd = accept(fd, NULL, NULL);
+	if (cfd < 0)
+		return -errno;
+	/* Fails harmlessly on UNIX sockets */
+	setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return cfd;
+}
+
+int read_full(int fd, void *buf, size_t len)
+{
+	ssize_t ret;
+	char *p = buf;
+
+	while (len) {
+		ret = read(fd, p, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		if (ret == 0)
+			return -EPIPE;
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+int write_full(int fd, const void *buf, size_t len)
+{
+	ssize_t ret;
+	const char *p = buf;
+
+	while (len) {
+		ret = write(fd, p, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
@@ -30,12 +30,30 @@ static void help(const char *pname)
 {
 	pr_warn("Usage : %s <list of operations> --programmer=<programmer with options>\n", pname);
 	pr_warn("\t[--write-strategy=<strategy>] [--verbose] [--chip=<chipname>]\n");
-	pr_warn("\t operation = { --read=<filename>, --write=<filename>, --verify=<filename> }\n");
+	pr_warn("\t[--journal] [--resume] [--daemon=<socket>] [--client=<socket>]\n");
+	pr_warn("\t[--target=<target>[,<target>...]] [--serve=<socket or [host]:port>]\n");
+	pr_warn("\t[--cache-size=<kB>] [--verify-uncached] [--explain]\n");
+	pr_warn("\t operation = { --read=<filename>, --read-sparse=<filename>, --write=<filename>[@<offset>,...],\n\t\t\t --verify=<filename>, --benchmark, --make-manifest=<filename>,\n\t\t\t --apply-delta=<filename>, --make-delta=<base>,<update>[,<delta>] }\n");
 	pr_warn("\t\t Operations order is important, they are carried out in order\n");
 	pr_warn("Example1: write a file, verify it, and read back flash to another file\n");
 	pr_warn("\t%s --programmer=dediprog:voltage=1.8v --write-strategy=wipe_by_biggest_erases --write=/tmp/rom.bin --verify=/tmp/rom.bin --read=/tmp/rom_reread.bin\n", pname);
 	pr_warn("Example2: update a rom incrementaly, and then verify it\n");
 	pr_warn("\t%s --programmer=dummy --write-strategy=wipe_if_changes --write=/tmp/rom.bin --verify=/tmp/rom.bin\n", pname);
+	pr_warn("Example3: write a rom with a progress journal, and resume it if it was interrupted\n");
+	pr_warn("\t%s --programmer=dediprog --resume --write=/tmp/rom.bin\n", pname);
+	pr_warn("Example4: keep a programmer opened, and submit operations to it\n");
+	pr_warn("\t%s --programmer=dediprog:voltage=1.8v --daemon=/tmp/flashrom2.sock &\n", pname);
+	pr_warn("\t%s --client=/tmp/flashrom2.sock --write=/tmp/rom.bin --verify=/tmp/rom.bin\n", pname);
+	pr_warn("Example5: write the same image on both targets of a programmer\n");
+	pr_warn("\t%s --programmer=dediprog --target=1,2 --write=/tmp/rom.bin --verify=/tmp/rom.bin\n", pname);
+	pr_warn("Example6: lend a programmer to another host, and write a rom through it\n");
+	pr_warn("\t%s --programmer=dediprog --serve=0.0.0.0:4242 &\n", pname);
+	pr_warn("\t%s --programmer=remote:ip=flasher,port=4242 --write=/tmp/rom.bin\n", pname);
+	pr_warn("Example7: ship the changes between two roms, and update a chip holding the first one\n");
+	pr_warn("\t%s --make-delta=/tmp/rom.bin,/tmp/rom2.bin,/tmp/rom2.delta\n", pname);
+	pr_warn("\t%s --programmer=dediprog --apply-delta=/tmp/rom2.delta\n", pname);
+	pr_warn("Example8: write a bootloader and a kernel at their offsets, leaving the rest of the chip untouched\n");
+	pr_warn("\t%s --programmer=dediprog --write=/tmp/boot.bin@0,/tmp/kernel.bin@0x100000\n", pname);
 	pr_warn("\nAvailable chips :\n");
 	print_available_chips();
 	pr_warn("Available programmers :\n");
@@ -54,10 +72,30 @@ int main(int argc, char **argv)
 		{ "chip", required_argument, 0, 'c' },
 		{ "write-strategy", required_argument, 0, 's' },
 		{ "verbose", no_argument, 0, 'V' },
+		{ "journal", no_argument, 0, 'j' },
+		{ "resume", no_argument, 0, 'R' },
+		{ "daemon", required_argument, 0, 'D' },
+		{ "client", required_argument, 0, 'C' },
+		{ "benchmark", no_argument, 0, 'B' },
+		{ "make-manifest", required_argument, 0, 'M' },
+		{ "read-sparse", required_argument, 0, 'S' },
+		{ "target", required_argument, 0, 'T' },
+		{ "serve", required_argument, 0, 'N' },
+		{ "cache-size", required_argument, 0, 'K' },
+		{ "verify-uncached", no_argument, 0, 'U' },
+		{ "explain", no_argument, 0, 'X' },
+		{ "apply-delta", required_argument, 0, 'A' },
+		{ "make-delta", required_argument, 0, 'm' },
 		{NULL, 0, 0, 0 }
 	};
 	struct operation op, op_programmer, op_chip;
 	enum write_strategy write_strategy = WIPE_BY_BIGGEST_ERASES;
+	enum journal_mode journal_mode = JOURNAL_OFF;
+	char *daemon_socket = NULL, *client_socket = NULL, *targets = NULL;
+	char *serve_address = NULL, *end;
+	unsigned int cache_kb = BLOCK_CACHE_DEFAULT_KB;
+	int programmer_given = 0, chip_needed = 0, verify_uncached = 0;
+	int explain = 0;
 	char c;
 
 	if (argc == 1) {
@@ -83,21 +121,31 @@ int main(int argc, char **argv)
 			break;
 		case 'r':
 			op.op = READ;
+			chip_needed = 1;
+			op.arg.filename = optarg;
+			operation_add_tail(&op);
+			break;
+		case 'S':
+			op.op = READ_SPARSE;
+			chip_needed = 1;
 			op.arg.filename = optarg;
 			operation_add_tail(&op);
 			break;
 		case 'w':
 			op.op = WRITE;
+			chip_needed = 1;
 			op.arg.filename = optarg;
 			operation_add_tail(&op);
 			break;
 		case 'v':
 			op.op = VERIFY;
+			chip_needed = 1;
 			op.arg.filename = optarg;
 			operation_add_tail(&op);
 			break;
 		case 'p':
 			op_programmer.arg.programmer = optarg;
+			programmer_given = 1;
 			break;
 		case 'c':
 			op_chip.arg.chipname = optarg;
@@ -105,6 +153,60 @@ int main(int argc, char **argv)
 		case 's':
 			write_strategy = parse_write_strategy(optarg);
 			break;
+		case 'j':
+			if (journal_mode == JOURNAL_OFF)
+				journal_mode = JOURNAL_ON;
+			break;
+		case 'R':
+			journal_mode = JOURNAL_RESUME;
+			break;
+		case 'B':
+			op.op = BENCHMARK;
+			chip_needed = 1;
+			operation_add_tail(&op);
+			break;
+		case 'M':
+			op.op = MAKE_MANIFEST;
+			op.arg.filename = optarg;
+			operation_add_tail(&op);
+			break;
+		case 'A':
+			op.op = APPLY_DELTA;
+			chip_needed = 1;
+			op.arg.filename = optarg;
+			operation_add_tail(&op);
+			break;
+		case 'm':
+			op.op = MAKE_DELTA;
+			op.arg.filename = optarg;
+			operation_add_tail(&op);
+			break;
+		case 'T':
+			targets = optarg;
+			break;
+		case 'D':
+			daemon_socket = optarg;
+			break;
+		case 'C':
+			client_socket = optarg;
+			break;
+		case 'N':
+			serve_address = optarg;
+			break;
+		case 'K':
+			cache_kb = strtoul(optarg, &end, 0);
+			if (*end || end == optarg) {
+				pr_warn("Error: invalid cache size %s, aborting !\n",
+					optarg);
+				exit(1);
+			}
+			break;
+		case 'U':
+			verify_uncached = 1;
+			break;
+		case 'X':
+			explain = 1;
+			break;
 		default:
 			help(argv[0]);
 		}
@@ -115,11 +217,41 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	/* The targets of a daemon or a server are chosen by their clients. */
+	if (targets && (daemon_socket || serve_address)) {
+		pr_warn("Error: --target can't be used with --daemon or --serve, aborting !\n");
+		exit(1);
+	}
+	/* Each target gets its own chip probe, and all the operations. */
+	if (targets && operations_for_targets(targets, &op_chip))
+		exit(1);
+
+	op.op = SET_JOURNAL;
+	op.arg.journal_mode = journal_mode;
+	operation_add(&op);
+	op.op = SET_BLOCK_CACHE;
+	op.arg.block_cache.max_kb = cache_kb;
+	op.arg.block_cache.verify_uncached = verify_uncached;
+	operation_add(&op);
 	op.op = SET_WRITE_STRATEGY;
 	op.arg.write_strategy = write_strategy;
 	operation_add(&op);
-	operation_add(&op_chip);
-	operation_add(&op_programmer);
+	/* The chip is probed by each client request, not by the daemon. */
+	if (!daemon_socket && !serve_address && chip_needed && !targets)
+		operation_add(&op_chip);
+	/* A client keeps the programmer of the daemon, unless told otherwise. */
+	if ((!client_socket && (chip_needed || daemon_socket ||
+				serve_address)) ||
+	    programmer_given)
+		operation_add(&op_programmer);
 
+	if (explain)
+		return operations_explain();
+	if (serve_address)
+		return operations_serve_remote(serve_address);
+	if (daemon_socket)
+		return operations_serve(daemon_socket);
+	if (client_socket)
+		return operations_submit(client_socket);
 	return operations_launch();
 }
@@ -0,0 +1,86 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "benchmark"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <buffer_pool.h>
+#include <bus_spi.h>
+#include <chip.h>
+#include <debug.h>
+#include <metrics.h>
+#include <programmer.h>
+
+static int benchmark_read(struct context *ctx, unsigned char *buf,
+			  size_t size, size_t chunk)
+{
+	struct metric m;
+	char name[64];
+	uint64_t since;
+	off_t pos;
+	size_t n;
+	int ret, planned;
+
+	/* The programmers with their own read path don't follow the plan */
+	planned = ctx->chip->bustype == BUS_SPI &&
+		ctx->mst->spi.read == default_spi_read;
+
+	snprintf(name, sizeof(name), "read by %zu kB", chunk / 1024);
+	m = (struct metric) { .name = name };
+	for (pos = 0; pos < size; pos += n) {
+		n = size - pos < chunk ? size - pos : chunk;
+		since = metrics_now();
+		ret = chip_read_uncached(ctx, buf + pos, pos, n);
+		if (ret < 0)
+			return ret;
+		metric_account(&m, n, since);
+		if (planned)
+			m.transfers += spi_plan_transfers(ctx,
+							  SPI_TRANSFER_READ,
+							  pos, n, NULL, 0);
+	}
+	metric_print(&m);
+	return 0;
+}
+
+/*
+ * The whole chip is read with several request sizes, to show both the raw
+ * throughput of the programmer and its cost per request. The block cache is
+ * bypassed, and the chip content left untouched.
+ */
+int op_benchmark_chip(struct context *ctx)
+{
+	size_t size = ctx->chip->total_size_kb * 1024;
+	unsigned char *buf;
+	int ret;
+
+	buf = buffer_get(&ctx->buffers, size);
+	if (!buf)
+		return -ENOMEM;
+
+	pr_info("Benchmarking reads of zone 0x%06x..0x%06zx\n", 0, size);
+	ret = benchmark_read(ctx, buf, size, size);
+	if (!ret && size >= 64 * 1024)
+		ret = benchmark_read(ctx, buf, size, 64 * 1024);
+	if (!ret && size >= 4 * 1024)
+		ret = benchmark_read(ctx, buf, size, 4 * 1024);
+
+	buffer_put(&ctx->buffers, buf);
+	return ret;
+}
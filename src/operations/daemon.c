@@ -0,0 +1,350 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "daemon"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <buffer_pool.h>
+#include <chip.h>
+#include <daemon.h>
+#include <debug.h>
+#include <image.h>
+#include <operation.h>
+#include <operations.h>
+#include <programmer.h>
+#include <socket.h>
+
+static volatile sig_atomic_t daemon_stop;
+
+static int op_has_string_arg(enum operation_type type)
+{
+	switch (type) {
+	case READ:
+	case READ_SPARSE:
+	case WRITE:
+	case VERIFY:
+	case MAKE_MANIFEST:
+	case APPLY_DELTA:
+	case MAKE_DELTA:
+	case SET_CHIP:
+	case SET_PROGRAMMER:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int op_has_file_arg(enum operation_type type)
+{
+	return type == READ || type == READ_SPARSE || type == WRITE ||
+		type == VERIFY || type == MAKE_MANIFEST || type == APPLY_DELTA;
+}
+
+static int send_msg(int fd, enum daemon_msg_type type, const void *payload,
+		    size_t len)
+{
+	struct daemon_msg msg = { .type = type, .len = len };
+	int ret;
+
+	ret = write_full(fd, &msg, sizeof(msg));
+	if (!ret)
+		ret = write_full(fd, payload, len);
+	return ret;
+}
+
+static void daemon_print_hook(void *data, const char *msg)
+{
+	send_msg(*(int *)data, DAEMON_MSG_LOG, msg, strlen(msg));
+}
+
+static void free_ops(struct list_head *ops)
+{
+	struct operation *op, *tmp;
+
+	list_for_each_entry_safe(op, tmp, ops, list) {
+		list_del(&op->list);
+		if (op_has_string_arg(op->op))
+			free(op->arg.filename);
+		free(op);
+	}
+}
+
+static int decode_request(int fd, struct list_head *ops)
+{
+	struct daemon_request req;
+	struct daemon_op dop;
+	struct operation *op;
+	uint32_t value;
+	char *s;
+	int i, ret;
+
+	ret = read_full(fd, &req, sizeof(req));
+	if (ret)
+		return ret;
+	if (req.magic != DAEMON_MAGIC || req.nb_ops > DAEMON_MAX_OPS)
+		return -EPROTO;
+
+	for (i = 0; i < req.nb_ops; i++) {
+		ret = read_full(fd, &dop, sizeof(dop));
+		if (ret)
+			return ret;
+		if (dop.op >= LAST_OPERATION_TYPE)
+			return -EPROTO;
+		op = calloc(1, sizeof(*op));
+		if (!op)
+			return -ENOMEM;
+		op->op = dop.op;
+		list_add_tail(&op->list, ops);
+
+		if (op_has_string_arg(op->op)) {
+			s = malloc(dop.arglen + 1);
+			if (!s)
+				return -ENOMEM;
+			ret = read_full(fd, s, dop.arglen);
+			s[dop.arglen] = '\0';
+			op->arg.filename = s;
+		} else if (op->op == SET_BLOCK_CACHE &&
+			   dop.arglen == 2 * sizeof(value)) {
+			ret = read_full(fd, &value, sizeof(value));
+			op->arg.block_cache.max_kb = value;
+			if (!ret)
+				ret = read_full(fd, &value, sizeof(value));
+			op->arg.block_cache.verify_uncached = value;
+		} else if (dop.arglen == sizeof(value)) {
+			ret = read_full(fd, &value, sizeof(value));
+			if (op->op == SET_WRITE_STRATEGY)
+				op->arg.write_strategy = value;
+			else if (op->op == SET_TARGET)
+				op->arg.target = value;
+			else
+				op->arg.journal_mode = value;
+		} else {
+			ret = -EPROTO;
+		}
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static void daemon_handle(struct context *ctx, int fd)
+{
+	LIST_HEAD(ops);
+	int32_t status;
+	int ret;
+
+	ret = decode_request(fd, &ops);
+	if (ret) {
+		pr_err("Invalid request received: %d\n", ret);
+		free_ops(&ops);
+		return;
+	}
+
+	print_set_hook(daemon_print_hook, &fd);
+	status = operations_run(ctx, &ops);
+	block_cache_report(ctx);
+	print_set_hook(NULL, NULL);
+	pr_dbg("Request done: %d\n", status);
+
+	send_msg(fd, DAEMON_MSG_STATUS, &status, sizeof(status));
+	free_ops(&ops);
+}
+
+static void daemon_signal(int sig)
+{
+	daemon_stop = 1;
+}
+
+int daemon_serve(const char *socket_path, struct list_head *ops)
+{
+	struct sigaction sa;
+	struct context ctx;
+	int fd, cfd, ret;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ret = operations_run(&ctx, ops);
+	if (ret)
+		return ret;
+
+	fd = unix_listen(socket_path);
+	if (fd < 0)
+		return fd;
+
+	signal(SIGPIPE, SIG_IGN);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = daemon_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	pr_info("Waiting for operations on %s\n", socket_path);
+	while (!daemon_stop) {
+		cfd = accept(fd, NULL, NULL);
+		if (cfd < 0)
+			continue;
+		daemon_handle(&ctx, cfd);
+		close(cfd);
+	}
+
+	pr_info("Stopping daemon\n");
+	close(fd);
+	unlink(socket_path);
+	programmer_shutdown(&ctx);
+	image_cache_release(&ctx.images);
+	buffer_pool_release(&ctx.buffers);
+	block_cache_release(&ctx);
+	return 0;
+}
+
+/*
+ * The daemon doesn't share the client working directory, send it absolute
+ * file names.
+ */
+static char *absolute_path(const char *filename, char *path, size_t size)
+{
+	char cwd[PATH_MAX];
+
+	if (filename[0] == '/' || !getcwd(cwd, sizeof(cwd)))
+		return (char *)filename;
+	snprintf(path, size, "%s/%s", cwd, filename);
+	return path;
+}
+
+/* The files of a comma separated list, such as the make delta ones */
+static char *absolute_paths(const char *files, char *paths, size_t size)
+{
+	char path[PATH_MAX * 2], *file, *list, *next;
+	size_t len = 0;
+
+	list = strdup(files);
+	if (!list)
+		return (char *)files;
+	paths[0] = '\0';
+	for (file = list; file && len < size; file = next) {
+		next = strchr(file, ',');
+		if (next)
+			*next++ = '\0';
+		len += snprintf(paths + len, size - len, "%s%s",
+				len ? "," : "", absolute_path(file, path,
+							      sizeof(path)));
+	}
+	free(list);
+	return paths;
+}
+
+static int encode_request(int fd, struct list_head *ops)
+{
+	struct daemon_request req = { .magic = DAEMON_MAGIC, .nb_ops = 0 };
+	struct daemon_op dop;
+	struct operation *op;
+	char path[PATH_MAX * 4];
+	const char *s;
+	uint32_t value;
+	int ret;
+
+	list_for_each_entry(op, ops, list)
+		req.nb_ops++;
+	ret = write_full(fd, &req, sizeof(req));
+
+	list_for_each_entry(op, ops, list) {
+		if (ret)
+			break;
+		dop.op = op->op;
+		if (op_has_string_arg(op->op)) {
+			s = op->arg.filename;
+			if (op->op == WRITE && write_parts_composite(s))
+				s = absolute_paths(s, path, sizeof(path));
+			else if (op_has_file_arg(op->op))
+				s = absolute_path(s, path, sizeof(path));
+			else if (op->op == MAKE_DELTA)
+				s = absolute_paths(s, path, sizeof(path));
+			dop.arglen = strlen(s);
+			ret = write_full(fd, &dop, sizeof(dop));
+			if (!ret)
+				ret = write_full(fd, s, dop.arglen);
+		} else if (op->op == SET_BLOCK_CACHE) {
+			dop.arglen = 2 * sizeof(value);
+			ret = write_full(fd, &dop, sizeof(dop));
+			value = op->arg.block_cache.max_kb;
+			if (!ret)
+				ret = write_full(fd, &value, sizeof(value));
+			value = op->arg.block_cache.verify_uncached;
+			if (!ret)
+				ret = write_full(fd, &value, sizeof(value));
+		} else {
+			if (op->op == SET_WRITE_STRATEGY)
+				value = op->arg.write_strategy;
+			else if (op->op == SET_TARGET)
+				value = op->arg.target;
+			else
+				value = op->arg.journal_mode;
+			dop.arglen = sizeof(value);
+			ret = write_full(fd, &dop, sizeof(dop));
+			if (!ret)
+				ret = write_full(fd, &value, sizeof(value));
+		}
+	}
+	return ret;
+}
+
+int daemon_submit(const char *socket_path, struct list_head *ops)
+{
+	struct daemon_msg msg;
+	int32_t status = -EPROTO;
+	char *payload;
+	int fd, ret;
+
+	fd = unix_connect(socket_path);
+	if (fd < 0)
+		return fd;
+
+	ret = encode_request(fd, ops);
+	while (!ret) {
+		ret = read_full(fd, &msg, sizeof(msg));
+		if (ret)
+			break;
+		payload = malloc(msg.len + 1);
+		if (!payload) {
+			ret = -ENOMEM;
+			break;
+		}
+		ret = read_full(fd, payload, msg.len);
+		payload[msg.len] = '\0';
+		if (!ret && msg.type == DAEMON_MSG_LOG)
+			fputs(payload, stdout);
+		if (!ret && msg.type == DAEMON_MSG_STATUS &&
+		    msg.len == sizeof(status)) {
+			memcpy(&status, payload, sizeof(status));
+			free(payload);
+			break;
+		}
+		free(payload);
+	}
+
+	close(fd);
+	if (ret) {
+		pr_err("Lost connection to daemon %s: %d\n", socket_path, ret);
+		return ret;
+	}
+	return status;
+}
@@ -0,0 +1,339 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "delta"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <buffer_pool.h>
+#include <chip.h>
+#include <debug.h>
+#include <delta.h>
+#include <hash.h>
+#include <manifest.h>
+#include <operations.h>
+#include <programmer.h>
+
+/* The chip state of each changed block, found before anything is written */
+enum delta_state {
+	DELTA_UNTOUCHED,
+	DELTA_PENDING,
+	DELTA_APPLIED,
+};
+
+#define DELTA_READ_SIZE (64 * 1024)
+
+/*
+ * Without enough non blank blocks sampled, such as for a mostly blank base
+ * image, all the unchanged blocks are read and checked against the base CRC.
+ */
+static int delta_check_unchanged(struct context *ctx, struct delta *d)
+{
+	uint32_t block_size = d->hdr.block_size, crc = 0, i, j = 0, n;
+	uint32_t nb_blocks = (d->hdr.image_len + block_size - 1) / block_size;
+	uint32_t per_read = DELTA_READ_SIZE / block_size ? : 1;
+	unsigned char *buf;
+	off_t start;
+	size_t len;
+	int ret = 0;
+
+	buf = buffer_get(&ctx->buffers, (size_t)per_read * block_size);
+	if (!buf)
+		return -ENOMEM;
+	pr_info("Checking the unchanged blocks of the chip against the delta\n");
+	for (i = 0; !ret && i < nb_blocks; i += n) {
+		while (j < d->hdr.nb_records && (d->records[j].index < i ||
+		       (d->records[j].flags & DELTA_CHECK)))
+			j++;
+		/* The run of unchanged blocks up to the next changed one */
+		n = j < d->hdr.nb_records ? d->records[j].index - i :
+			nb_blocks - i;
+		if (!n) {
+			n = 1;
+			continue;
+		}
+		n = n < per_read ? n : per_read;
+		start = (off_t)i * block_size;
+		len = (uint64_t)start + (uint64_t)n * block_size >
+			d->hdr.image_len ? d->hdr.image_len - start :
+			(size_t)n * block_size;
+		ret = chip_read(ctx, buf, start, len);
+		if (ret < (int)len) {
+			ret = ret < 0 ? ret : -EIO;
+			break;
+		}
+		ret = 0;
+		crc = crc32c(crc, buf, len);
+	}
+	buffer_put(&ctx->buffers, buf);
+	if (!ret && crc != d->hdr.base_crc) {
+		pr_err("The unchanged blocks don't hold the delta base\n");
+		ret = -EINVAL;
+	}
+	return ret;
+}
+
+/*
+ * Each changed block and each checked block is read from the chip, and its
+ * hash compared to the delta ones. A changed block may already hold its new
+ * content, if a previous apply was interrupted. The unchanged blocks are all
+ * checked if fewer than DELTA_MAX_CHECKS non blank ones were sampled.
+ */
+static int delta_check_chip(struct context *ctx, struct delta *d,
+			    enum delta_state *states, unsigned int *nb_pending)
+{
+	struct delta_record *r;
+	unsigned char *buf;
+	unsigned int nb_bad = 0, nb_checks = 0;
+	off_t start;
+	uint32_t i, len, crc;
+	int ret = 0;
+
+	buf = buffer_get(&ctx->buffers, d->hdr.block_size);
+	if (!buf)
+		return -ENOMEM;
+	*nb_pending = 0;
+	for (i = 0; i < d->hdr.nb_records; i++) {
+		r = &d->records[i];
+		start = (off_t)r->index * d->hdr.block_size;
+		len = delta_block_len(d, r->index);
+		ret = chip_read(ctx, buf, start, len);
+		if (ret < (int)len) {
+			ret = ret < 0 ? ret : -EIO;
+			break;
+		}
+		ret = 0;
+		if ((r->flags & (DELTA_CHECK | DELTA_BLANK)) == DELTA_CHECK)
+			nb_checks++;
+		crc = crc32c(0, buf, len);
+		if (crc == r->base_crc && !(r->flags & DELTA_CHECK)) {
+			states[i] = DELTA_PENDING;
+			(*nb_pending)++;
+		} else if (crc == r->new_crc) {
+			states[i] = r->flags & DELTA_CHECK ? DELTA_UNTOUCHED :
+				DELTA_APPLIED;
+		} else {
+			pr_err("Block 0x%06x..0x%06x doesn't hold the delta base\n",
+			       start, start + len);
+			nb_bad++;
+		}
+	}
+	buffer_put(&ctx->buffers, buf);
+	if (ret || nb_bad)
+		return ret ? ret : -EINVAL;
+	if (nb_checks < DELTA_MAX_CHECKS)
+		ret = delta_check_unchanged(ctx, d);
+	return ret;
+}
+
+/*
+ * The zone [zstart, zend[ covers whole erase blocks : its content is the chip
+ * one, with the pending blocks it covers replaced by their new content.
+ */
+static int delta_write_zone(struct context *ctx, struct delta *d,
+			    enum delta_state *states, uint32_t first,
+			    uint32_t last, off_t zstart, off_t zend)
+{
+	struct delta_record *r;
+	unsigned char *zone;
+	off_t start;
+	uint32_t i;
+	int ret;
+
+	zone = buffer_get(&ctx->buffers, zend - zstart);
+	if (!zone)
+		return -ENOMEM;
+	ret = chip_read(ctx, zone, zstart, zend - zstart);
+	if (ret < (int)(zend - zstart)) {
+		ret = ret < 0 ? ret : -EIO;
+		goto out;
+	}
+	for (i = first; i <= last; i++) {
+		r = &d->records[i];
+		if (states[i] != DELTA_PENDING)
+			continue;
+		start = (off_t)r->index * d->hdr.block_size;
+		if (d->data[i])
+			memcpy(zone + (start - zstart), d->data[i],
+			       delta_block_len(d, r->index));
+		else
+			memset(zone + (start - zstart), 0xff,
+			       delta_block_len(d, r->index));
+	}
+	pr_info("Writing zone 0x%06x..0x%06x\n", zstart, zend);
+	ret = chip_write_image(ctx, zone, zstart, zend - zstart);
+	if (ret > 0)
+		ret = 0;
+out:
+	buffer_put(&ctx->buffers, zone);
+	return ret;
+}
+
+/*
+ * The pending blocks are gathered into zones of whole erase blocks, the
+ * neighbouring ones being merged, and each zone is written.
+ */
+static int delta_write(struct context *ctx, struct delta *d,
+		       enum delta_state *states)
+{
+	size_t esize = chip_smallest_erase_block(ctx->chip);
+	off_t start, end, zstart = 0, zend = 0;
+	uint32_t i, first = 0;
+	int ret = 0, in_zone = 0;
+
+	if (!esize)
+		return -ENODEV;
+	for (i = 0; !ret && i <= d->hdr.nb_records; i++) {
+		if (i < d->hdr.nb_records && states[i] != DELTA_PENDING)
+			continue;
+		if (i < d->hdr.nb_records) {
+			start = (off_t)d->records[i].index * d->hdr.block_size;
+			end = start + delta_block_len(d, d->records[i].index);
+			start -= start % esize;
+			end += (esize - end % esize) % esize;
+			if (in_zone && start <= zend) {
+				zend = end > zend ? end : zend;
+				continue;
+			}
+		}
+		if (in_zone)
+			ret = delta_write_zone(ctx, d, states, first, i - 1,
+					       zstart, zend);
+		if (i < d->hdr.nb_records) {
+			first = i;
+			zstart = start;
+			zend = end;
+			in_zone = 1;
+		}
+	}
+	return ret;
+}
+
+static int delta_verify(struct context *ctx, struct delta *d,
+			enum delta_state *states)
+{
+	unsigned char *buf;
+	off_t start;
+	uint32_t i, len;
+	int ret = 0;
+
+	buf = buffer_get(&ctx->buffers, d->hdr.block_size);
+	if (!buf)
+		return -ENOMEM;
+	for (i = 0; !ret && i < d->hdr.nb_records; i++) {
+		if (states[i] != DELTA_PENDING)
+			continue;
+		start = (off_t)d->records[i].index * d->hdr.block_size;
+		len = delta_block_len(d, d->records[i].index);
+		ret = chip_read_back(ctx, buf, start, len);
+		if (ret < (int)len) {
+			ret = ret < 0 ? ret : -EIO;
+			break;
+		}
+		ret = 0;
+		if (crc32c(0, buf, len) != d->records[i].new_crc) {
+			pr_err("Verification of block 0x%06x..0x%06x failed\n",
+			       start, start + len);
+			ret = -EIO;
+		}
+	}
+	buffer_put(&ctx->buffers, buf);
+	return ret;
+}
+
+int op_apply_delta(struct context *ctx, char *filename)
+{
+	size_t chip_size = ctx->chip->total_size_kb * 1024;
+	enum delta_state *states = NULL;
+	unsigned int nb_pending;
+	struct delta d;
+	int ret;
+
+	ret = delta_load(filename, &d);
+	if (ret)
+		return ret;
+	if (d.hdr.image_len != chip_size) {
+		pr_err("Delta %s is for a %ju bytes chip, not a %zu bytes one\n",
+		       filename, (uintmax_t)d.hdr.image_len, chip_size);
+		ret = -EINVAL;
+		goto out;
+	}
+	ret = -ENOMEM;
+	states = calloc(d.hdr.nb_records ? : 1, sizeof(*states));
+	if (!states)
+		goto out;
+
+	pr_info("Checking %u blocks of the chip against delta %s\n",
+		d.hdr.nb_records, filename);
+	ret = delta_check_chip(ctx, &d, states, &nb_pending);
+	if (ret == -EINVAL)
+		pr_err("The chip doesn't hold the base image of delta %s\n",
+		       filename);
+	if (!ret && nb_pending)
+		ret = delta_write(ctx, &d, states);
+	if (!ret)
+		ret = delta_verify(ctx, &d, states);
+	if (!ret)
+		pr_warn("Delta %s applied: %u blocks written.\n", filename,
+			nb_pending);
+out:
+	free(states);
+	delta_release(&d);
+	return ret;
+}
+
+/* The argument is <base>,<update>[,<delta>], by default <update>.delta */
+int op_make_delta(struct context *ctx, char *files)
+{
+	char *base, *update, *delta, *name = NULL;
+	int ret = -EINVAL;
+
+	base = strdup(files);
+	if (!base)
+		return -ENOMEM;
+	update = strchr(base, ',');
+	if (!update) {
+		pr_err("Invalid delta files %s, expecting <base>,<update>\n",
+		       files);
+		goto out;
+	}
+	*update++ = '\0';
+	delta = strchr(update, ',');
+	if (delta) {
+		*delta++ = '\0';
+	} else {
+		ret = -ENOMEM;
+		name = malloc(strlen(update) + sizeof(".delta"));
+		if (!name)
+			goto out;
+		sprintf(name, "%s.delta", update);
+		delta = name;
+	}
+
+	ret = delta_make(base, update, delta, MANIFEST_BLOCK_SIZE);
+	if (ret >= 0) {
+		pr_warn("Delta %s: %d blocks changed from %s to %s.\n", delta,
+			ret, base, update);
+		ret = 0;
+	}
+out:
+	free(name);
+	free(base);
+	return ret;
+}
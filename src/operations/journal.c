@@ -0,0 +1,237 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "journal"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cache.h>
+#include <chip.h>
+#include <debug.h>
+#include <hash.h>
+#include <journal.h>
+
+#define JOURNAL_MAGIC "FR2JRNL"
+#define JOURNAL_VERSION 1
+
+/*
+ * On disk layout : a header, then the geometry of each erase block, then one
+ * state byte per erase block. Only the state bytes are rewritten during the
+ * write.
+ */
+struct journal_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t image_crc;
+	uint64_t image_len;
+	uint64_t start;
+	uint32_t manufacture_id;
+	uint32_t model_id;
+	uint32_t nb_blocks;
+} __attribute__((packed));
+
+struct journal_block {
+	uint32_t start;
+	uint32_t size;
+} __attribute__((packed));
+
+struct journal {
+	int fd;
+	char path[PATH_MAX];
+	off_t states_offset;
+	int nb_blocks;
+	uint8_t *states;
+};
+
+static int journal_fill(struct journal_header *hdr,
+			struct journal_block **blocks, struct context *ctx,
+			const unsigned char *image, size_t len, off_t start,
+			struct list_head *erases)
+{
+	struct block_eraser *eraser;
+	int i = 0;
+
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic));
+	hdr->version = JOURNAL_VERSION;
+	hdr->image_crc = crc32c(0, image, len);
+	hdr->image_len = len;
+	hdr->start = start;
+	hdr->manufacture_id = ctx->chip->manufacture_id;
+	hdr->model_id = ctx->chip->model_id;
+	list_for_each_entry(eraser, erases, list)
+		hdr->nb_blocks++;
+
+	*blocks = calloc(hdr->nb_blocks, sizeof(**blocks));
+	if (!*blocks)
+		return -ENOMEM;
+	list_for_each_entry(eraser, erases, list) {
+		(*blocks)[i].start = eraser->start;
+		(*blocks)[i].size = eraser->size;
+		i++;
+	}
+	return 0;
+}
+
+static int journal_load(struct journal *j, const struct journal_header *hdr,
+			const struct journal_block *blocks)
+{
+	struct journal_header disk_hdr;
+	struct journal_block *disk_blocks;
+	size_t geometry_len = hdr->nb_blocks * sizeof(*blocks);
+	int ret = -EINVAL;
+
+	if (pread(j->fd, &disk_hdr, sizeof(disk_hdr), 0) != sizeof(disk_hdr) ||
+	    memcmp(&disk_hdr, hdr, sizeof(disk_hdr)))
+		return -EINVAL;
+
+	disk_blocks = malloc(geometry_len);
+	if (!disk_blocks)
+		return -ENOMEM;
+	if (pread(j->fd, disk_blocks, geometry_len, sizeof(*hdr)) ==
+	    geometry_len && !memcmp(disk_blocks, blocks, geometry_len) &&
+	    pread(j->fd, j->states, j->nb_blocks, j->states_offset) ==
+	    j->nb_blocks)
+		ret = 0;
+	free(disk_blocks);
+	return ret;
+}
+
+static int journal_create(struct journal *j, const struct journal_header *hdr,
+			  const struct journal_block *blocks)
+{
+	size_t geometry_len = hdr->nb_blocks * sizeof(*blocks);
+
+	memset(j->states, JOURNAL_PENDING, j->nb_blocks);
+	if (ftruncate(j->fd, 0) ||
+	    pwrite(j->fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+	    pwrite(j->fd, blocks, geometry_len, sizeof(*hdr)) != geometry_len ||
+	    pwrite(j->fd, j->states, j->nb_blocks, j->states_offset) !=
+	    j->nb_blocks || fsync(j->fd))
+		return -errno;
+	return 0;
+}
+
+struct journal *journal_open(struct context *ctx, const unsigned char *image,
+			     size_t len, off_t start, struct list_head *erases,
+			     int resume)
+{
+	struct journal_header hdr;
+	struct journal_block *blocks = NULL;
+	struct journal *j;
+	char name[80];
+	int ret;
+
+	j = calloc(1, sizeof(*j));
+	if (!j)
+		return NULL;
+	j->fd = -1;
+	ret = journal_fill(&hdr, &blocks, ctx, image, len, start, erases);
+	if (ret)
+		goto err;
+	j->nb_blocks = hdr.nb_blocks;
+	j->states_offset = sizeof(hdr) + hdr.nb_blocks * sizeof(*blocks);
+	j->states = malloc(j->nb_blocks);
+	if (!j->states)
+		goto err;
+
+	snprintf(name, sizeof(name), "journal-%08x-%zx-%06x%06x-%jx",
+		 hdr.image_crc, len, ctx->chip->manufacture_id,
+		 ctx->chip->model_id, (intmax_t)start);
+	ret = cache_path(j->path, sizeof(j->path), name);
+	if (ret) {
+		pr_err("No cache directory available for the write journal\n");
+		goto err;
+	}
+
+	j->fd = open(j->path, O_RDWR | O_CREAT, 0644);
+	if (j->fd < 0) {
+		pr_err("Cannot open write journal %s\n", j->path);
+		goto err;
+	}
+
+	if (resume && !journal_load(j, &hdr, blocks)) {
+		pr_info("Resuming write from journal %s\n", j->path);
+	} else {
+		if (resume)
+			pr_warn("No matching journal found, starting over\n");
+		if (journal_create(j, &hdr, blocks)) {
+			pr_err("Cannot write journal %s\n", j->path);
+			goto err;
+		}
+	}
+	pr_dbg("Journal %s opened, %d blocks\n", j->path, j->nb_blocks);
+
+	free(blocks);
+	return j;
+err:
+	if (j->fd >= 0)
+		close(j->fd);
+	free(j->states);
+	free(blocks);
+	free(j);
+	return NULL;
+}
+
+enum journal_state journal_get_state(struct journal *j, int block)
+{
+	if (block < 0 || block >= j->nb_blocks)
+		return JOURNAL_PENDING;
+	return j->states[block];
+}
+
+int journal_set_state(struct journal *j, int block, enum journal_state state)
+{
+	uint8_t s = state;
+
+	if (block < 0 || block >= j->nb_blocks)
+		return -EINVAL;
+	j->states[block] = s;
+	if (pwrite(j->fd, &s, 1, j->states_offset + block) != 1 ||
+	    fdatasync(j->fd)) {
+		pr_err("Cannot update journal %s: %d\n", j->path, errno);
+		return -errno;
+	}
+	return 0;
+}
+
+int journal_first_incomplete(struct journal *j)
+{
+	int i;
+
+	for (i = 0; i < j->nb_blocks; i++)
+		if (j->states[i] != JOURNAL_VERIFIED)
+			break;
+	return i;
+}
+
+void journal_close(struct journal *j, int completed)
+{
+	if (!j)
+		return;
+	close(j->fd);
+	if (completed)
+		unlink(j->path);
+	free(j->states);
+	free(j);
+}
@@ -0,0 +1,46 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "make-manifest"
+
+#include <debug.h>
+#include <manifest.h>
+#include <operations.h>
+
+int op_make_manifest(struct context *ctx, char *filename)
+{
+	struct manifest m;
+	uint32_t i, nb_blank = 0;
+	int ret;
+
+	ret = manifest_build(filename, MANIFEST_BLOCK_SIZE, &m);
+	if (ret) {
+		pr_err("Couldn't hash %s: %d\n", filename, ret);
+		return ret;
+	}
+	for (i = 0; i < m.nb_blocks; i++)
+		if (manifest_block_blank(&m, i))
+			nb_blank++;
+
+	ret = manifest_save_for_image(filename, &m);
+	if (ret)
+		pr_err("Couldn't store the manifest of %s: %d\n", filename, ret);
+	else
+		pr_warn("Manifest of %s: %u blocks of %u bytes, %u blank.\n",
+			filename, m.nb_blocks, m.block_size, nb_blank);
+	manifest_release(&m);
+	return ret;
+}
@@ -14,14 +14,21 @@
  * GNU General Public License for more details.
  *
  */
+#include <errno.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <buffer_pool.h>
+#include <chip.h>
+#include <daemon.h>
 #include <debug.h>
+#include <image.h>
 #include <programmer.h>
 #include <operation.h>
 #include <operations.h>
+#include <remote.h>
 #include <write_strategy.h>
 
 static LIST_HEAD(operations);
@@ -47,12 +54,18 @@ static char *get_operation_desc(struct operation *op)
 	case READ:
 		sprintf(msg, "read chip into %s", op->arg.filename);
 		break;
+	case READ_SPARSE:
+		sprintf(msg, "read chip sparsely into %s", op->arg.filename);
+		break;
 	case WRITE:
 		sprintf(msg, "write chip from %s", op->arg.filename);
 		break;
 	case VERIFY:
 		sprintf(msg, "verify chip against %s", op->arg.filename);
 		break;
+	case SET_TARGET:
+		sprintf(msg, "select target %d", op->arg.target);
+		break;
 	case SET_WRITE_STRATEGY:
 		sprintf(msg, "set write strategy to %s",
 			get_write_strategy_name(op->arg.write_strategy));
@@ -63,6 +76,31 @@ static char *get_operation_desc(struct operation *op)
 	case SET_PROGRAMMER:
 		sprintf(msg, "set programmer to %s", op->arg.programmer);
 		break;
+	case SET_JOURNAL:
+		sprintf(msg, "%s write journal",
+			op->arg.journal_mode == JOURNAL_RESUME ? "resume from" :
+			op->arg.journal_mode == JOURNAL_ON ? "use a" :
+			"don't use a");
+		break;
+	case SET_BLOCK_CACHE:
+		sprintf(msg, "cache up to %u kB of the chip%s",
+			op->arg.block_cache.max_kb,
+			op->arg.block_cache.verify_uncached ?
+			", verifying from the chip" : "");
+		break;
+	case BENCHMARK:
+		sprintf(msg, "benchmark chip reads");
+		break;
+	case MAKE_MANIFEST:
+		sprintf(msg, "make manifest of %s", op->arg.filename);
+		break;
+	case APPLY_DELTA:
+		sprintf(msg, "apply delta %s", op->arg.filename);
+		break;
+	case MAKE_DELTA:
+		snprintf(msg, sizeof(msg), "make delta of %s",
+			 op->arg.filename);
+		break;
 	default:
 		sprintf(msg, "unknown action");
 	}
@@ -98,46 +136,343 @@ void operation_add(struct operation *op)
 	list_add(&new->list, &operations);
 }
 
-int operations_launch(void)
+static int operation_run(struct context *ctx, struct operation *op)
 {
+	switch(op->op) {
+	case READ:
+		if (programmer_chip_available(ctx))
+			return op_read_chip(ctx, op->arg.filename, 0, 0);
+		break;
+	case READ_SPARSE:
+		if (programmer_chip_available(ctx))
+			return op_read_chip_sparse(ctx, op->arg.filename, 0, 0);
+		break;
+	case WRITE:
+		if (programmer_chip_available(ctx))
+			return op_write_chip(ctx, op->arg.filename, 0, 0);
+		break;
+	case VERIFY:
+		if (programmer_chip_available(ctx))
+			return op_verify_chip(ctx, op->arg.filename, 0, 0);
+		break;
+	case BENCHMARK:
+		if (programmer_chip_available(ctx))
+			return op_benchmark_chip(ctx);
+		break;
+	case APPLY_DELTA:
+		if (programmer_chip_available(ctx))
+			return op_apply_delta(ctx, op->arg.filename);
+		break;
+	case MAKE_MANIFEST:
+		return op_make_manifest(ctx, op->arg.filename);
+	case MAKE_DELTA:
+		return op_make_delta(ctx, op->arg.filename);
+	case SET_PROGRAMMER:
+		return op_set_programmer(ctx, op->arg.programmer);
+	case SET_CHIP:
+		return op_set_chip(ctx, op->arg.chipname);
+	case SET_TARGET:
+		return op_set_target(ctx, op->arg.target);
+	case SET_WRITE_STRATEGY:
+		return op_set_write_strategy(ctx, op->arg.write_strategy);
+	case SET_JOURNAL:
+		return op_set_journal(ctx, op->arg.journal_mode);
+	case SET_BLOCK_CACHE:
+		return op_set_block_cache(ctx, op->arg.block_cache.max_kb,
+					  op->arg.block_cache.verify_uncached);
+	default:
+		break;
+	}
+	return 0;
+}
+
+/*
+ * A step of the plan carries out nb_ops consecutive operations of the list,
+ * either one by one, or fused :
+ *  - the reads and verifies following each other share one read of the chip
+ *  - a write followed by the verify of the same file verifies against the
+ *    written image, reading back only the blocks the write changed
+ */
+enum plan_step_type {
+	STEP_OPERATION,
+	STEP_SCAN,
+	STEP_WRITE_VERIFY,
+};
+
+struct plan_step {
+	enum plan_step_type type;
 	struct operation *op;
-	struct context ctx;
-	int num_op = 1, ret = 0;
-
-	list_for_each_entry(op, &operations, list) {
-		pr_dbg("Operation %d: %s\n", num_op, get_operation_desc(op));
-		switch(op->op) {
-		case READ:
-			if (programmer_chip_available(&ctx))
-				ret = op_read_chip(&ctx, op->arg.filename, 0, 0);
-			break;
-		case WRITE:
-			if (programmer_chip_available(&ctx))
-				ret = op_write_chip(&ctx, op->arg.filename, 0, 0);
-			break;
-		case VERIFY:
-			if (programmer_chip_available(&ctx))
-				ret = op_verify_chip(&ctx, op->arg.filename, 0, 0);
-			break;
-		case SET_PROGRAMMER:
-			ret = op_set_programmer(&ctx, op->arg.programmer);
+	int nb_ops;
+	struct list_head list;
+};
+
+static int op_scannable(struct operation *op)
+{
+	return op->op == READ || op->op == VERIFY;
+}
+
+static int operations_plan(struct list_head *ops, struct list_head *plan)
+{
+	struct operation *op, *next;
+	struct plan_step *step;
+
+	for (op = list_first_entry(ops, struct operation, list);
+	     &op->list != ops; op = next) {
+		step = calloc(1, sizeof(*step));
+		if (!step)
+			return -ENOMEM;
+		step->type = STEP_OPERATION;
+		step->op = op;
+		step->nb_ops = 1;
+		list_add_tail(&step->list, plan);
+
+		next = list_next_entry(op, list);
+		if (op->op == WRITE && &next->list != ops &&
+		    next->op == VERIFY &&
+		    !write_parts_composite(op->arg.filename) &&
+		    !strcmp(op->arg.filename, next->arg.filename)) {
+			step->type = STEP_WRITE_VERIFY;
+			step->nb_ops = 2;
+			next = list_next_entry(next, list);
+			continue;
+		}
+		if (!op_scannable(op))
+			continue;
+		for (; &next->list != ops && op_scannable(next);
+		     next = list_next_entry(next, list))
+			step->nb_ops++;
+		if (step->nb_ops > 1)
+			step->type = STEP_SCAN;
+	}
+	return 0;
+}
+
+static void operations_plan_release(struct list_head *plan)
+{
+	struct plan_step *step, *tmp;
+
+	list_for_each_entry_safe(step, tmp, plan, list) {
+		list_del(&step->list);
+		free(step);
+	}
+}
+
+static int plan_step_scan(struct context *ctx, struct plan_step *step)
+{
+	struct operation *op = step->op;
+	struct scan_part *parts;
+	int i, ret;
+
+	parts = calloc(step->nb_ops, sizeof(*parts));
+	if (!parts)
+		return -ENOMEM;
+	for (i = 0; i < step->nb_ops; i++) {
+		parts[i].filename = op->arg.filename;
+		parts[i].verify = op->op == VERIFY;
+		op = list_next_entry(op, list);
+	}
+	ret = op_scan_chip(ctx, parts, step->nb_ops);
+	free(parts);
+	return ret;
+}
+
+static int plan_step_run(struct context *ctx, struct plan_step *step)
+{
+	switch (step->type) {
+	case STEP_SCAN:
+		if (programmer_chip_available(ctx))
+			return plan_step_scan(ctx, step);
+		return 0;
+	case STEP_WRITE_VERIFY:
+		if (programmer_chip_available(ctx))
+			return op_write_verify_chip(ctx, step->op->arg.filename);
+		return 0;
+	default:
+		return operation_run(ctx, step->op);
+	}
+}
+
+/*
+ * The files of the writes are loaded and hashed while the programmer and the
+ * chips are probed.
+ */
+static struct image_preload *
+operations_preload(struct list_head *ops, struct image_preload_file **files)
+{
+	struct image_preload_file *f;
+	struct operation *op;
+	int nb = 0, i;
+
+	*files = NULL;
+	list_for_each_entry(op, ops, list)
+		nb++;
+	f = calloc(nb, sizeof(*f));
+	if (!f)
+		return NULL;
+	nb = 0;
+	list_for_each_entry(op, ops, list) {
+		if (op->op != WRITE || write_parts_composite(op->arg.filename))
+			continue;
+		for (i = 0; i < nb; i++)
+			if (!strcmp(f[i].filename, op->arg.filename))
+				break;
+		if (i < nb || nb == IMAGE_CACHE_MAX)
+			continue;
+		f[nb++].filename = op->arg.filename;
+	}
+	if (!nb) {
+		free(f);
+		return NULL;
+	}
+	*files = f;
+	return image_preload_start(f, nb);
+}
+
+static int plan_step_setup(struct plan_step *step)
+{
+	switch (step->op->op) {
+	case SET_PROGRAMMER:
+	case SET_CHIP:
+	case SET_TARGET:
+	case SET_WRITE_STRATEGY:
+	case SET_JOURNAL:
+	case SET_BLOCK_CACHE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+int operations_run(struct context *ctx, struct list_head *ops)
+{
+	struct image_preload_file *files;
+	struct image_preload *preload;
+	struct plan_step *step;
+	struct operation *op;
+	LIST_HEAD(plan);
+	int num_op = 1, i, ret;
+
+	preload = operations_preload(ops, &files);
+	ret = operations_plan(ops, &plan);
+	list_for_each_entry(step, &plan, list) {
+		if (ret)
 			break;
-		case SET_CHIP:
-			ret = op_set_chip(&ctx, op->arg.chipname);
+		if (preload && !plan_step_setup(step)) {
+			image_preload_finish(preload, &ctx->images);
+			preload = NULL;
+		}
+		for (i = 0, op = step->op; i < step->nb_ops; i++) {
+			pr_dbg("Operation %d: %s\n", num_op++,
+			       get_operation_desc(op));
+			op = list_next_entry(op, list);
+		}
+		ret = plan_step_run(ctx, step);
+	}
+	if (preload)
+		image_preload_finish(preload, &ctx->images);
+	free(files);
+	operations_plan_release(&plan);
+
+	return ret;
+}
+
+int operations_explain(void)
+{
+	struct plan_step *step;
+	struct operation *op;
+	LIST_HEAD(plan);
+	int num_step = 1, i, ret;
+
+	ret = operations_plan(&operations, &plan);
+	if (ret)
+		goto out;
+	list_for_each_entry(step, &plan, list) {
+		op = step->op;
+		switch (step->type) {
+		case STEP_SCAN:
+			pr_warn("%d: one read of the chip for :\n", num_step);
+			for (i = 0; i < step->nb_ops; i++) {
+				pr_warn("\t%s\n", get_operation_desc(op));
+				op = list_next_entry(op, list);
+			}
 			break;
-		case SET_WRITE_STRATEGY:
-			ret = op_set_write_strategy(&ctx, op->arg.write_strategy);
+		case STEP_WRITE_VERIFY:
+			pr_warn("%d: %s, then verify the written blocks\n",
+				num_step, get_operation_desc(op));
 			break;
 		default:
-			ret = 0;
+			pr_warn("%d: %s\n", num_step, get_operation_desc(op));
 		}
-		if (ret)
-			return ret;
-		num_op++;
+		num_step++;
 	}
+out:
+	operations_plan_release(&plan);
+	return ret;
+}
 
-	if (programmer_chip_available(&ctx))
-		programmer_shutdown(&ctx);
+int operations_for_targets(const char *targets, struct operation *op_chip)
+{
+	struct operation *op, *tmp, set_target;
+	LIST_HEAD(ops);
+	const char *s;
+	char *end;
+	long target;
+	int ret = 0;
 
-	return 0;
+	if (!*targets) {
+		pr_err("Empty target list\n");
+		return -EINVAL;
+	}
+	list_splice_init(&operations, &ops);
+	for (s = targets; *s; s = end + (*end == ',')) {
+		target = strtol(s, &end, 10);
+		if (end == s || (*end && *end != ',')) {
+			pr_err("Invalid target list %s\n", targets);
+			ret = -EINVAL;
+			break;
+		}
+		set_target.op = SET_TARGET;
+		set_target.arg.target = target;
+		operation_add_tail(&set_target);
+		operation_add_tail(op_chip);
+		list_for_each_entry(op, &ops, list)
+			operation_add_tail(op);
+	}
+
+	list_for_each_entry_safe(op, tmp, &ops, list) {
+		list_del(&op->list);
+		free(op);
+	}
+	return ret;
+}
+
+int operations_launch(void)
+{
+	struct context ctx;
+	int ret;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ret = operations_run(&ctx, &operations);
+	block_cache_report(&ctx);
+	programmer_shutdown(&ctx);
+	image_cache_release(&ctx.images);
+	buffer_pool_release(&ctx.buffers);
+	block_cache_release(&ctx);
+
+	return ret;
+}
+
+int operations_serve(const char *socket_path)
+{
+	return daemon_serve(socket_path, &operations);
+}
+
+int operations_submit(const char *socket_path)
+{
+	return daemon_submit(socket_path, &operations);
+}
+
+int operations_serve_remote(const char *address)
+{
+	return remote_serve(address, &operations);
 }
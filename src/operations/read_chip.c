@@ -19,52 +19,169 @@
 #define DEBUG_MODULE "chip-read"
 
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <buffer_pool.h>
 #include <chip.h>
+#include <compress.h>
 #include <debug.h>
+#include <image.h>
+#include <operations.h>
 #include <programmer.h>
+#include <socket.h>
+
+static int read_store_raw(char *filename, const unsigned char *buf,
+			  size_t len)
+{
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(filename, "w");
+	if (!f) {
+		ret = -errno;
+		pr_err("Cannot open file %s to read chip into it\n",
+		       filename);
+		return ret;
+	}
+	if (fwrite(buf, len, 1, f) < 1)
+		ret = -errno;
+	if (fclose(f) && !ret)
+		ret = -errno;
+	return ret;
+}
+
+/*
+ * The compressor runs on all CPUs. A compressor which can't be run breaks the
+ * pipe, which mustn't kill us.
+ */
+static int read_store_compressed(char *filename, enum compression c,
+				 const unsigned char *buf, size_t len)
+{
+	void (*sigpipe)(int);
+	pid_t pid;
+	int fd, ret;
+
+	fd = compression_pipe(filename, c, 1, &pid);
+	if (fd < 0) {
+		pr_err("Cannot compress chip into %s\n", filename);
+		return fd;
+	}
+	sigpipe = signal(SIGPIPE, SIG_IGN);
+	ret = write_full(fd, buf, len);
+	close(fd);
+	signal(SIGPIPE, sigpipe);
+	if (compression_wait(pid) && !ret)
+		ret = -EIO;
+	return ret;
+}
+
+int chip_read_store(char *filename, const unsigned char *buf, size_t len)
+{
+	enum compression c = compression_from_suffix(filename);
+	int ret;
+
+	if (c != COMPRESSION_NONE)
+		ret = read_store_compressed(filename, c, buf, len);
+	else
+		ret = read_store_raw(filename, buf, len);
+	if (ret) {
+		pr_err("Couldn't write %zd bytes into %s\n",
+		       len, filename);
+		return ret;
+	}
+
+	pr_warn("Read operation succeeded.\n");
+	return 0;
+}
 
 int op_read_chip(struct context *ctx, char *filename,
 		 off_t where, size_t len)
 {
-	FILE *f;
 	unsigned char *buf;
-	int ret = 0;
+	int ret;
 
 	if (len == 0)
 		len = ctx->chip->total_size_kb * 1024;
-	buf = malloc(ctx->chip->total_size_kb * 1024);
+	buf = buffer_get(&ctx->buffers, len);
 	if (!buf)
 		return -ENOMEM;
-	memset(buf, 0xff, ctx->chip->total_size_kb * 1024);
 
-	f = fopen(filename, "w");
-	if (!f) {
+	pr_info("Reading zone 0x%06x..0x%06x\n", where, where + len);
+	ret = chip_read(ctx, buf, where, len);
+	if (ret >= 0)
+		ret = chip_read_store(filename, buf, len);
+	buffer_put(&ctx->buffers, buf);
+	return ret;
+}
+
+#define READ_CHUNK_SIZE (64 * 1024)
+
+/* The blank runs are detected with the granularity of the smallest erase. */
+static uint32_t smallest_erase_size(struct flashchip *chip)
+{
+	uint32_t size = chip->total_size_kb * 1024;
+	int i;
+
+	for (i = 0; i < NUM_ERASEFUNCTIONS; i++)
+		if (chip->erasers[i].size && chip->erasers[i].size < size)
+			size = chip->erasers[i].size;
+	return size;
+}
+
+/*
+ * The chip is read chunk by chunk into a sparse container, where its blank
+ * erase blocks take no room.
+ */
+int op_read_chip_sparse(struct context *ctx, char *filename,
+			off_t where, size_t len)
+{
+	struct image *img;
+	unsigned char *buf;
+	size_t pos, n;
+	int ret;
+
+	if (len == 0)
+		len = ctx->chip->total_size_kb * 1024;
+	buf = buffer_get(&ctx->buffers, READ_CHUNK_SIZE);
+	if (!buf)
+		return -ENOMEM;
+
+	img = image_create_sparse(filename, smallest_erase_size(ctx->chip));
+	if (!img) {
+		ret = -errno;
 		pr_err("Cannot open file %s to read chip into it\n",
 		       filename);
-		return errno;
+		goto err;
 	}
 
 	pr_info("Reading zone 0x%06x..0x%06x\n", where, where + len);
-	ret = chip_read(ctx, buf, where, len);
-	if (ret < 0)
-		goto err;
-	ret = fwrite(buf, len, 1, f);
-	if (ret < 1) {
-		pr_err("Couldn't write %zd bytes into %s\n",
-		       len, filename);
-		ret = -errno;
-		goto err;
+	for (pos = 0; pos < len; pos += n) {
+		n = len - pos < READ_CHUNK_SIZE ? len - pos : READ_CHUNK_SIZE;
+		ret = chip_read(ctx, buf, where + pos, n);
+		if (ret < (int)n) {
+			ret = ret < 0 ? ret : -EIO;
+			break;
+		}
+		ret = image_append(img, buf, n);
+		if (ret) {
+			pr_err("Couldn't write %zd bytes into %s\n",
+			       n, filename);
+			break;
+		}
 	}
+	if (!ret)
+		ret = image_finish(img);
+	else
+		image_finish(img);
+	if (ret)
+		goto err;
 
-	ret = 0;
 	pr_warn("Read operation succeeded.\n");
 err:
-	free(buf);
-	fclose(f);
+	buffer_put(&ctx->buffers, buf);
 	return ret;
 }
@@ -0,0 +1,334 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "remote-server"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <buffer_pool.h>
+#include <bus_spi.h>
+#include <chip.h>
+#include <debug.h>
+#include <image.h>
+#include <operation.h>
+#include <operations.h>
+#include <programmer.h>
+#include <remote.h>
+#include <socket.h>
+
+static volatile sig_atomic_t remote_stop;
+
+struct remote_request {
+	struct remote_msg msg;
+	unsigned char *payload;
+	/* The answer, filled by the request handler */
+	int32_t status;
+	unsigned char *result;
+	uint32_t result_len;
+};
+
+static int remote_hello(struct context *ctx, struct remote_request *req)
+{
+	struct remote_hello *hello = (void *)req->payload;
+	struct remote_info *info = (void *)req->result;
+
+	if (req->msg.len != sizeof(*hello) ||
+	    ntohl(hello->magic) != REMOTE_MAGIC ||
+	    ntohl(hello->version) != REMOTE_VERSION)
+		return -EPROTONOSUPPORT;
+
+	info->magic = htonl(REMOTE_MAGIC);
+	info->version = htonl(REMOTE_VERSION);
+	info->max_data_read = htonl(spi_max_data(ctx, SPI_TRANSFER_READ));
+	info->max_data_write = htonl(spi_max_data(ctx, SPI_TRANSFER_WRITE));
+	req->result_len = sizeof(*info);
+	return 0;
+}
+
+/*
+ * The commands of a request are sent to the programmer at once, as the
+ * client would have.
+ */
+static int remote_spi(struct context *ctx, struct remote_request *req)
+{
+	struct spi_command *cmds;
+	struct remote_spi_cmd rcmd;
+	unsigned char *p = req->payload, *end = p + req->msg.len;
+	unsigned int nb = 0, i, delays = 0;
+	uint32_t writecnt, readcnt;
+	uint64_t readlen = 0;
+	int ret;
+
+	/*
+	 * A command without any byte to write or read would end the commands
+	 * list early.
+	 */
+	while (p + sizeof(rcmd) <= end) {
+		memcpy(&rcmd, p, sizeof(rcmd));
+		p += sizeof(rcmd);
+		writecnt = ntohl(rcmd.writecnt);
+		readcnt = ntohl(rcmd.readcnt);
+		if (writecnt > (size_t)(end - p) || readcnt > REMOTE_MAX_LEN ||
+		    (!writecnt && !readcnt))
+			return -EPROTO;
+		p += writecnt;
+		readlen += readcnt;
+		nb++;
+	}
+	if (p != end || !nb || readlen > REMOTE_MAX_LEN)
+		return -EPROTO;
+
+	cmds = calloc(nb + 1, sizeof(*cmds));
+	if (!cmds)
+		return -ENOMEM;
+	p = req->payload;
+	for (i = 0; i < nb; i++) {
+		memcpy(&rcmd, p, sizeof(rcmd));
+		p += sizeof(rcmd);
+		cmds[i].writecnt = ntohl(rcmd.writecnt);
+		cmds[i].readcnt = ntohl(rcmd.readcnt);
+		cmds[i].delay_us = ntohl(rcmd.delay_us);
+		cmds[i].writearr = p;
+		cmds[i].readarr = req->result + req->result_len;
+		p += cmds[i].writecnt;
+		req->result_len += cmds[i].readcnt;
+		delays |= cmds[i].delay_us;
+	}
+
+	if (nb == 1 && !delays)
+		ret = ctx->mst->spi.command(ctx, cmds[0].writecnt,
+					    cmds[0].readcnt, cmds[0].writearr,
+					    cmds[0].readarr);
+	else
+		ret = ctx->mst->spi.multicommand(ctx, cmds);
+	free(cmds);
+	return ret;
+}
+
+static int remote_transfer(struct context *ctx, struct remote_request *req)
+{
+	struct remote_range range;
+	unsigned char *data = req->payload + sizeof(range);
+	off_t start;
+	size_t len;
+	int ret;
+
+	if (req->msg.len < sizeof(range))
+		return -EPROTO;
+	memcpy(&range, req->payload, sizeof(range));
+	start = ntohl(range.start);
+	len = ntohl(range.len);
+	if (len > REMOTE_MAX_LEN)
+		return -EPROTO;
+	if (req->msg.type != REMOTE_READ && req->msg.len != sizeof(range) + len)
+		return -EPROTO;
+	if (!ctx->chip)
+		return -ENODEV;
+	if (start + len > (off_t)ctx->chip->total_size_kb * 1024)
+		return -EINVAL;
+
+	switch (req->msg.type) {
+	case REMOTE_READ:
+		ret = ctx->mst->spi.read(ctx, req->result, start, len);
+		if (ret >= 0)
+			req->result_len = len;
+		break;
+	case REMOTE_WRITE_256:
+		ret = ctx->mst->spi.write_256(ctx, data, start, len);
+		break;
+	default:
+		ret = spi_aai_write(ctx, data, start, len);
+		break;
+	}
+	return ret < 0 ? ret : 0;
+}
+
+static int remote_set_chip(struct context *ctx, struct remote_request *req)
+{
+	char *name;
+	int ret;
+
+	name = strndup((char *)req->payload, req->msg.len);
+	if (!name)
+		return -ENOMEM;
+	ret = op_set_chip(ctx, name);
+	if (ret)
+		ctx->chip = NULL;
+	free(name);
+	return ret;
+}
+
+static int remote_set_target(struct context *ctx, struct remote_request *req)
+{
+	uint32_t target;
+
+	if (req->msg.len != sizeof(target))
+		return -EPROTO;
+	memcpy(&target, req->payload, sizeof(target));
+	return op_set_target(ctx, ntohl(target));
+}
+
+static int32_t remote_dispatch(struct context *ctx, struct remote_request *req)
+{
+	switch (req->msg.type) {
+	case REMOTE_HELLO:
+		return remote_hello(ctx, req);
+	case REMOTE_SPI:
+		return remote_spi(ctx, req);
+	case REMOTE_READ:
+	case REMOTE_WRITE_256:
+	case REMOTE_WRITE_AAI:
+		return remote_transfer(ctx, req);
+	case REMOTE_SET_CHIP:
+		return remote_set_chip(ctx, req);
+	case REMOTE_SET_TARGET:
+		return remote_set_target(ctx, req);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+/*
+ * Carry out one request, and answer it. The client sends the next ones
+ * meanwhile, so that the programmer is never left waiting for the network.
+ */
+static int remote_handle(struct context *ctx, int fd)
+{
+	struct remote_request req;
+	struct remote_msg msg;
+	int ret;
+
+	ret = read_full(fd, &msg, sizeof(msg));
+	if (ret)
+		return ret;
+	memset(&req, 0, sizeof(req));
+	req.msg.type = msg.type;
+	req.msg.seq = ntohl(msg.seq);
+	req.msg.len = ntohl(msg.len);
+	if (req.msg.len > sizeof(struct remote_range) + REMOTE_MAX_LEN)
+		return -EPROTO;
+
+	req.payload = buffer_get(&ctx->buffers, req.msg.len + 1);
+	req.result = buffer_get(&ctx->buffers, REMOTE_MAX_LEN);
+	ret = -ENOMEM;
+	if (req.payload && req.result)
+		ret = read_full(fd, req.payload, req.msg.len);
+	if (!ret) {
+		req.status = remote_dispatch(ctx, &req);
+		if (req.status)
+			req.result_len = 0;
+		pr_vdbg("request %u type %u: %d\n", req.msg.seq,
+			req.msg.type, req.status);
+
+		msg.status = htonl(req.status);
+		msg.len = htonl(req.result_len);
+		ret = write_full(fd, &msg, sizeof(msg));
+		if (!ret)
+			ret = write_full(fd, req.result, req.result_len);
+	}
+	buffer_put(&ctx->buffers, req.payload);
+	buffer_put(&ctx->buffers, req.result);
+	return ret;
+}
+
+static void remote_signal(int sig)
+{
+	remote_stop = 1;
+}
+
+static int remote_listen(const char *address)
+{
+	char *host, *port;
+	int fd;
+
+	if (strchr(address, '/'))
+		return unix_listen(address);
+
+	host = strdup(address);
+	if (!host)
+		return -ENOMEM;
+	port = strrchr(host, ':');
+	if (!port) {
+		pr_err("Remote address %s is neither a path nor [host]:port\n",
+		       address);
+		free(host);
+		return -EINVAL;
+	}
+	*port++ = '\0';
+	/* The SPI access isn't authenticated, other hosts get it on demand */
+	fd = tcp_listen(*host ? host : "127.0.0.1", port);
+	free(host);
+	return fd;
+}
+
+int remote_serve(const char *address, struct list_head *ops)
+{
+	struct sigaction sa;
+	struct context ctx;
+	int fd, cfd, ret;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ret = operations_run(&ctx, ops);
+	if (ret)
+		return ret;
+	if (!ctx.mst || !(ctx.mst->buses_supported & BUS_SPI)) {
+		pr_err("Only SPI programmers can be served\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	fd = remote_listen(address);
+	ret = fd;
+	if (fd < 0)
+		goto out;
+
+	signal(SIGPIPE, SIG_IGN);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = remote_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	pr_info("Serving programmer %s on %s\n", ctx.mst->name, address);
+	while (!remote_stop) {
+		cfd = socket_accept(fd);
+		if (cfd < 0)
+			continue;
+		pr_info("Remote client connected\n");
+		do {
+			ret = remote_handle(&ctx, cfd);
+		} while (!ret);
+		if (ret != -EPIPE)
+			pr_err("Remote client dropped: %d\n", ret);
+		pr_info("Remote client disconnected\n");
+		close(cfd);
+	}
+
+	pr_info("Stopping remote server\n");
+	close(fd);
+	if (strchr(address, '/'))
+		unlink(address);
+	ret = 0;
+out:
+	programmer_shutdown(&ctx);
+	image_cache_release(&ctx.images);
+	buffer_pool_release(&ctx.buffers);
+	return ret;
+}
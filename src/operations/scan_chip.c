@@ -0,0 +1,130 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * It is heavily inspired from flashrom project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "chip-scan"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <buffer_pool.h>
+#include <chip.h>
+#include <debug.h>
+#include <operations.h>
+#include <programmer.h>
+
+static size_t gcd(size_t a, size_t b)
+{
+	size_t t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/*
+ * The chip is read chunk by chunk, each chunk being handed to all the
+ * verifies. If there is a read among the parts, the whole zone is kept for it.
+ * Each part ends with its own status, as if it had been run alone, and the
+ * first failure is returned.
+ */
+int op_scan_chip(struct context *ctx, struct scan_part *parts, int nb_parts)
+{
+	struct chip_verify *v;
+	unsigned char *buf = NULL;
+	size_t chunk = VERIFY_CHUNK_SIZE, len = 0, pos, n, vn;
+	int i, ret = 0, err, first = 0, failed = 0, whole = 0, verify = 0;
+	int *status;
+
+	v = calloc(nb_parts, sizeof(*v));
+	status = calloc(nb_parts, sizeof(*status));
+	if (!v || !status) {
+		free(v);
+		free(status);
+		return -ENOMEM;
+	}
+	for (i = 0; i < nb_parts; i++) {
+		if (!parts[i].verify) {
+			whole = 1;
+			len = ctx->chip->total_size_kb * 1024;
+			continue;
+		}
+		/* A verify which can't start stops the scan to the parts before */
+		failed = chip_verify_start(ctx, &v[i], parts[i].filename, NULL,
+					   0, 0, 0);
+		if (failed) {
+			nb_parts = i;
+			break;
+		}
+		verify = 1;
+		if (v[i].len > len)
+			len = v[i].len;
+		/* The chunks must fall on the block boundaries of all manifests */
+		chunk = chunk / gcd(chunk, v[i].m.block_size) *
+			v[i].m.block_size;
+	}
+	if (!nb_parts)
+		goto out;
+
+	ret = -ENOMEM;
+	buf = buffer_get(&ctx->buffers, whole ? len : chunk);
+	if (!buf)
+		goto out;
+
+	pr_info("Reading zone 0x000000..0x%06zx for %d operations\n", len,
+		nb_parts);
+	for (pos = 0; pos < len; pos += n) {
+		n = len - pos < chunk ? len - pos : chunk;
+		if (verify)
+			ret = chip_read_back(ctx, buf + (whole ? pos : 0), pos, n);
+		else
+			ret = chip_read(ctx, buf + (whole ? pos : 0), pos, n);
+		if (ret < (int)n) {
+			ret = ret < 0 ? ret : -EIO;
+			goto out;
+		}
+		ret = 0;
+		for (i = 0; i < nb_parts; i++) {
+			if (!parts[i].verify || status[i] || pos >= v[i].len)
+				continue;
+			vn = v[i].len - pos < n ? v[i].len - pos : n;
+			status[i] = chip_verify_chunk(ctx, &v[i],
+						      buf + (whole ? pos : 0),
+						      pos, vn);
+		}
+	}
+
+out:
+	/* A failed chip read fails all the parts */
+	for (i = 0; i < nb_parts; i++) {
+		err = ret ? : status[i];
+		if (parts[i].verify)
+			err = chip_verify_finish(ctx, &v[i], err);
+		else if (!err)
+			err = chip_read_store(parts[i].filename, buf, len);
+		if (err && !first)
+			first = err;
+	}
+	buffer_put(&ctx->buffers, buf);
+	free(status);
+	free(v);
+	return first ? : failed;
+}
@@ -24,6 +24,7 @@
 
 #include <chip.h>
 #include <debug.h>
+#include <programmer.h>
 
 int op_set_chip(struct context *context, char *programmer_args)
 {
@@ -32,14 +33,16 @@ int op_set_chip(struct context *context, char *programmer_args)
 	const char *chip_name = programmer_args;
 
 	pr_dbg("Setting chip to %s\n", chip_name);
+	block_cache_drop(context);
 	for_each_chip(chip) {
 		if (!strcmp(chip->driver_name, chip_name)) {
 			context->chip = chip;
 			ret = chip->probe(context, programmer_args);
 			if (!ret)
 				return -ENODEV;
-			else
-				return 0;
+			if (context->mst->chip_setup)
+				return context->mst->chip_setup(context);
+			return 0;
 		}
 	}
 
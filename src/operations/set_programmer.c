@@ -20,31 +20,51 @@
 #define DEBUG_MODULE "set-programmer"
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <chip.h>
 #include <debug.h>
 #include <programmer.h>
 
 int op_set_programmer(struct context *context, char *programmer_args)
 {
-	int ret;
+	int ret = -ENODEV;
 	struct programmer *programmer;
-	const char *programmer_name = extract_programmer_name(programmer_args);
+	char *programmer_name;
 	void *pdata;
 
 	pr_dbg("Setting programmer to %s\n", programmer_args);
+	if (context->mst && !strcmp(context->programmer_args, programmer_args)) {
+		pr_dbg("Keeping already opened programmer\n");
+		return 0;
+	}
+	if (context->mst) {
+		programmer_shutdown(context);
+		block_cache_drop(context);
+		context->mst = NULL;
+		free(context->programmer_args);
+		context->programmer_args = NULL;
+	}
+
+	programmer_name = extract_programmer_name(programmer_args);
+	if (!programmer_name)
+		return -EINVAL;
 	for_each_programmer(programmer) {
 		if (!strcmp(programmer->name, programmer_name)) {
 			ret = programmer->probe(programmer_args, &pdata);
 			if (!ret) {
 				context->mst = programmer;
+				context->programmer_args = strdup(programmer_args);
 				context->programmer_data = pdata;
 			}
+			free(programmer_name);
 			return ret;
 		}
 	}
 
 	pr_err("Programmer %s not found in available programmers.\n",
 	       programmer_name);
-	return -ENODEV;
+	free(programmer_name);
+	return ret;
 }
@@ -0,0 +1,51 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#define DEBUG_MODULE "target-set"
+
+#include <errno.h>
+
+#include <chip.h>
+#include <debug.h>
+#include <programmer.h>
+
+int op_set_target(struct context *context, int target)
+{
+	int ret;
+
+	pr_dbg("Selecting target %d\n", target);
+	if (!context->mst) {
+		pr_err("No programmer found, cannot select target %d.\n",
+		       target);
+		return -ENODEV;
+	}
+	if (!context->mst->select_target) {
+		if (target == 1)
+			return 0;
+		pr_err("Programmer %s has a single target.\n",
+		       context->mst->name);
+		return -EINVAL;
+	}
+
+	/* The chip of the previous target must not be used anymore. */
+	context->chip = NULL;
+	block_cache_drop(context);
+	ret = context->mst->select_target(context, target);
+	if (!ret)
+		pr_info("Selected target %d\n", target);
+	return ret;
+}
@@ -24,59 +24,201 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <buffer_pool.h>
 #include <chip.h>
 #include <debug.h>
+#include <hash.h>
+#include <image.h>
+#include <manifest.h>
+#include <operations.h>
 #include <programmer.h>
 
-int op_verify_chip(struct context *ctx, char *filename,
-		   off_t where, size_t len)
+#define VERIFY_MAX_REPORTS 16
+
+/*
+ * The hash of each block of the chip is compared to the image manifest. If the
+ * image has no valid manifest, it is built along with the verify, from the
+ * image content given or read from the image file, and stored for the next
+ * verify.
+ */
+int chip_verify_start(struct context *ctx, struct chip_verify *v,
+		      char *filename, const unsigned char *image,
+		      size_t image_len, off_t where, size_t len)
 {
-	FILE *f;
-	unsigned char *buf = NULL, *buf_reference = NULL;
+	size_t chip_size = ctx->chip->total_size_kb * 1024;
 	int ret;
 
-	buf_reference = malloc(ctx->chip->total_size_kb * 1024);
-	if (!buf_reference)
-		return -ENOMEM;
-	buf = malloc(ctx->chip->total_size_kb * 1024);
-	if (!buf)
-		return -ENOMEM;
-
-	f = fopen(filename, "r");
-	if (!f) {
-		pr_err("Cannot open file %s to verfiy the chip against\n",
-		       filename);
-		return errno;
-	}
-	if (!len) {
-		fseek(f, 0, SEEK_END);
-		len = ftell(f);
-		rewind(f);
+	memset(v, 0, sizeof(*v));
+	v->filename = filename;
+	v->image = image;
+	v->where = where;
+	v->have_manifest = !manifest_load_for_image(filename, &v->m);
+	if (v->have_manifest) {
+		pr_info("Verifying against manifest of %s\n", filename);
+	} else {
+		if (!image) {
+			v->img = image_open(filename);
+			if (!v->img) {
+				pr_err("Cannot open file %s to verify the chip against\n",
+				       filename);
+				return -ENOENT;
+			}
+			image_len = image_length(v->img);
+		}
+		ret = manifest_init(&v->m, image_len, MANIFEST_BLOCK_SIZE);
+		if (ret)
+			goto err;
 	}
-	ret = fread(buf_reference + where, len, 1, f);
-	if (ret < 1) {
-		pr_err("Couldn't read %zd bytes from %s\n",
-		       len, filename);
-		ret = -ENXIO;
+	if (!len)
+		len = v->m.image_len;
+	v->len = len;
+	ret = -EINVAL;
+	if (len > v->m.image_len || where + len > chip_size) {
+		pr_err("Zone 0x%06x..0x%06x doesn't fit the image or the chip\n",
+		       where, where + len);
 		goto err;
 	}
+	return 0;
 
-	pr_info("Reading zone 0x%06x..0x%06x\n", where, where + len);
-	ret = chip_read(ctx, buf, where, len);
-	if (ret < len)
-		goto err;
-	if (!memcmp(buf_reference + where, buf, len)) {
+err:
+	chip_verify_finish(ctx, v, ret);
+	return ret;
+}
+
+int chip_verify_chunk(struct context *ctx, struct chip_verify *v,
+		      const unsigned char *buf, size_t pos, size_t n)
+{
+	struct manifest *m = &v->m;
+	unsigned char *buf_reference;
+	size_t b, blen;
+	int ret;
+
+	if (!v->have_manifest && v->image) {
+		ret = image_cache_wait(&ctx->images, v->image + pos, n);
+		if (ret)
+			return ret;
+		manifest_hash(m, v->image + pos, pos, n);
+	} else if (!v->have_manifest) {
+		buf_reference = buffer_get(&ctx->buffers, n);
+		if (!buf_reference)
+			return -ENOMEM;
+		if (image_read(v->img, buf_reference, pos, n)) {
+			pr_err("Couldn't read %zd bytes from %s\n",
+			       n, v->filename);
+			buffer_put(&ctx->buffers, buf_reference);
+			return -ENXIO;
+		}
+		manifest_hash(m, buf_reference, pos, n);
+		buffer_put(&ctx->buffers, buf_reference);
+	}
+
+	for (b = 0; b < n; b += blen) {
+		blen = n - b < m->block_size ? n - b : m->block_size;
+		/* A zone shorter than the image ends in a partial block */
+		if (pos + b + m->block_size > v->len &&
+		    pos + b + m->block_size <= m->image_len)
+			continue;
+		if (crc32c(0, buf + b, blen) == m->crc[(pos + b) / m->block_size])
+			continue;
+		if (v->nb_bad++ < VERIFY_MAX_REPORTS)
+			pr_warn("Mismatch in block 0x%06x..0x%06x\n",
+				v->where + pos + b, v->where + pos + b + blen);
+	}
+	return 0;
+}
+
+int chip_verify_finish(struct context *ctx, struct chip_verify *v, int ret)
+{
+	if (ret)
+		goto out;
+
+	if (v->nb_bad > VERIFY_MAX_REPORTS)
+		pr_warn("... and %u more mismatching blocks\n",
+			v->nb_bad - VERIFY_MAX_REPORTS);
+	if (!v->have_manifest && v->len == v->m.image_len)
+		manifest_save_for_image(v->filename, &v->m);
+	if (!v->nb_bad) {
 		pr_warn("Verification of chip against %s success.\n",
-			filename);
+			v->filename);
 	} else {
 		pr_warn("Verification of chip against %s failure.\n",
-			filename);
+			v->filename);
+		ret = -EIO;
 	}
-	ret = 0;
 
-err:
-	fclose(f);
-	free(buf);
-	free(buf_reference);
+out:
+	if (v->img)
+		image_close(v->img);
+	v->img = NULL;
+	manifest_release(&v->m);
 	return ret;
 }
+
+/*
+ * The chip is read chunk by chunk, each chunk being verified before the next
+ * one is read.
+ */
+static int chip_verify(struct context *ctx, char *filename,
+		       const unsigned char *image, size_t image_len,
+		       off_t where, size_t len)
+{
+	struct chip_verify v;
+	unsigned char *buf;
+	size_t chunk, n, pos;
+	int ret;
+
+	ret = chip_verify_start(ctx, &v, filename, image, image_len, where,
+				len);
+	if (ret)
+		return ret;
+
+	chunk = chip_verify_chunk_size(&v);
+	buf = buffer_get(&ctx->buffers, chunk);
+	if (!buf)
+		return chip_verify_finish(ctx, &v, -ENOMEM);
+
+	pr_info("Reading zone 0x%06x..0x%06x\n", where, where + v.len);
+	for (pos = 0; pos < v.len; pos += n) {
+		n = v.len - pos < chunk ? v.len - pos : chunk;
+		ret = chip_read_back(ctx, buf, where + pos, n);
+		if (ret < (int)n) {
+			ret = ret < 0 ? ret : -EIO;
+			break;
+		}
+		ret = chip_verify_chunk(ctx, &v, buf, pos, n);
+		if (ret)
+			break;
+	}
+	buffer_put(&ctx->buffers, buf);
+	return chip_verify_finish(ctx, &v, ret);
+}
+
+int op_verify_chip(struct context *ctx, char *filename,
+		   off_t where, size_t len)
+{
+	return chip_verify(ctx, filename, NULL, 0, where, len);
+}
+
+/*
+ * The image just written is still in the image cache, and is the reference of
+ * the verify if it has no manifest. The blocks left untouched by the write and
+ * read from the chip are served by the block cache, so that only the written
+ * blocks are read back.
+ */
+int op_write_verify_chip(struct context *ctx, char *filename)
+{
+	const unsigned char *image;
+	size_t size;
+	int ret;
+
+	ret = op_write_chip(ctx, filename, 0, 0);
+	if (ret)
+		return ret;
+	image = image_cache_get(&ctx->images, filename, &size);
+	if (!image) {
+		pr_err("Cannot load file %s to verify the chip against\n",
+		       filename);
+		return -ENOENT;
+	}
+	return chip_verify(ctx, filename, image, size, 0, 0);
+}
@@ -24,15 +24,67 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <buffer_pool.h>
 #include <chip.h>
 #include <debug.h>
+#include <diff.h>
+#include <image.h>
+#include <journal.h>
+#include <operations.h>
 #include <programmer.h>
 
+static int write_ranges(struct context *context, const unsigned char *block,
+			off_t bstart, struct diff_ranges *ranges)
+{
+	struct diff_range *r;
+	int i, ret;
+
+	for (i = 0; i < ranges->nb; i++) {
+		r = &ranges->range[i];
+		ret = chip_write(context, block + (r->start - bstart),
+				 r->start, r->len);
+		if (ret < (int)r->len) {
+			pr_err("Write of zone 0x%06x..0x%06x failed: %d\n",
+			       r->start, r->start + r->len, ret);
+			return ret < 0 ? ret : -EIO;
+		}
+	}
+	return 0;
+}
+
+/*
+ * A compressed image is still being decompressed while the chip is written :
+ * the zone is programmed by runs of the pages already there, of at least
+ * WRITE_STREAM_CHUNK bytes. An image already loaded is a single run.
+ */
+#define WRITE_STREAM_CHUNK (64 * 1024)
+
+static size_t write_stream_run(struct context *context,
+			       const unsigned char *buf, off_t start,
+			       size_t pos, size_t len)
+{
+	size_t n, page_size = context->chip->page_size;
+
+	n = image_cache_available(&context->images, buf + pos, len - pos);
+	if (n == len - pos)
+		return n;
+	if (n < WRITE_STREAM_CHUNK)
+		n = len - pos < WRITE_STREAM_CHUNK ? len - pos :
+			WRITE_STREAM_CHUNK;
+	/* Stop on a page boundary, so that no page is programmed twice */
+	if (n < len - pos && (start + pos + n) % page_size > 0 &&
+	    n > (start + pos + n) % page_size)
+		n -= (start + pos + n) % page_size;
+	return n;
+}
+
 static int chip_write_by_biggest_erases(struct context *context,
-					unsigned char *buf, off_t start,
+					const unsigned char *buf, off_t start,
 					size_t len)
 {
-	int ret;
+	struct diff_ranges ranges;
+	size_t pos, n;
+	int ret, blank;
 
 	pr_info("Erasing zone 0x%06x..0x%06x\n", start, start + len);
 	ret = chip_erase(context, start, len, 0, NULL, NULL);
@@ -42,122 +94,394 @@ static int chip_write_by_biggest_erases(struct context *context,
 		return ret;
 	}
 	pr_info("Writing zone 0x%06x..0x%06x\n", start, start + len);
-	ret = chip_write(context, buf, start, len);
-	return ret;
+	for (pos = 0; pos < len; pos += n) {
+		/* The blocks known blank from the image manifest are skipped */
+		n = image_cache_span(&context->images, buf + pos, len - pos,
+				     &blank);
+		if (blank)
+			continue;
+		n = write_stream_run(context, buf, start, pos, pos + n);
+		ret = image_cache_wait(&context->images, buf + pos, n);
+		if (ret)
+			return ret;
+		ret = diff_data_ranges(buf + pos, start + pos, n,
+				       context->chip->page_size, &ranges);
+		if (ret)
+			return ret;
+		/* Erased pages which stay blank don't need to be programmed. */
+		ret = write_ranges(context, buf + pos, start + pos, &ranges);
+		diff_release_ranges(&ranges);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Compute the part of the erase block [bstart, bstart + blen[ covered by the
+ * zone [start, end[.
+ */
+static void block_overlap(off_t bstart, size_t blen, off_t start, off_t end,
+			  off_t *ostart, size_t *olen)
+{
+	off_t oend = bstart + blen < end ? bstart + blen : end;
+
+	*ostart = bstart > start ? bstart : start;
+	*olen = oend > *ostart ? oend - *ostart : 0;
+}
+
+static int block_matches(struct context *context, unsigned char *tmp,
+			 off_t bstart, size_t blen, const unsigned char *ref,
+			 off_t ostart, size_t olen)
+{
+	int ret;
+
+	ret = chip_read_back(context, tmp, bstart, blen);
+	if (ret < (int)blen)
+		return 0;
+	return !memcmp(tmp + (ostart - bstart), ref, olen);
 }
 
+/*
+ * A chip erase would make the whole chip a single block, defeating the purpose
+ * of block by block writes. Keep only the erasers smaller than the chip, if
+ * any.
+ */
+static void block_erasers(struct flashchip *chip,
+			    struct block_eraser erasers[NUM_ERASEFUNCTIONS])
+{
+	size_t chip_size = chip->total_size_kb * 1024;
+	int i, j = 0;
+
+	memset(erasers, 0, sizeof(chip->erasers));
+	for (i = 0; i < NUM_ERASEFUNCTIONS; i++)
+		if (chip->erasers[i].block_erase &&
+		    chip->erasers[i].size < chip_size)
+			erasers[j++] = chip->erasers[i];
+	if (!j)
+		memcpy(erasers, chip->erasers, sizeof(chip->erasers));
+}
+
+/*
+ * Each erase block is compared page by page to its current content. Blocks
+ * where bits only need to be cleared are programmed in place, the others are
+ * erased, and only their non blank pages are programmed.
+ */
 static int chip_write_if_changes(struct context *context,
-				 unsigned char *buf, off_t start,
-				 size_t len, unsigned char *chip_ref)
+				 const unsigned char *buf, off_t start,
+				 size_t len)
 {
 	LIST_HEAD(erases);
-	struct block_eraser *eraser;
-	off_t end, bstart, copy_skip_first, copy_skip_last;
-	size_t blen;
-	int ret, skip_it;
+	struct block_eraser erasers[NUM_ERASEFUNCTIONS], *eraser;
+	struct diff_block diff;
+	unsigned char *chip_ref, *block = NULL;
+	off_t end = start + len, zstart, ostart;
+	size_t zlen, olen, max_blen = 0;
+	int ret;
 
-	end = start + len;
-	ret = compute_list_erases(context->chip->erasers, start, len, &erases);
+	block_erasers(context->chip, erasers);
+	ret = compute_list_erases(erasers, start, len, &erases);
 	if (ret)
 		return ret;
 
-	bstart = list_first_entry(&erases, struct block_eraser, list)->start;
+	/* Only the erase blocks covering the zone need to be read. */
+	zstart = list_first_entry(&erases, struct block_eraser, list)->start;
+	eraser = list_last_entry(&erases, struct block_eraser, list);
+	zlen = eraser->start + eraser->size - zstart;
+	list_for_each_entry(eraser, &erases, list)
+		if (eraser->size > max_blen)
+			max_blen = eraser->size;
+	chip_ref = buffer_get(&context->buffers, zlen);
+	block = buffer_get(&context->buffers, max_blen);
+	if (!chip_ref || !block) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	ret = chip_read(context, chip_ref, zstart, zlen);
+	if (ret < (int)zlen) {
+		ret = ret < 0 ? ret : -EIO;
+		goto out;
+	}
+
+	ret = 0;
 	list_for_each_entry(eraser, &erases, list) {
-		blen = eraser->size;
-		skip_it = (bstart >= start && (bstart + blen < len) &&
-			   !memcmp(chip_ref + bstart, buf + bstart, blen));
-		pr_vdbg("%s: considering 0x%06x..0x%06x(%d): %s\n",
-			__func__, bstart, bstart + blen, blen,
-			skip_it ? "won't touch" : "erasing and writing");
-		if (skip_it)
-			continue;
-		ret = eraser->block_erase(context, bstart, blen);
-		if (ret < 0) {
-			pr_err("Erase of zone 0x%06x..0x%06x failed: %d\n",
-			       bstart, bstart + blen, ret);
+		block_overlap(eraser->start, eraser->size, start, end,
+			      &ostart, &olen);
+		ret = image_cache_wait(&context->images, buf + (ostart - start),
+				       olen);
+		if (ret)
 			break;
-		}
-		copy_skip_first = (start > bstart ? start - bstart : 0);
-		copy_skip_last = (end < bstart + blen ? bstart + blen - end
-				  : 0);
-		memcpy(chip_ref + bstart + copy_skip_first,
-		       buf + (bstart - start),
-		       blen - copy_skip_first - copy_skip_last);
-		ret = chip_write(context, chip_ref + bstart, bstart, blen);
-		if (ret < blen) {
-			pr_err("Write of zone 0x%06x..0x%06x failed: %d\n",
-			       bstart, bstart + blen, ret);
+		memcpy(block, chip_ref + (eraser->start - zstart),
+		       eraser->size);
+		memcpy(block + (ostart - eraser->start),
+		       buf + (ostart - start), olen);
+		ret = diff_compute_block(chip_ref + (eraser->start - zstart),
+					 block, eraser->start, eraser->size,
+					 context->chip->page_size, &diff);
+		if (ret)
 			break;
+
+		if (diff.flags & DIFF_BITS_CLEARED) {
+			pr_vdbg("%s: 0x%06x..0x%06x(%d) programming %d ranges\n",
+				__func__, eraser->start,
+				eraser->start + eraser->size, eraser->size,
+				diff.changed.nb);
+			ret = write_ranges(context, block, eraser->start,
+					   &diff.changed);
+		} else if (diff.flags & DIFF_NEEDS_ERASE) {
+			pr_vdbg("%s: 0x%06x..0x%06x(%d) erasing and writing\n",
+				__func__, eraser->start,
+				eraser->start + eraser->size, eraser->size);
+			ret = chip_erase_block(context, eraser, eraser->start,
+					       eraser->size);
+			if (ret < 0)
+				pr_err("Erase of zone 0x%06x..0x%06x failed: %d\n",
+				       eraser->start,
+				       eraser->start + eraser->size, ret);
+			else
+				ret = write_ranges(context, block,
+						   eraser->start, &diff.data);
+		} else {
+			pr_vdbg("%s: 0x%06x..0x%06x(%d) unchanged, won't touch\n",
+				__func__, eraser->start,
+				eraser->start + eraser->size, eraser->size);
 		}
-		bstart += blen;
+		diff_release_block(&diff);
+		if (ret)
+			break;
 	}
-	return 0;
+
+out:
+	buffer_put(&context->buffers, block);
+	buffer_put(&context->buffers, chip_ref);
+	free_list_erases(&erases);
+	return ret;
 }
 
-int op_write_chip(struct context *context, char *filename,
-		  off_t where, size_t len)
+/*
+ * Journaled write : the zone is written erase block by erase block, and each
+ * block is read back. The journal records after each step the state of the
+ * block, so that an interrupted write can be resumed.
+ *
+ * Bytes outside the written zone within a partially covered block are
+ * preserved by reading the block first. If the write is interrupted between
+ * the erase and the program of such a block, these bytes are lost.
+ */
+static int chip_write_journaled(struct context *context,
+				const unsigned char *buf, off_t start,
+				size_t len)
 {
-	struct flashchip *chip = context->chip;
-	FILE *f;
-	unsigned char *buf, *chip_ref;
-	size_t ret;
-
-	buf = malloc(chip->total_size_kb * 1024);
-	chip_ref = malloc(chip->total_size_kb * 1024);
-	memset(buf, 0xff, chip->total_size_kb * 1024);
-	memset(chip_ref, 0xff, chip->total_size_kb * 1024);
-	if (!buf || !chip_ref)
-		return -ENOMEM;
-
-	f = fopen(filename, "r");
-	if (!f) {
-		pr_err("Cannot open file %s to write the chip\n",
-		       filename);
-		return errno;
-	}
-	if (!len) {
-		fseek(f, 0, SEEK_END);
-		len = ftell(f);
-		rewind(f);
+	LIST_HEAD(erases);
+	struct block_eraser erasers[NUM_ERASEFUNCTIONS], *eraser;
+	struct journal *journal;
+	enum journal_state state;
+	unsigned char *block = NULL, *tmp = NULL;
+	off_t end = start + len, ostart;
+	size_t olen, max_blen = 0;
+	int ret, i, first, partial;
+
+	block_erasers(context->chip, erasers);
+	ret = compute_list_erases(erasers, start, len, &erases);
+	if (ret)
+		return ret;
+	/* The journal is named after the hash of the whole image */
+	ret = image_cache_wait(&context->images, buf, len);
+	if (ret) {
+		journal = NULL;
+		goto out;
 	}
-	if (len > chip->total_size_kb * 1024) {
-		pr_warn("File %s is bigger that chip total size %d, truncating\n",
-			filename, chip->total_size_kb * 1024);
-		len = chip->total_size_kb * 1024;
+	journal = journal_open(context, buf, len, start, &erases,
+			       context->journal_mode == JOURNAL_RESUME);
+	if (!journal) {
+		ret = -EIO;
+		goto out;
+	}
+	list_for_each_entry(eraser, &erases, list)
+		if (eraser->size > max_blen)
+			max_blen = eraser->size;
+	block = buffer_get(&context->buffers, max_blen);
+	tmp = buffer_get(&context->buffers, max_blen);
+	if (!block || !tmp) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* Quickly check the last block committed by a previous run. */
+	first = journal_first_incomplete(journal);
+	i = 0;
+	list_for_each_entry(eraser, &erases, list) {
+		if (first == 0 || i++ != first - 1)
+			continue;
+		block_overlap(eraser->start, eraser->size, start, end,
+			      &ostart, &olen);
+		if (block_matches(context, tmp, eraser->start, eraser->size,
+				  buf + (ostart - start), ostart, olen)) {
+			pr_info("Resuming write at block 0x%06x\n",
+				eraser->start + eraser->size);
+		} else {
+			pr_warn("Last committed block 0x%06x is corrupted, rewriting it\n",
+				eraser->start);
+			journal_set_state(journal, first - 1, JOURNAL_PENDING);
+		}
 	}
-	ret = fread(buf, len, 1, f);
-	if (ret < 1) {
-		pr_err("Couldn't read %zd bytes from %s\n",
-		       len, filename);
-		ret = -ENXIO;
-		goto err;
+
+	i = -1;
+	list_for_each_entry(eraser, &erases, list) {
+		i++;
+		state = journal_get_state(journal, i);
+		if (state == JOURNAL_VERIFIED)
+			continue;
+		block_overlap(eraser->start, eraser->size, start, end,
+			      &ostart, &olen);
+		partial = (olen < eraser->size);
+		pr_vdbg("%s: block 0x%06x..0x%06x(%d), state %d\n", __func__,
+			eraser->start, eraser->start + eraser->size,
+			eraser->size, state);
+
+		if (state == JOURNAL_PROGRAMMED &&
+		    block_matches(context, tmp, eraser->start, eraser->size,
+				  buf + (ostart - start), ostart, olen)) {
+			ret = journal_set_state(journal, i, JOURNAL_VERIFIED);
+			if (ret)
+				break;
+			continue;
+		}
+		if (state == JOURNAL_PROGRAMMED)
+			state = JOURNAL_PENDING;
+
+		if (state == JOURNAL_PENDING && (partial ||
+		    context->write_strategy == WIPE_IF_CHANGES)) {
+			ret = chip_read(context, block, eraser->start,
+					eraser->size);
+			if (ret < (int)eraser->size) {
+				ret = -EIO;
+				break;
+			}
+			if (context->write_strategy == WIPE_IF_CHANGES &&
+			    !memcmp(block + (ostart - eraser->start),
+				    buf + (ostart - start), olen)) {
+				ret = journal_set_state(journal, i,
+							JOURNAL_VERIFIED);
+				if (ret)
+					break;
+				continue;
+			}
+		} else {
+			memset(block, 0xff, eraser->size);
+		}
+		memcpy(block + (ostart - eraser->start), buf + (ostart - start),
+		       olen);
+
+		if (state == JOURNAL_PENDING) {
+			ret = chip_erase_block(context, eraser, eraser->start,
+					       eraser->size);
+			if (ret) {
+				pr_err("Erase of zone 0x%06x..0x%06x failed: %d\n",
+				       eraser->start, eraser->start + eraser->size,
+				       ret);
+				break;
+			}
+			ret = journal_set_state(journal, i, JOURNAL_ERASED);
+			if (ret)
+				break;
+		}
+
+		ret = chip_write(context, block, eraser->start, eraser->size);
+		if (ret < (int)eraser->size) {
+			pr_err("Write of zone 0x%06x..0x%06x failed: %d\n",
+			       eraser->start, eraser->start + eraser->size, ret);
+			ret = -EIO;
+			break;
+		}
+		ret = journal_set_state(journal, i, JOURNAL_PROGRAMMED);
+		if (ret)
+			break;
+
+		if (!block_matches(context, tmp, eraser->start, eraser->size,
+				   block, eraser->start, eraser->size)) {
+			pr_err("Verification of zone 0x%06x..0x%06x failed\n",
+			       eraser->start, eraser->start + eraser->size);
+			ret = -EIO;
+			break;
+		}
+		ret = journal_set_state(journal, i, JOURNAL_VERIFIED);
+		if (ret)
+			break;
 	}
 
+	if (!ret)
+		ret = len;
+out:
+	journal_close(journal, ret >= 0);
+	free_list_erases(&erases);
+	buffer_put(&context->buffers, block);
+	buffer_put(&context->buffers, tmp);
+	return ret;
+}
+
+int chip_write_image(struct context *context, const unsigned char *buf,
+		     off_t where, size_t len)
+{
+	int ret;
+
+	if (context->chip->unlock) {
+		ret = context->chip->unlock(context);
+		if (ret) {
+			pr_err("Couldn't unlock the chip for writing: %d\n", ret);
+			return ret < 0 ? ret : -EACCES;
+		}
+	}
+
+	if (context->journal_mode != JOURNAL_OFF)
+		return chip_write_journaled(context, buf, where, len);
+
 	switch(context->write_strategy) {
 	case WIPE_BY_BIGGEST_ERASES:
 		ret = chip_write_by_biggest_erases(context, buf, where, len);
 		break;
 	case WIPE_IF_CHANGES:
-		ret = chip_read(context, chip_ref, 0,
-				chip->total_size_kb * 1024);
-		if (ret >= chip->total_size_kb * 1024)
-			ret = chip_write_if_changes(context, buf, where, len,
-						    chip_ref);
-		fclose(f);
+		ret = chip_write_if_changes(context, buf, where, len);
 		break;
 	default:
 		ret = -ENODEV;
 	}
+	return ret;
+}
+
+int op_write_chip(struct context *context, char *filename,
+		  off_t where, size_t len)
+{
+	struct flashchip *chip = context->chip;
+	const unsigned char *buf;
+	size_t size;
+	int ret;
+
+	if (write_parts_composite(filename))
+		return op_write_composite(context, filename);
+	buf = image_cache_get(&context->images, filename, &size);
+	if (!buf) {
+		pr_err("Cannot load file %s to write the chip\n", filename);
+		return -ENOENT;
+	}
+	if (!len)
+		len = size;
+	if (len > size) {
+		pr_err("File %s is smaller than the zone to write\n", filename);
+		return -EINVAL;
+	}
+	if (len > chip->total_size_kb * 1024) {
+		pr_warn("File %s is bigger that chip total size %d, truncating\n",
+			filename, chip->total_size_kb * 1024);
+		len = chip->total_size_kb * 1024;
+	}
 
+	ret = chip_write_image(context, buf, where, len);
 	if (ret < 0) {
-		pr_err("Couldn't write the %z bytes into the chip\n",
-		       ret);
-		goto err;
+		pr_err("Couldn't write the %zd bytes into the chip: %d\n",
+		       len, ret);
+		return ret;
 	}
 
-	ret = 0;
 	pr_warn("Write operation succeeded.\n");
-err:
-	free(buf);
-	return ret;
+	return 0;
 }
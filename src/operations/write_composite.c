@@ -0,0 +1,261 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "chip-write"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <buffer_pool.h>
+#include <chip.h>
+#include <debug.h>
+#include <image.h>
+#include <journal.h>
+#include <operations.h>
+#include <programmer.h>
+
+struct write_part {
+	char *filename;
+	off_t where;
+	size_t len;
+};
+
+int write_parts_composite(const char *arg)
+{
+	return strchr(arg, '@') && access(arg, F_OK);
+}
+
+static int write_part_cmp(const void *a, const void *b)
+{
+	const struct write_part *pa = a, *pb = b;
+
+	return (pa->where > pb->where) - (pa->where < pb->where);
+}
+
+static int write_part_parse(char *item, size_t chip_size,
+			    struct write_part *part)
+{
+	unsigned long long where;
+	char *at, *end;
+	ssize_t size;
+
+	at = strrchr(item, '@');
+	if (!at || at == item) {
+		pr_err("%s isn't a file@offset\n", item);
+		return -EINVAL;
+	}
+	*at++ = '\0';
+	errno = 0;
+	where = strtoull(at, &end, 0);
+	if (!*at || *end || errno) {
+		pr_err("Invalid offset %s of file %s\n", at, item);
+		return -EINVAL;
+	}
+	size = image_size(item);
+	if (size < 0) {
+		pr_err("Cannot open file %s\n", item);
+		return size;
+	}
+	if (!size) {
+		pr_err("File %s is empty\n", item);
+		return -EINVAL;
+	}
+	if (where > chip_size || (size_t)size > chip_size - where) {
+		pr_err("File %s at 0x%06llx doesn't fit in the chip\n", item,
+		       where);
+		return -EINVAL;
+	}
+	part->filename = item;
+	part->where = where;
+	part->len = size;
+	return 0;
+}
+
+/*
+ * The parts and their file names are allocated at once, the names pointing
+ * within a copy of arg following the parts.
+ */
+static int write_parts_parse(const char *arg, size_t chip_size,
+			     struct write_part **parts)
+{
+	struct write_part *p;
+	const char *c;
+	char *s, *item;
+	int nb = 1, i, ret = 0;
+
+	for (c = arg; (c = strchr(c, ',')); c++)
+		nb++;
+	p = malloc(nb * sizeof(*p) + strlen(arg) + 1);
+	if (!p)
+		return -ENOMEM;
+	s = strcpy((char *)(p + nb), arg);
+	for (i = 0; !ret && i < nb; i++) {
+		item = s;
+		s = strchr(s, ',');
+		if (s)
+			*s++ = '\0';
+		ret = write_part_parse(item, chip_size, &p[i]);
+	}
+	if (ret) {
+		free(p);
+		return ret;
+	}
+
+	qsort(p, nb, sizeof(*p), write_part_cmp);
+	for (i = 1; i < nb; i++) {
+		if (p[i].where >= p[i - 1].where + (off_t)p[i - 1].len)
+			continue;
+		pr_err("Files %s and %s overlap\n", p[i - 1].filename,
+		       p[i].filename);
+		free(p);
+		return -EINVAL;
+	}
+	*parts = p;
+	return nb;
+}
+
+/*
+ * The zone is assembled from the chip content of the erase blocks holding the
+ * gaps between its files, then from the files, so that the gaps are written
+ * back untouched.
+ */
+static int write_zone(struct context *ctx, struct write_part *parts,
+		      int first, int last, off_t zstart, off_t zend,
+		      size_t esize)
+{
+	unsigned char *buf;
+	off_t pos = zstart, read_end = zstart, start, end;
+	size_t zlen = zend - zstart;
+	int i, ret = 0;
+
+	buf = buffer_get(&ctx->buffers, zlen);
+	if (!buf)
+		return -ENOMEM;
+	for (i = first; !ret && i <= last + 1; i++) {
+		start = pos;
+		end = i <= last ? parts[i].where : zend;
+		if (i <= last)
+			pos = parts[i].where + parts[i].len;
+		if (end <= start)
+			continue;
+		start -= start % esize;
+		start = start > read_end ? start : read_end;
+		end += (esize - end % esize) % esize;
+		if (end <= start)
+			continue;
+		ret = chip_read(ctx, buf + (start - zstart), start, end - start);
+		if (ret < (int)(end - start))
+			break;
+		ret = 0;
+		read_end = end;
+	}
+	for (i = first; !ret && i <= last; i++)
+		ret = image_load(parts[i].filename,
+				 buf + (parts[i].where - zstart), parts[i].len);
+	if (ret > 0)
+		ret = -EIO;
+	if (!ret) {
+		pr_info("Writing %d files into zone 0x%06llx..0x%06llx\n",
+			last - first + 1, (unsigned long long)zstart,
+			(unsigned long long)zend);
+		ret = chip_write_image(ctx, buf, zstart, zlen);
+		if (ret < 0)
+			pr_err("Couldn't write the zone 0x%06llx..0x%06llx: %d\n",
+			       (unsigned long long)zstart,
+			       (unsigned long long)zend, ret);
+		else
+			ret = 0;
+	}
+	buffer_put(&ctx->buffers, buf);
+	return ret;
+}
+
+/*
+ * A journaled write is resumed from the journal of the same zone content. The
+ * gaps of a zone are read from the chip, and a resume after their erase would
+ * build another zone, losing them : under a journal, the files must cover
+ * whole erase blocks.
+ */
+static int write_parts_journalable(struct write_part *parts, int nb,
+				   size_t esize, size_t chip_size)
+{
+	off_t end;
+	int i;
+
+	for (i = 0; i < nb; i++) {
+		end = parts[i].where + parts[i].len;
+		if (parts[i].where % esize ||
+		    (end % esize && (size_t)end != chip_size)) {
+			pr_err("File %s isn't on %zu bytes erase blocks boundaries, as journaled writes need\n",
+			       parts[i].filename, esize);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Each file is widened to the smallest erase blocks it touches, and the files
+ * sharing or bordering erase blocks are gathered into one zone, written at
+ * once.
+ */
+int op_write_composite(struct context *ctx, char *arg)
+{
+	size_t chip_size = ctx->chip->total_size_kb * 1024;
+	size_t esize = chip_smallest_erase_block(ctx->chip);
+	struct write_part *parts = NULL;
+	off_t start = 0, end = 0, zstart = 0, zend = 0;
+	int nb, i, first = 0, nb_zones = 0, ret = 0;
+
+	if (!esize)
+		return -ENODEV;
+	nb = write_parts_parse(arg, chip_size, &parts);
+	if (nb < 0)
+		return nb;
+	if (ctx->journal_mode != JOURNAL_OFF &&
+	    !write_parts_journalable(parts, nb, esize, chip_size)) {
+		free(parts);
+		return -EINVAL;
+	}
+	for (i = 0; !ret && i <= nb; i++) {
+		if (i < nb) {
+			start = parts[i].where - parts[i].where % esize;
+			end = parts[i].where + parts[i].len;
+			end += (esize - end % esize) % esize;
+			if (i > first && start <= zend) {
+				zend = end;
+				continue;
+			}
+		}
+		if (i > 0) {
+			ret = write_zone(ctx, parts, first, i - 1, zstart,
+					 zend, esize);
+			nb_zones++;
+		}
+		first = i;
+		zstart = start;
+		zend = end;
+	}
+	free(parts);
+	if (ret)
+		return ret;
+
+	pr_warn("Write operation succeeded, %d files in %d zones.\n", nb,
+		nb_zones);
+	return 0;
+}
@@ -16,37 +16,246 @@
 #define DEBUG_MODULE "programmer-automatic"
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include <cache.h>
 #include <debug.h>
 #include <programmer.h>
+#include <usb_util.h>
+
+#define AUTO_CACHE "programmers"
+#define AUTO_UNDECIDED -2
+
+/*
+ * All the programmers are probed concurrently. The first one in the
+ * programmers list order which succeeded is chosen, once all the ones before
+ * it failed. Probes finishing after the choice are shut down by their thread,
+ * and are waited for when the chosen programmer is shut down. The programmers
+ * therefore keep their state in their probe data, never in globals.
+ */
+struct auto_job {
+	struct auto_state *state;
+	struct programmer *programmer;
+	void *data;
+	int ret;
+	int done;
+};
+
+struct auto_state {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *args;
+	int winner;
+	int nb_jobs;
+	int refs;
+	struct auto_job jobs[];
+};
 
 static struct programmer automatic;
-static int auto_probe(const char *programmer_args, void **data)
+static struct auto_state *auto_pending;
+static void (*auto_found_shutdown)(void *pdata);
+
+static void auto_state_put(struct auto_state *state)
+{
+	int last = !--state->refs;
+
+	pthread_mutex_unlock(&state->lock);
+	if (!last)
+		return;
+	pthread_mutex_destroy(&state->lock);
+	pthread_cond_destroy(&state->cond);
+	free(state->args);
+	free(state);
+}
+
+static void *auto_probe_job(void *arg)
+{
+	struct auto_job *job = arg;
+	struct auto_state *state = job->state;
+	void *data = NULL;
+	int ret;
+
+	pr_dbg("Probing programmer %s\n", job->programmer->name);
+	ret = job->programmer->probe(state->args, &data);
+
+	pthread_mutex_lock(&state->lock);
+	job->ret = ret;
+	job->data = data;
+	job->done = 1;
+	if (!ret && state->winner != AUTO_UNDECIDED &&
+	    &state->jobs[state->winner] != job &&
+	    job->programmer->shutdown)
+		job->programmer->shutdown(data);
+	pthread_cond_broadcast(&state->cond);
+	auto_state_put(state);
+	return NULL;
+}
+
+/* Wait for the probes still running after the last choice. */
+static void auto_drain(void)
+{
+	struct auto_state *state = auto_pending;
+
+	if (!state)
+		return;
+	pthread_mutex_lock(&state->lock);
+	while (state->refs > 1)
+		pthread_cond_wait(&state->cond, &state->lock);
+	auto_pending = NULL;
+	auto_state_put(state);
+	usb_scan_freeze(0);
+}
+
+static void auto_shutdown(void *pdata)
+{
+	auto_drain();
+	if (auto_found_shutdown)
+		auto_found_shutdown(pdata);
+}
+
+/* Returns the chosen job, -1 if all failed, or AUTO_UNDECIDED. */
+static int auto_pick(struct auto_state *state)
+{
+	int i;
+
+	for (i = 0; i < state->nb_jobs; i++) {
+		if (!state->jobs[i].done)
+			return AUTO_UNDECIDED;
+		if (!state->jobs[i].ret)
+			return i;
+	}
+	return -1;
+}
+
+static int auto_device_missing(struct programmer *programmer)
+{
+	return (programmer->usb_vid || programmer->usb_pid) &&
+		!get_device_by_vid_pid(programmer->usb_vid,
+				       programmer->usb_pid, 0);
+}
+
+static int auto_probe_all(const char *programmer_args, const char *first,
+			  struct programmer **found, void **data)
 {
 	struct programmer *programmer;
+	struct auto_state *state;
+	struct auto_job *job;
+	pthread_t thread;
+	int i, n = 0, ret = -ENODEV;
+
+	for_each_programmer(programmer)
+		n++;
+	state = calloc(1, sizeof(*state) + n * sizeof(state->jobs[0]));
+	if (!state)
+		return -ENOMEM;
+	state->args = strdup(programmer_args);
+	if (!state->args) {
+		free(state);
+		return -ENOMEM;
+	}
+	pthread_mutex_init(&state->lock, NULL);
+	pthread_cond_init(&state->cond, NULL);
+	state->winner = AUTO_UNDECIDED;
+
+	for_each_programmer(programmer) {
+		if (programmer->probe == automatic.probe ||
+		    (first && !strcmp(programmer->name, first)))
+			continue;
+		if (auto_device_missing(programmer)) {
+			pr_dbg("Skipping programmer %s, no device found\n",
+			       programmer->name);
+			continue;
+		}
+		job = &state->jobs[state->nb_jobs++];
+		job->state = state;
+		job->programmer = programmer;
+	}
+	state->refs = state->nb_jobs + 1;
+
+	for (i = 0; i < state->nb_jobs; i++) {
+		job = &state->jobs[i];
+		if (pthread_create(&thread, NULL, auto_probe_job, job))
+			auto_probe_job(job);
+		else
+			pthread_detach(thread);
+	}
+
+	pthread_mutex_lock(&state->lock);
+	while ((state->winner = auto_pick(state)) == AUTO_UNDECIDED)
+		pthread_cond_wait(&state->cond, &state->lock);
+	for (i = 0; i < state->nb_jobs; i++) {
+		job = &state->jobs[i];
+		if (i == state->winner) {
+			*found = job->programmer;
+			*data = job->data;
+			ret = 0;
+		} else if (job->done && !job->ret &&
+			   job->programmer->shutdown) {
+			job->programmer->shutdown(job->data);
+		}
+	}
+	pthread_mutex_unlock(&state->lock);
+	auto_pending = state;
+	if (ret)
+		auto_drain();
+	return ret;
+}
+
+/*
+ * The programmer which succeeded last time with the same arguments is probed
+ * alone first. The USB devices are enumerated once, and the programmers whose
+ * device is missing are not probed at all. The enumeration is kept until the
+ * last probe is over.
+ */
+static int auto_probe(const char *programmer_args, void **data)
+{
+	struct programmer *programmer, *found = NULL;
 	struct list_head head;
-	int ret;
+	char last[64];
+	int ret = -ENODEV;
 
+	auto_drain();
+	usb_scan();
+	usb_scan_freeze(1);
+	if (cache_get_string(AUTO_CACHE, programmer_args, last, sizeof(last)))
+		last[0] = '\0';
 	for_each_programmer(programmer) {
-		pr_dbg("Probing programmer %s\n", programmer->name);
-		if (programmer->probe == auto_probe)
+		if (!last[0] || strcmp(programmer->name, last) ||
+		    programmer->probe == auto_probe ||
+		    auto_device_missing(programmer))
 			continue;
+		pr_dbg("Probing programmer %s, found last time\n", last);
 		ret = programmer->probe(programmer_args, data);
-		if (!ret) {
-			head = automatic.list;
-			automatic = *programmer;
-			automatic.list = head;
-			return 0;
-		}
+		if (!ret)
+			found = programmer;
 	}
+	if (!found)
+		ret = auto_probe_all(programmer_args, last[0] ? last : NULL,
+				     &found, data);
+	if (!auto_pending)
+		usb_scan_freeze(0);
+	if (ret)
+		return -ENODEV;
 
-	return -ENODEV;
+	pr_info("Found programmer %s\n", found->name);
+	if (strcmp(found->name, last))
+		cache_set_string(AUTO_CACHE, programmer_args, found->name);
+	head = automatic.list;
+	automatic = *found;
+	automatic.name = "automatic";
+	automatic.probe = auto_probe;
+	automatic.shutdown = auto_shutdown;
+	automatic.list = head;
+	auto_found_shutdown = found->shutdown;
+	return 0;
 }
 
 static struct programmer automatic = {
 	.buses_supported = 0,
 	.probe = auto_probe,
-	.desc = "probes each programmer until one is found",
+	.desc = "probes all programmers at once, and picks the first found",
 };
 
 DECLARE_PROGRAMMER(automatic);
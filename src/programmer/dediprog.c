@@ -18,28 +18,29 @@
 #define DEBUG_MODULE "dediprog"
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <buffer_pool.h>
+#include <cache.h>
 #include <chip.h>
 #include <debug.h>
+#include <dediprog_sim.h>
 #include <programmer.h>
 #include <spi_nor.h>
 #include <spi_programmer.h>
 #include <usb_util.h>
 
-#if IS_WINDOWS
-#include <lusb0_usb.h>
-#else
-#include <usb.h>
-#endif
-
 #define DEDI_SPI_CMD_PAGESWRITE	0x1
 #define DEDI_SPI_CMD_PAGESREAD	0x2
 #define DEDI_SPI_CMD_AAIWRITE	0x4
 
 #define FIRMWARE_VERSION(x,y,z) ((x << 16) | (y << 8) | z)
 #define DEFAULT_TIMEOUT 3000
+#define DEDIPROG_USB_VID 0x0483
+#define DEDIPROG_USB_PID 0xdada
 
 struct dediprog_data;
 struct dediprog_data {
@@ -47,7 +48,12 @@ struct dediprog_data {
 	int dediprog_firmwareversion;
 	int millivolts;
 	int speed_hz;
+	int auto_speed;
+	long usedevice;
+	size_t bulk_size;
+	struct usb_buffer bulk;
 	int chip_select;
+	int sim;
 	int (*set_leds)(struct dediprog_data *ddata, int led);
 	int (*send_command)(struct dediprog_data *ddata, unsigned int writecnt,
 			    unsigned int readcnt, const unsigned char *writearr,
@@ -276,65 +282,88 @@ static int dediprog_prep_multi_cmd(struct dediprog_data *ddata, int nb_pages,
 }
 
 #define DEDIPROG_MIN_ALIGN 512
+#define DEDIPROG_DEFAULT_BULK (16 * 1024)
+#define DEDIPROG_MAX_BULK (64 * 1024)
+
+/*
+ * The dediprog transfers one chip page per DEDIPROG_MIN_ALIGN bytes frame.
+ * Several frames are grouped in a single bulk transfer, up to bulk_size bytes,
+ * to lower the number of USB round trips.
+ */
+static int dediprog_frames_per_bulk(struct dediprog_data *ddata)
+{
+	return ddata->bulk_size / DEDIPROG_MIN_ALIGN;
+}
+
 /**
  * do_dediprog_spi_read_pages - read several pages from the chip
- * @ddata: the dediprog internal data
+ * @ctxt: the context of the dediprog
  * @buf: the buffer to read the chip into
  * @start: the address on the chip where to begin the read
  * @len: the length to read
  * @page_size: the number of bytes in one chip page
  *
- * Reads bytes from the NOR chip. Because the dediprog stores one page per bulk
- * transfer, each bulk transfer has the following constraints :
- *  - page_size < 512 (the usb bulk endpoint size)
- *  - in a 512 bytes transfer, only page_size are usefull, the remaining is filled with 0xff
+ * Reads bytes from the NOR chip. Because the dediprog stores one page per
+ * frame, each frame has the following constraints :
+ *  - page_size <= 512 (the usb bulk endpoint size)
+ *  - in a 512 bytes frame, only page_size are usefull, the remaining is filled
+ *    with 0xff
  *
- * If start or (start + len) is not on a page boundary, the residue is read into
- * a temporary buffer before being copied back to buf, which implies a
- * performance loss.
+ * The frames are read into the bulk buffer, and their pages copied into buf.
+ * When the bulk buffer is plain memory, and the frames are whole 512 bytes
+ * pages from a page boundary, they are read into buf instead.
  *
  * Returns the number of bytes read, or < 0 if an error occurred.
  */
-static int do_dediprog_spi_read_pages(struct dediprog_data *ddata,
+static int do_dediprog_spi_read_pages(struct context *ctxt,
 				      unsigned char *buf,  off_t start,
 				      size_t len, size_t pagesize)
 {
-	unsigned char tmp_buf[DEDIPROG_MIN_ALIGN];
-	int i, ret, nb_pages, skip_first;
-	int first_page_bytes, nb_middle_pages, last_page_bytes;
+	struct dediprog_data *ddata = ctxt->programmer_data;
+	unsigned char *tmp_buf = ddata->bulk.data, *dst;
+	int i, ret, nb_pages, nb_frames, skip, count, direct;
+	size_t done = 0;
 
 	if (start % DEDIPROG_MIN_ALIGN)
 		return -EINVAL;
-	skip_first = start % pagesize;
-	first_page_bytes = (pagesize - skip_first) % pagesize;
-	last_page_bytes = (len - skip_first) % pagesize;
-	nb_middle_pages = (len - first_page_bytes - last_page_bytes) / pagesize;
-
-	nb_pages = nb_middle_pages + (first_page_bytes ? 1 : 0) +
-		(last_page_bytes ? 1 : 0);
+	skip = start % pagesize;
+	nb_pages = (skip + len + pagesize - 1) / pagesize;
 	ret = dediprog_prep_multi_cmd(ddata, nb_pages,
 				      (start / pagesize) * pagesize,
 				      pagesize, DEDI_SPI_CMD_PAGESREAD);
 
-	memset(tmp_buf, 0xff, sizeof(tmp_buf));
-	if (ret >= 0 && first_page_bytes) {
-		ret = do_usb_bulk_read(ddata->dediprog_handle, 2,
-				       tmp_buf, DEDIPROG_MIN_ALIGN,
+	while (ret >= 0 && nb_pages > 0) {
+		nb_frames = dediprog_frames_per_bulk(ddata);
+		if (nb_frames > nb_pages)
+			nb_frames = nb_pages;
+		count = nb_frames * pagesize - skip;
+		if (count > len - done)
+			count = len - done;
+		direct = !ddata->bulk.dma && pagesize == DEDIPROG_MIN_ALIGN &&
+			!skip && count == nb_frames * DEDIPROG_MIN_ALIGN;
+		dst = direct ? buf + done : tmp_buf;
+
+		ret = do_usb_bulk_read(ddata->dediprog_handle, 2, dst,
+				       nb_frames * DEDIPROG_MIN_ALIGN,
 				       DEFAULT_TIMEOUT);
-		memcpy(buf, tmp_buf + skip_first, first_page_bytes);
-		buf += first_page_bytes;
-	}
-	ret = DEDIPROG_MIN_ALIGN;
-	for (i = 0; ret >= DEDIPROG_MIN_ALIGN && i < nb_middle_pages; i++) {
-		ret = do_usb_bulk_read(ddata->dediprog_handle, 2, buf,
-				       DEDIPROG_MIN_ALIGN, DEFAULT_TIMEOUT);
-		buf += pagesize;
-	}
-	if (ret >= DEDIPROG_MIN_ALIGN && last_page_bytes) {
-		ret = do_usb_bulk_read(ddata->dediprog_handle, 2, tmp_buf,
-				       DEDIPROG_MIN_ALIGN, DEFAULT_TIMEOUT);
-		memcpy(buf, tmp_buf, last_page_bytes);
-		buf += last_page_bytes;
+		if (ret != nb_frames * DEDIPROG_MIN_ALIGN) {
+			ret = ret < 0 ? ret : -EIO;
+			break;
+		}
+		for (i = 0; !direct && i < nb_frames; i++) {
+			int from = i ? 0 : skip;
+			int n = pagesize - from;
+
+			if (n > len - done)
+				n = len - done;
+			memcpy(buf + done, tmp_buf + i * DEDIPROG_MIN_ALIGN + from,
+			       n);
+			done += n;
+		}
+		if (direct)
+			done += count;
+		nb_pages -= nb_frames;
+		skip = 0;
 	}
 
 	if (ret < 0)
@@ -345,69 +374,72 @@ static int do_dediprog_spi_read_pages(struct dediprog_data *ddata,
 
 /**
  * do_dediprog_spi_write_pages - write several pages to the chip
- * @ddata: the dediprog internal data
- * @buf: the buffer to read the chip into
- * @start: the address on the chip where to begin the read
- * @len: the length to read
+ * @ctxt: the context of the dediprog
+ * @buf: the buffer to write into the chip
+ * @start: the address on the chip where to begin the write
+ * @len: the length to write
  * @page_size: the number of bytes in one chip page
+ * @spi_cmd: DEDI_SPI_CMD_PAGESWRITE, or DEDI_SPI_CMD_AAIWRITE for AAI chips
  *
- * Write bytes from the NOR chip. Because the dediprog stores one page per bulk
- * transfer, each bulk transfer has the following constraints :
- *  - page_size < 512 (the usb bulk endpoint size)
- *  - in a 512 bytes transfer, only page_size are usefull, the remaining is filled with 0xff
+ * Write bytes to the NOR chip. Because the dediprog programs one page per
+ * frame, each frame has the following constraints :
+ *  - page_size <= 512 (the usb bulk endpoint size)
+ *  - in a 512 bytes frame, only page_size are usefull, the remaining is filled
+ *    with 0xff
+ * The known firmwares don't accept several pages in one frame, so pages are
+ * padded into frames, and frames are grouped into bulk transfers.
  *
  * If start or (start + len) is not on a page boundary, the residue is filled
- * with 0xff and written as a whole page.
+ * with 0xff and written as a whole page. This holds for AAI writes too, as
+ * the dediprog programs each page with AAI words from the page start. Each
+ * byte of a frame is filled once, either with data or with 0xff padding.
  *
  * Returns the number of bytes written, or < 0 if an error occurred.
  */
-static int do_dediprog_spi_write_pages(struct dediprog_data *ddata,
+static int do_dediprog_spi_write_pages(struct context *ctxt,
 				       const unsigned char *buf,  off_t start,
-				       size_t len, size_t pagesize)
+				       size_t len, size_t pagesize,
+				       unsigned char spi_cmd)
 {
-	unsigned char tmp_buf[DEDIPROG_MIN_ALIGN];
-	int i, ret, nb_pages, skip_first;
-	int first_page_bytes, nb_middle_pages, last_page_bytes;
-
-	if (start % DEDIPROG_MIN_ALIGN)
-		return -EINVAL;
-	skip_first = start % pagesize;
-	first_page_bytes = (pagesize - skip_first) % pagesize;
-	last_page_bytes = (len - skip_first) % pagesize;
-	nb_middle_pages = (len - first_page_bytes - last_page_bytes) / pagesize;
+	struct dediprog_data *ddata = ctxt->programmer_data;
+	unsigned char *tmp_buf = ddata->bulk.data, *frame;
+	int i, ret, nb_pages, nb_frames, skip, n;
+	size_t done = 0;
 
-	nb_pages = nb_middle_pages + (first_page_bytes ? 1 : 0) +
-		(last_page_bytes ? 1 : 0);
+	skip = start % pagesize;
+	nb_pages = (skip + len + pagesize - 1) / pagesize;
 	ret = dediprog_prep_multi_cmd(ddata, nb_pages,
 				      (start / pagesize) * pagesize,
-				      pagesize, DEDI_SPI_CMD_PAGESWRITE);
-
-	memset(tmp_buf, 0xff, sizeof(tmp_buf));
-	if (ret >= 0 && first_page_bytes) {
-		memset(tmp_buf, 0xff, sizeof(tmp_buf));
-		memcpy(tmp_buf + skip_first, buf, first_page_bytes);
-		ret = do_usb_bulk_write(ddata->dediprog_handle, 2,
-				       tmp_buf, DEDIPROG_MIN_ALIGN,
-				       DEFAULT_TIMEOUT);
-		buf += first_page_bytes;
-	}
-	memset(tmp_buf, 0xff, sizeof(tmp_buf));
-	ret = DEDIPROG_MIN_ALIGN;
-	for (i = 0; ret >= DEDIPROG_MIN_ALIGN && i < nb_middle_pages; i++) {
-		memcpy(tmp_buf, buf, pagesize);
+				      pagesize, spi_cmd);
+
+	while (ret >= 0 && nb_pages > 0) {
+		nb_frames = dediprog_frames_per_bulk(ddata);
+		if (nb_frames > nb_pages)
+			nb_frames = nb_pages;
+		for (i = 0; i < nb_frames; i++) {
+			frame = tmp_buf + i * DEDIPROG_MIN_ALIGN;
+			n = pagesize - skip;
+			if (n > len - done)
+				n = len - done;
+			memset(frame, 0xff, skip);
+			memcpy(frame + skip, buf + done, n);
+			memset(frame + skip + n, 0xff,
+			       DEDIPROG_MIN_ALIGN - skip - n);
+			done += n;
+			skip = 0;
+		}
+
 		ret = do_usb_bulk_write(ddata->dediprog_handle, 2, tmp_buf,
-				       DEDIPROG_MIN_ALIGN, DEFAULT_TIMEOUT);
-		buf += pagesize;
-	}
-	memset(tmp_buf, 0xff, sizeof(tmp_buf));
-	if (ret >= DEDIPROG_MIN_ALIGN && last_page_bytes) {
-		memcpy(tmp_buf, buf, last_page_bytes);
-		ret = do_usb_bulk_read(ddata->dediprog_handle, 2, tmp_buf,
-				       DEDIPROG_MIN_ALIGN, DEFAULT_TIMEOUT);
-		buf += last_page_bytes;
+					nb_frames * DEDIPROG_MIN_ALIGN,
+					DEFAULT_TIMEOUT);
+		if (ret != nb_frames * DEDIPROG_MIN_ALIGN) {
+			ret = ret < 0 ? ret : -EIO;
+			break;
+		}
+		nb_pages -= nb_frames;
 	}
 
-	if (ret < DEDIPROG_MIN_ALIGN)
+	if (ret < 0)
 		return ret;
 	else
 		return len;
@@ -422,7 +454,7 @@ static int dediprog_spi_read(struct context *ctxt, unsigned char *buf,
 	pr_dbg("read dediprog(buf=%p, start=%u, len=%zu)\n", buf, start, len);
 	dediprog_set_leds(ddata, PASS_OFF|BUSY_ON|ERROR_OFF);
 
-	ret = do_dediprog_spi_read_pages(ddata, buf, start, len,
+	ret = do_dediprog_spi_read_pages(ctxt, buf, start, len,
 					 DEDIPROG_MIN_ALIGN);
 	if (ret < (int)len) {
 		dediprog_set_leds(ddata, PASS_OFF|BUSY_OFF|ERROR_ON);
@@ -435,8 +467,9 @@ static int dediprog_spi_read(struct context *ctxt, unsigned char *buf,
 	return ret;
 }
 
-static int dediprog_spi_write(struct context *ctxt, const unsigned char *buf,
-			      off_t start, size_t len)
+static int dediprog_spi_bulk_write(struct context *ctxt,
+				   const unsigned char *buf, off_t start,
+				   size_t len, unsigned char spi_cmd)
 {
 	int ret, timeout = 10;
 	struct dediprog_data *ddata = ctxt->programmer_data;
@@ -444,8 +477,8 @@ static int dediprog_spi_write(struct context *ctxt, const unsigned char *buf,
 	pr_dbg("write dediprog(buf=%p, start=%u, len=%zu)\n", buf, start, len);
 	dediprog_set_leds(ddata, PASS_OFF|BUSY_ON|ERROR_OFF);
 
-	ret = do_dediprog_spi_write_pages(ddata, buf, start, len,
-					  ctxt->chip->page_size);
+	ret = do_dediprog_spi_write_pages(ctxt, buf, start, len,
+					  ctxt->chip->page_size, spi_cmd);
 	while (ret > (int)len && timeout-- &&
 	       spi_read_status_register(ctxt) & SPI_SR_WIP)
 		programmer_delay(10);
@@ -461,6 +494,22 @@ static int dediprog_spi_write(struct context *ctxt, const unsigned char *buf,
 	return ret;
 }
 
+static int dediprog_spi_write(struct context *ctxt, const unsigned char *buf,
+			      off_t start, size_t len)
+{
+	return dediprog_spi_bulk_write(ctxt, buf, start, len,
+				       DEDI_SPI_CMD_PAGESWRITE);
+}
+
+/* The AAI words are sent by the dediprog, not one SPI command each. */
+static int dediprog_spi_write_aai(struct context *ctxt,
+				  const unsigned char *buf, off_t start,
+				  size_t len)
+{
+	return dediprog_spi_bulk_write(ctxt, buf, start, len,
+				       DEDI_SPI_CMD_AAIWRITE);
+}
+
 static int dediprog_spi_speed_value(int speed)
 {
 	struct dediprog_spispeed *sp;
@@ -706,10 +755,254 @@ static int dediprog_setup(struct dediprog_data *ddata)
 	return 0;
 }
 
+/*
+ * SPI clock tuning : a sample of the chip is read at the slowest clock as a
+ * reference, then at each clock from the fastest one down. The first clock for
+ * which all the reads match the reference is kept.
+ */
+#define DEDIPROG_TUNE_SAMPLE	(16 * 1024)
+#define DEDIPROG_TUNE_READS	3
+#define DEDIPROG_TUNE_REF_HZ	(375 * kHz)
+#define DEDIPROG_SPEEDS_CACHE	"dediprog-speeds"
+
+static int dediprog_change_spi_speed(struct dediprog_data *ddata, int spi_hz)
+{
+	if (dediprog_set_spi_speed(ddata, spi_hz) || dediprog_setup(ddata))
+		return -ENXIO;
+	ddata->speed_hz = spi_hz;
+	return 0;
+}
+
+static int dediprog_next_spi_speed(int below_hz)
+{
+	struct dediprog_spispeed *sp;
+	int best = -1;
+
+	for (sp = &spi_speeds[0]; sp->speed_hz >= 0; sp++)
+		if (sp->speed_hz < below_hz && sp->speed_hz > best)
+			best = sp->speed_hz;
+	return best;
+}
+
+static int dediprog_sample_stable(struct context *ctx,
+				  const unsigned char *ref, unsigned char *tmp,
+				  size_t len)
+{
+	int i, ret;
+
+	for (i = 0; i < DEDIPROG_TUNE_READS; i++) {
+		ret = do_dediprog_spi_read_pages(ctx, tmp, 0, len,
+						 DEDIPROG_MIN_ALIGN);
+		if (ret < (int)len || memcmp(ref, tmp, len))
+			return 0;
+	}
+	return 1;
+}
+
+static int dediprog_tune_spi_speed(struct context *ctx, size_t len)
+{
+	struct dediprog_data *ddata = ctx->programmer_data;
+	unsigned char *ref, *tmp;
+	int hz, ret, i;
+
+	ref = buffer_get(&ctx->buffers, len);
+	tmp = buffer_get(&ctx->buffers, len);
+	ret = -ENOMEM;
+	if (!ref || !tmp)
+		goto out;
+
+	ret = dediprog_change_spi_speed(ddata, DEDIPROG_TUNE_REF_HZ);
+	if (!ret)
+		ret = do_dediprog_spi_read_pages(ctx, ref, 0, len,
+						 DEDIPROG_MIN_ALIGN);
+	if (ret < (int)len) {
+		pr_err("Couldn't read the reference sample\n");
+		ret = ret < 0 ? ret : -EIO;
+		goto out;
+	}
+	if (!dediprog_sample_stable(ctx, ref, tmp, len)) {
+		pr_err("Reads are not stable at %d Hz, check the wiring\n",
+		       DEDIPROG_TUNE_REF_HZ);
+		ret = -EIO;
+		goto out;
+	}
+	for (i = 0; i < len && ref[i] == 0xff; i++)
+		;
+	if (i == len)
+		pr_warn("Tuning SPI speed on a blank area, the result is less reliable\n");
+
+	for (hz = dediprog_next_spi_speed(INT_MAX); hz > DEDIPROG_TUNE_REF_HZ;
+	     hz = dediprog_next_spi_speed(hz)) {
+		ret = dediprog_change_spi_speed(ddata, hz);
+		if (ret)
+			goto out;
+		if (dediprog_sample_stable(ctx, ref, tmp, len))
+			break;
+		pr_info("SPI speed %d Hz is not reliable\n", hz);
+	}
+	if (hz <= DEDIPROG_TUNE_REF_HZ) {
+		hz = DEDIPROG_TUNE_REF_HZ;
+		ret = dediprog_change_spi_speed(ddata, hz);
+		if (ret)
+			goto out;
+	}
+	ret = hz;
+out:
+	buffer_put(&ctx->buffers, tmp);
+	buffer_put(&ctx->buffers, ref);
+	return ret;
+}
+
+static int dediprog_chip_setup(struct context *ctx)
+{
+	struct dediprog_data *ddata = ctx->programmer_data;
+	struct flashchip *chip = ctx->chip;
+	size_t len = DEDIPROG_TUNE_SAMPLE;
+	char key[80];
+	long hz;
+	int ret;
+
+	if (!ddata->auto_speed)
+		return 0;
+	if (ddata->dediprog_firmwareversion < FIRMWARE_VERSION(5, 0, 0)) {
+		pr_warn("Skipping SPI speed tuning because firmware is too old.\n");
+		return 0;
+	}
+
+	/* The signal integrity depends on the device, the chip and the voltage */
+	snprintf(key, sizeof(key), "sf100-%ld-t%d-fw%06x-%dmV-%08x:%08x",
+		 ddata->usedevice, ddata->chip_select + 1,
+		 ddata->dediprog_firmwareversion, ddata->millivolts,
+		 chip->manufacture_id, chip->model_id);
+	if (!cache_get_value(DEDIPROG_SPEEDS_CACHE, key, &hz) &&
+	    dediprog_spi_speed_value(hz) >= 0) {
+		pr_info("Using SPI speed %ld Hz found in cache\n", hz);
+		return dediprog_change_spi_speed(ddata, hz);
+	}
+
+	if (len > chip->total_size_kb * 1024)
+		len = chip->total_size_kb * 1024;
+	dediprog_set_leds(ddata, PASS_OFF|BUSY_ON|ERROR_OFF);
+	ret = dediprog_tune_spi_speed(ctx, len);
+	if (ret < 0) {
+		dediprog_set_leds(ddata, PASS_OFF|BUSY_OFF|ERROR_ON);
+		return ret;
+	}
+	dediprog_set_leds(ddata, PASS_OFF|BUSY_OFF|ERROR_OFF);
+
+	pr_info("Tuned SPI speed to %d Hz\n", ret);
+	if (cache_set_value(DEDIPROG_SPEEDS_CACHE, key, ret))
+		pr_warn("Couldn't store the tuned SPI speed in cache\n");
+	return 0;
+}
+
+/*
+ * The other target is probed at the speed it was probed at, as the tuning is
+ * done for each chip.
+ */
+static int dediprog_select_target(struct context *ctx, int target)
+{
+	struct dediprog_data *ddata = ctx->programmer_data;
+
+	if (target < 1 || target > 2) {
+		pr_err("Sorry, target must be 1 or 2\n");
+		return -EINVAL;
+	}
+	ddata->chip_select = target - 1;
+	if (ddata->auto_speed)
+		return dediprog_change_spi_speed(ddata, DEDIPROG_TUNE_REF_HZ);
+	return dediprog_chip_select(ddata) ? -ENXIO : 0;
+}
+
+static int dediprog_parse_bulk_size(const char *programmer_args,
+				    size_t *bulk_size)
+{
+	char *s, *suffix;
+	long size;
+
+	s = extract_programmer_param(programmer_args, "bulk");
+	if (!s)
+		return 0;
+	size = strtol(s, &suffix, 10);
+	if (!strcasecmp(suffix, "k"))
+		size *= 1024;
+	else if (*suffix)
+		size = -1;
+	free(s);
+
+	if (size < DEDIPROG_MIN_ALIGN || size > DEDIPROG_MAX_BULK ||
+	    size % DEDIPROG_MIN_ALIGN) {
+		pr_err("Sorry, bulk size must be a multiple of %d up to %d bytes\n",
+		       DEDIPROG_MIN_ALIGN, DEDIPROG_MAX_BULK);
+		return -EINVAL;
+	}
+	*bulk_size = size;
+	return 0;
+}
+
+static int dediprog_open_usb(struct dediprog_data *ddata)
+{
+	libusb_device *dev;
+
+	usb_scan();
+	dev = get_device_by_vid_pid(DEDIPROG_USB_VID, DEDIPROG_USB_PID,
+				    (unsigned int) ddata->usedevice);
+	if (!dev) {
+		pr_err("Could not find a Dediprog SF100 on USB!\n");
+		return 1;
+	}
+	pr_dbg("Found USB device (%04x:%04x).\n",
+		 DEDIPROG_USB_VID, DEDIPROG_USB_PID);
+	ddata->dediprog_handle = usb_open_device(dev, 1, 0);
+	if (!ddata->dediprog_handle)
+		return -ENODEV;
+
+	return 0;
+}
+
+/*
+ * The simulated SF100 carries the USB transfers of this driver in-process, for
+ * benchmarking and testing without the device.
+ */
+static int dediprog_open_sim(struct dediprog_data *ddata,
+			     const char *programmer_args)
+{
+	char *image1, *image2, *fw, *latency;
+	unsigned int latency_us = 0;
+
+	image1 = extract_programmer_param(programmer_args, "sim");
+	image2 = extract_programmer_param(programmer_args, "sim2");
+	fw = extract_programmer_param(programmer_args, "fw");
+	latency = extract_programmer_param(programmer_args, "latency");
+	if (latency)
+		latency_us = strtoul(latency, NULL, 0);
+
+	ddata->dediprog_handle = sf100_sim_open(image1, image2,
+						fw ? fw : "6.0.0", latency_us);
+	free(image1);
+	free(image2);
+	free(fw);
+	free(latency);
+	if (!ddata->dediprog_handle) {
+		pr_err("Could not plug the simulated SF100\n");
+		return -ENODEV;
+	}
+	pr_info("Using a simulated SF100\n");
+	return 0;
+}
+
+/* The simulated SF100 gives the USB transfers of its handle back to libusb */
+static void dediprog_close(struct dediprog_data *ddata)
+{
+	if (ddata->sim)
+		sf100_sim_close(ddata->dediprog_handle);
+	else
+		usb_close_device(ddata->dediprog_handle, 0);
+}
+
 int dediprog_probe(const char *programmer_args, void **data)
 {
-	struct usb_device *dev;
-	char *device;
+	char *device, *target, *sim;
 	long usedevice = 0;
 	int ret;
 	struct dediprog_data *ddata;
@@ -720,18 +1013,26 @@ int dediprog_probe(const char *programmer_args, void **data)
 	ddata->speed_hz = 12 * MHz;
 	ddata->millivolts = 3500;
 	ddata->chip_select = 0;
+	ddata->bulk_size = DEDIPROG_DEFAULT_BULK;
+	ret = -EINVAL;
+	if (dediprog_parse_bulk_size(programmer_args, &ddata->bulk_size))
+		goto err_free;
 
 	spi_programmer_extract_params(programmer_args, &ddata->speed_hz,
 				  &ddata->millivolts);
+	/* Probe the chip at the safest speed, it will be tuned afterwards */
+	ddata->auto_speed = ddata->speed_hz == SPI_HZ_AUTO;
+	if (ddata->auto_speed)
+		ddata->speed_hz = DEDIPROG_TUNE_REF_HZ;
 	if (dediprog_spi_speed_value(ddata->speed_hz) < 0) {
 		pr_err("Sorry, requested spi speed %d Hz not possible, aborting ...\n",
 		       ddata->speed_hz);
-		return -EINVAL;
+		goto err_free;
 	}
 	if (dediprog_spi_voltage_value(ddata->millivolts) < 0) {
 		pr_err("Sorry, requested spi voltage %dmv not possible, aborting ...\n",
 		       ddata->millivolts);
-		return -EINVAL;
+		goto err_free;
 	}
 
 	device = extract_programmer_param(programmer_args, "device");
@@ -742,58 +1043,52 @@ int dediprog_probe(const char *programmer_args, void **data)
 		if (errno != 0 || device == dev_suffix) {
 			pr_err("Error: Could not convert 'device'.\n");
 			free(device);
-			return -EINVAL;
+			goto err_free;
 		}
 		if (usedevice < 0 || usedevice > UINT_MAX) {
 			pr_err("Error: Value for 'device' is out of range.\n");
 			free(device);
-			return -EINVAL;
+			goto err_free;
 		}
 		if (strlen(dev_suffix) > 0) {
 			pr_err("Error: Garbage following 'device' value.\n");
 			free(device);
-			return -EINVAL;
+			goto err_free;
 		}
 		pr_info("Using device %li.\n", usedevice);
 	}
 	free(device);
-
-	/* Here comes the USB stuff. */
-	usb_init();
-	usb_find_busses();
-	usb_find_devices();
-	dev = get_device_by_vid_pid(0x0483, 0xdada, (unsigned int) usedevice);
-	if (!dev) {
-		pr_err("Could not find a Dediprog SF100 on USB!\n");
-		return 1;
-	}
-	pr_dbg("Found USB device (%04x:%04x).\n",
-		 dev->descriptor.idVendor, dev->descriptor.idProduct);
-	ddata->dediprog_handle = usb_open(dev);
-	if (!ddata->dediprog_handle) {
-		pr_err("Could not open USB device: %s\n", usb_strerror());
-		return -ENODEV;
-	}
-	ret = usb_set_configuration(ddata->dediprog_handle, 1);
-	if (ret < 0) {
-		pr_err("Could not set USB device configuration: %i %s\n",
-		       ret, usb_strerror());
-		if (usb_close(ddata->dediprog_handle))
-			pr_err("Could not close USB device!\n");
-		return -ENODEV;
-	}
-	ret = usb_claim_interface(ddata->dediprog_handle, 0);
-	if (ret < 0) {
-		pr_err("Could not claim USB device interface %i: %i %s\n",
-		       0, ret, usb_strerror());
-		if (usb_close(ddata->dediprog_handle))
-			pr_err("Could not close USB device!\n");
-		return -ENODEV;
+	ddata->usedevice = usedevice;
+
+	target = extract_programmer_param(programmer_args, "target");
+	if (target) {
+		if (strcmp(target, "1") && strcmp(target, "2")) {
+			pr_err("Error: Value for 'target' must be 1 or 2.\n");
+			free(target);
+			goto err_free;
+		}
+		ddata->chip_select = atoi(target) - 1;
+		free(target);
 	}
 
+	sim = extract_programmer_param(programmer_args, "sim");
+	ddata->sim = sim != NULL;
+	free(sim);
+	if (ddata->sim)
+		ret = dediprog_open_sim(ddata, programmer_args);
+	else
+		ret = dediprog_open_usb(ddata);
+	if (ret)
+		goto err_free;
+	ret = -ENOMEM;
+	if (usb_buffer_alloc(ddata->dediprog_handle, &ddata->bulk,
+			     ddata->bulk_size))
+		goto err_close;
+
 	/* Perform basic setup. */
+	ret = -ENXIO;
 	if (dediprog_setup(ddata))
-		return -ENXIO;
+		goto err_buffer;
 
 	dediprog_set_leds(ddata, PASS_ON|BUSY_ON|ERROR_ON);
 
@@ -802,18 +1097,26 @@ int dediprog_probe(const char *programmer_args, void **data)
 	    dediprog_set_spi_speed(ddata, ddata->speed_hz) ||
 	    dediprog_setup(ddata)) {
 		dediprog_set_leds(ddata, PASS_OFF|BUSY_OFF|ERROR_ON);
-		return -ENXIO;
+		goto err_buffer;
 	}
 
 	if (dediprog_set_spi_voltage(ddata, ddata->millivolts)) {
 		dediprog_set_leds(ddata, PASS_OFF|BUSY_OFF|ERROR_ON);
-		return -ENXIO;
+		goto err_buffer;
 	}
 
 	dediprog_set_leds(ddata, PASS_OFF|BUSY_OFF|ERROR_OFF);
 	*data = ddata;
 
 	return 0;
+
+err_buffer:
+	usb_buffer_free(ddata->dediprog_handle, &ddata->bulk);
+err_close:
+	dediprog_close(ddata);
+err_free:
+	free(ddata);
+	return ret;
 }
 
 static void dediprog_shutdown(void *d)
@@ -821,6 +1124,9 @@ static void dediprog_shutdown(void *d)
 	struct dediprog_data *ddata = d;
 
 	dediprog_set_spi_voltage(ddata, 0);
+	usb_buffer_free(ddata->dediprog_handle, &ddata->bulk);
+	dediprog_close(ddata);
+	free(ddata);
 }
 
 static struct programmer dediprog = {
@@ -832,10 +1138,15 @@ static struct programmer dediprog = {
 		.multicommand = default_spi_send_multicommand,
 		.read = dediprog_spi_read,
 		.write_256 = dediprog_spi_write,
+		.write_aai = dediprog_spi_write_aai,
 	},
 	.probe = dediprog_probe,
 	.shutdown = dediprog_shutdown,
-	.desc = "[voltage={1.8v,2.5v,3.5v}] [hz={12MHz,...}]",
+	.chip_setup = dediprog_chip_setup,
+	.select_target = dediprog_select_target,
+	.usb_vid = DEDIPROG_USB_VID,
+	.usb_pid = DEDIPROG_USB_PID,
+	.desc = "[voltage={1.8v,2.5v,3.5v}] [hz={12MHz,...,auto}] [bulk=16k] [sim=<image>[,sim2=<image>][,fw=6.0.0][,latency=<us>]]",
 };
 
 DECLARE_PROGRAMMER(dediprog);
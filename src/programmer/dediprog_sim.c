@@ -0,0 +1,299 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "dediprog-sim"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chip.h>
+#include <debug.h>
+#include <dediprog_sim.h>
+#include <flash_emulator.h>
+#include <spi_nor.h>
+#include <usb_util.h>
+
+#define SF100_FRAME		512
+#define SF100_MAX_CMD		16
+#define SF100_NB_TARGETS	2
+
+/* Vendor requests, as sent by the dediprog driver */
+#define SF100_REQ_SPI_CMD	0x01
+#define SF100_REQ_SELECT	0x04	/* Command A, and chip select */
+#define SF100_REQ_DEVSTR_PREP	0x07	/* Device string prepare, or LEDs */
+#define SF100_REQ_DEVSTR	0x08
+#define SF100_REQ_VOLTAGE	0x09
+#define SF100_REQ_COMMAND_A	0x0b
+#define SF100_REQ_READ		0x20
+#define SF100_REQ_WRITE		0x30
+#define SF100_REQ_SPEED		0x61
+
+struct sf100_sim {
+	struct flash_emulator emu[SF100_NB_TARGETS];
+	char *image[SF100_NB_TARGETS];
+	int target;
+	char devstr[17];
+	/* From 5.5.0 on, the SPI commands and the page transfers differ */
+	int fw6;
+	unsigned int latency_us;
+
+	int leds, voltage, speed;
+	unsigned char cmd[SF100_MAX_CMD];
+	unsigned int cmdlen;
+
+	/* The page transfer announced by the last read or write request */
+	int writing;
+	unsigned int nb_pages, pagesize;
+	off_t addr;
+
+	unsigned long nb_control, nb_bulk, nb_frames;
+};
+
+static void sf100_latency(struct sf100_sim *sf)
+{
+	if (sf->latency_us)
+		usleep(sf->latency_us);
+}
+
+/*
+ * An unpowered chip answers nothing, and ignores the commands.
+ */
+static void sf100_spi_command(struct sf100_sim *sf, unsigned int readcnt,
+			      unsigned char *readarr)
+{
+	memset(readarr, 0xff, readcnt);
+	if (!sf->voltage || !sf->cmdlen)
+		return;
+	flash_emulator_command(&sf->emu[sf->target], sf->cmdlen, readcnt,
+			       sf->cmd, readarr);
+}
+
+static int sf100_prep_pages(struct sf100_sim *sf, int request, int value,
+			    int idx, const unsigned char *buf, size_t size)
+{
+	if (size < 4 || (sf->fw6 && size < 10))
+		return -EINVAL;
+	sf->writing = request == SF100_REQ_WRITE;
+	sf->nb_pages = buf[0] | buf[1] << 8;
+	if (sf->fw6) {
+		sf->pagesize = (buf[4] | buf[5] << 8) + 1;
+		sf->addr = (off_t)(buf[6] | buf[7] << 8 | buf[8] << 16 |
+				   (uint32_t)buf[9] << 24) * sf->pagesize;
+	} else {
+		sf->pagesize = sf->writing ? 256 : SF100_FRAME;
+		sf->addr = value + idx * 0x10000;
+	}
+	if (sf->pagesize > SF100_FRAME)
+		return -EINVAL;
+	return size;
+}
+
+static int sf100_control_msg(usb_dev_handle *dev, int requesttype,
+			     int request, int value, int idx,
+			     unsigned char *bytes, size_t size, int timeout)
+{
+	struct sf100_sim *sf = (struct sf100_sim *)dev;
+	int in = requesttype & USB_ENDPOINT_IN;
+
+	sf100_latency(sf);
+	sf->nb_control++;
+
+	switch (request) {
+	case SF100_REQ_SPI_CMD:
+		if (in) {
+			sf100_spi_command(sf, size, bytes);
+			return size;
+		}
+		if (size > SF100_MAX_CMD)
+			return -EINVAL;
+		memcpy(sf->cmd, bytes, size);
+		sf->cmdlen = size;
+		/* Without an answer to read, the command is run right away */
+		if (!(sf->fw6 ? value : idx))
+			sf100_spi_command(sf, 0, NULL);
+		return size;
+	case SF100_REQ_SELECT:
+		if (value & ~2)
+			return -EINVAL;
+		sf->target = value >> 1;
+		return 0;
+	case SF100_REQ_COMMAND_A:
+		if (!in || size < 1)
+			return -EINVAL;
+		bytes[0] = 0x6f;
+		return 1;
+	case SF100_REQ_DEVSTR_PREP:
+		if (!in) {
+			sf->leds = value >> 8 ? value >> 8 : idx;
+			return 0;
+		}
+		if (size < 1)
+			return -EINVAL;
+		bytes[0] = 0xff;
+		return 1;
+	case SF100_REQ_DEVSTR:
+		if (size > 16)
+			size = 16;
+		memcpy(bytes, sf->devstr, size);
+		return size;
+	case SF100_REQ_VOLTAGE:
+		sf->voltage = value;
+		return 0;
+	case SF100_REQ_SPEED:
+		sf->speed = value;
+		return 0;
+	case SF100_REQ_READ:
+	case SF100_REQ_WRITE:
+		return sf100_prep_pages(sf, request, value, idx, bytes, size);
+	default:
+		pr_err("Unknown request 0x%02x\n", request);
+		return -EINVAL;
+	}
+}
+
+/*
+ * Each frame carries one page, a bulk transfer several frames, within the
+ * pages announced by the last read or write request.
+ */
+static int sf100_bulk_check(struct sf100_sim *sf, size_t len, int writing)
+{
+	sf100_latency(sf);
+	sf->nb_bulk++;
+	if (sf->writing != writing || len % SF100_FRAME ||
+	    len / SF100_FRAME > sf->nb_pages)
+		return -EIO;
+	sf->nb_frames += len / SF100_FRAME;
+	return 0;
+}
+
+static int sf100_bulk_read(usb_dev_handle *dev, int endpoint,
+			   unsigned char *buf, size_t len, int timeout)
+{
+	struct sf100_sim *sf = (struct sf100_sim *)dev;
+	struct flash_emulator *emu = &sf->emu[sf->target];
+	size_t i;
+
+	if (sf100_bulk_check(sf, len, 0))
+		return -EIO;
+	memset(buf, 0xff, len);
+	for (i = 0; i < len; i += SF100_FRAME) {
+		if (sf->voltage)
+			flash_emulator_read(emu, buf + i, sf->addr,
+					    sf->pagesize);
+		sf->addr += sf->pagesize;
+		sf->nb_pages--;
+	}
+	return len;
+}
+
+static int sf100_bulk_write(usb_dev_handle *dev, int endpoint,
+			    unsigned char *buf, size_t len, int timeout)
+{
+	struct sf100_sim *sf = (struct sf100_sim *)dev;
+	struct flash_emulator *emu = &sf->emu[sf->target];
+	size_t i;
+
+	if (sf100_bulk_check(sf, len, 1))
+		return -EIO;
+	for (i = 0; i < len; i += SF100_FRAME) {
+		/* The firmware sends WREN itself, the protections still hold */
+		if (sf->voltage && !(emu->status & SPI_SR_BP_MASK))
+			flash_emulator_program(emu, buf + i, sf->addr,
+					       sf->pagesize);
+		sf->addr += sf->pagesize;
+		sf->nb_pages--;
+	}
+	return len;
+}
+
+static const struct usb_backend sf100_backend = {
+	.name = "simulated SF100",
+	.control_msg = sf100_control_msg,
+	.bulk_read = sf100_bulk_read,
+	.bulk_write = sf100_bulk_write,
+};
+
+static void sf100_free(struct sf100_sim *sf)
+{
+	int i;
+
+	for (i = 0; i < SF100_NB_TARGETS; i++) {
+		flash_emulator_release(&sf->emu[i]);
+		free(sf->image[i]);
+	}
+	free(sf);
+}
+
+usb_dev_handle *sf100_sim_open(const char *image1, const char *image2,
+			       const char *firmware, unsigned int latency_us)
+{
+	struct flash_emulator *emu1;
+	struct sf100_sim *sf;
+	int major, minor, ret;
+
+	sf = calloc(1, sizeof(*sf));
+	if (!sf)
+		return NULL;
+	if (sscanf(firmware, "%d.%d", &major, &minor) != 2) {
+		pr_err("Invalid firmware version %s\n", firmware);
+		free(sf);
+		return NULL;
+	}
+	snprintf(sf->devstr, sizeof(sf->devstr), "SF100 V:%-8s", firmware);
+	sf->fw6 = major > 5 || (major == 5 && minor >= 5);
+	sf->latency_us = latency_us;
+
+	emu1 = &sf->emu[0];
+	sf->image[0] = strdup(image1);
+	ret = sf->image[0] ? flash_emulator_load(emu1, image1) : -ENOMEM;
+	if (!ret && image2) {
+		sf->image[1] = strdup(image2);
+		ret = sf->image[1] ? flash_emulator_load(&sf->emu[1], image2) :
+			-ENOMEM;
+	} else if (!ret) {
+		ret = flash_emulator_init(&sf->emu[1], emu1->size,
+					  emu1->page_size, emu1->id[0],
+					  emu1->id[1] << 8 | emu1->id[2]);
+	}
+	if (!ret)
+		ret = usb_set_backend((usb_dev_handle *)sf, &sf100_backend);
+	if (ret) {
+		sf100_free(sf);
+		return NULL;
+	}
+	return (usb_dev_handle *)sf;
+}
+
+int sf100_sim_close(usb_dev_handle *dev)
+{
+	struct sf100_sim *sf = (struct sf100_sim *)dev;
+	int i, ret = 0;
+
+	usb_set_backend(dev, NULL);
+	pr_dbg("Left with leds 0x%x, voltage 0x%x, speed %d\n", sf->leds,
+	       sf->voltage, sf->speed);
+	pr_info("Simulated SF100: %lu control transfers, %lu bulk transfers of %lu frames\n",
+		sf->nb_control, sf->nb_bulk, sf->nb_frames);
+	for (i = 0; i < SF100_NB_TARGETS; i++)
+		if (sf->image[i] && flash_emulator_save(&sf->emu[i],
+							sf->image[i]))
+			ret = -EIO;
+	sf100_free(sf);
+	return ret;
+}
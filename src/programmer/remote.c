@@ -0,0 +1,499 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "remote"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <buffer_pool.h>
+#include <bus_spi.h>
+#include <chip.h>
+#include <debug.h>
+#include <programmer.h>
+#include <remote.h>
+#include <socket.h>
+#include <spi_programmer.h>
+
+/* Most requests sent and not answered yet */
+#define REMOTE_WINDOW		16
+
+struct remote_pending {
+	uint8_t type;
+	uint32_t seq;
+	unsigned char *dest;
+	uint32_t len;
+};
+
+struct remote_data {
+	int fd;
+	uint32_t seq;
+
+	/* The requests queued, and sent from out_pos on */
+	unsigned char *out;
+	size_t out_len, out_pos, out_size;
+	struct remote_pending pending[REMOTE_WINDOW];
+	unsigned int first_pending, nb_pending;
+	/* First error answered to the requests in flight */
+	int status;
+
+	/* The chip the server was told about */
+	const struct flashchip *chip;
+	/* The biggest transfers of the server programmer */
+	unsigned int max_data_read;
+	unsigned int max_data_write;
+};
+
+static void remote_disconnect(struct remote_data *rd, int err)
+{
+	pr_err("Lost connection to the remote programmer: %d\n", err);
+	close(rd->fd);
+	rd->fd = -1;
+}
+
+/*
+ * Read the answer of the oldest request in flight. The server writes whole
+ * answers, so once one is coming, it can be read without sending anything.
+ */
+static int remote_read_answer(struct remote_data *rd)
+{
+	struct remote_pending *p = &rd->pending[rd->first_pending];
+	struct remote_msg msg;
+	int32_t status;
+	uint32_t len;
+	int ret;
+
+	ret = read_full(rd->fd, &msg, sizeof(msg));
+	if (ret)
+		return ret;
+	status = ntohl(msg.status);
+	len = ntohl(msg.len);
+	if (msg.type != p->type || ntohl(msg.seq) != p->seq || len > p->len ||
+	    (!status && len != p->len))
+		return -EPROTO;
+	ret = read_full(rd->fd, p->dest, len);
+	if (ret)
+		return ret;
+
+	if (status && !rd->status)
+		rd->status = status;
+	rd->first_pending = (rd->first_pending + 1) % REMOTE_WINDOW;
+	rd->nb_pending--;
+	return 0;
+}
+
+/*
+ * Send the requests queued, reading the answers as they come, so that
+ * neither side is left blocked on a full socket.
+ */
+static int remote_flush(struct remote_data *rd)
+{
+	struct pollfd pfd = { .fd = rd->fd };
+	ssize_t n;
+	int ret;
+
+	while (rd->out_pos < rd->out_len) {
+		pfd.events = POLLOUT | (rd->nb_pending ? POLLIN : 0);
+		ret = poll(&pfd, 1, -1);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		if (pfd.revents & POLLIN) {
+			ret = remote_read_answer(rd);
+			if (ret)
+				return ret;
+		} else if (pfd.revents & (POLLERR | POLLHUP)) {
+			return -EPIPE;
+		}
+		if (!(pfd.revents & POLLOUT))
+			continue;
+		n = send(rd->fd, rd->out + rd->out_pos,
+			 rd->out_len - rd->out_pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0 && errno != EAGAIN && errno != EINTR)
+			return -errno;
+		if (n > 0)
+			rd->out_pos += n;
+	}
+	rd->out_len = rd->out_pos = 0;
+	return 0;
+}
+
+static int remote_complete_all(struct remote_data *rd)
+{
+	int ret;
+
+	if (rd->fd < 0)
+		return -ENOTCONN;
+	ret = remote_flush(rd);
+	while (!ret && rd->nb_pending)
+		ret = remote_read_answer(rd);
+	if (ret) {
+		remote_disconnect(rd, ret);
+		return ret;
+	}
+	ret = rd->status;
+	rd->status = 0;
+	return ret;
+}
+
+/*
+ * Queue a request of len bytes of payload, to be filled by the caller, its
+ * answer going to dest. Requests are sent without waiting for the previous
+ * answers, up to REMOTE_WINDOW of them.
+ */
+static unsigned char *remote_queue(struct remote_data *rd, uint8_t type,
+				   size_t len, void *dest, uint32_t destlen)
+{
+	struct remote_pending *p;
+	struct remote_msg msg;
+	unsigned char *out;
+	size_t size;
+	int ret = 0;
+
+	if (rd->fd < 0)
+		return NULL;
+	while (!ret && rd->nb_pending == REMOTE_WINDOW) {
+		ret = remote_flush(rd);
+		if (!ret)
+			ret = remote_read_answer(rd);
+	}
+	if (!ret && rd->out_len >= REMOTE_CHUNK)
+		ret = remote_flush(rd);
+	if (ret) {
+		remote_disconnect(rd, ret);
+		return NULL;
+	}
+
+	size = rd->out_len + sizeof(msg) + len;
+	if (size > rd->out_size) {
+		out = realloc(rd->out, size);
+		if (!out)
+			return NULL;
+		rd->out = out;
+		rd->out_size = size;
+	}
+	msg.type = type;
+	msg.seq = htonl(rd->seq);
+	msg.status = 0;
+	msg.len = htonl(len);
+	out = rd->out + rd->out_len;
+	memcpy(out, &msg, sizeof(msg));
+	rd->out_len = size;
+
+	p = &rd->pending[(rd->first_pending + rd->nb_pending) % REMOTE_WINDOW];
+	p->type = type;
+	p->seq = rd->seq++;
+	p->dest = dest;
+	p->len = destlen;
+	rd->nb_pending++;
+	return out + sizeof(msg);
+}
+
+static int remote_queue_range(struct remote_data *rd, uint8_t type,
+			      off_t start, size_t len, const uint8_t *data,
+			      uint8_t *dest)
+{
+	struct remote_range range;
+	unsigned char *p;
+
+	p = remote_queue(rd, type, sizeof(range) + (data ? len : 0), dest,
+			 dest ? len : 0);
+	if (!p)
+		return -EIO;
+	range.start = htonl(start);
+	range.len = htonl(len);
+	memcpy(p, &range, sizeof(range));
+	if (data)
+		memcpy(p + sizeof(range), data, len);
+	return 0;
+}
+
+/*
+ * Tell the server the chip found, so that its reads and writes follow the
+ * chip geometry.
+ */
+static int remote_queue_chip(struct context *ctx)
+{
+	struct remote_data *rd = ctx->programmer_data;
+	const char *name;
+	unsigned char *p;
+
+	if (rd->chip == ctx->chip)
+		return 0;
+	name = ctx->chip->driver_name;
+	p = remote_queue(rd, REMOTE_SET_CHIP, strlen(name), NULL, 0);
+	if (!p)
+		return -EIO;
+	memcpy(p, name, strlen(name));
+	rd->chip = ctx->chip;
+	return 0;
+}
+
+static int remote_spi_send_multicommand(struct context *ctx,
+					struct spi_command *cmds)
+{
+	struct remote_data *rd = ctx->programmer_data;
+	struct remote_spi_cmd rcmd;
+	struct spi_command *cmd;
+	unsigned char *p, *answer;
+	size_t len = 0, readlen = 0;
+	int ret;
+
+	for (cmd = cmds; cmd->writecnt || cmd->readcnt; cmd++) {
+		len += sizeof(rcmd) + cmd->writecnt;
+		readlen += cmd->readcnt;
+	}
+	if (len > REMOTE_MAX_LEN || readlen > REMOTE_MAX_LEN)
+		return -E2BIG;
+
+	answer = buffer_get(&ctx->buffers, readlen + 1);
+	if (!answer)
+		return -ENOMEM;
+	ret = -EIO;
+	p = remote_queue(rd, REMOTE_SPI, len, answer, readlen);
+	if (p) {
+		for (cmd = cmds; cmd->writecnt || cmd->readcnt; cmd++) {
+			rcmd.writecnt = htonl(cmd->writecnt);
+			rcmd.readcnt = htonl(cmd->readcnt);
+			rcmd.delay_us = htonl(cmd->delay_us);
+			memcpy(p, &rcmd, sizeof(rcmd));
+			memcpy(p + sizeof(rcmd), cmd->writearr, cmd->writecnt);
+			p += sizeof(rcmd) + cmd->writecnt;
+		}
+		ret = remote_complete_all(rd);
+	}
+
+	p = answer;
+	for (cmd = cmds; !ret && (cmd->writecnt || cmd->readcnt); cmd++) {
+		memcpy(cmd->readarr, p, cmd->readcnt);
+		p += cmd->readcnt;
+	}
+	buffer_put(&ctx->buffers, answer);
+	return ret;
+}
+
+static int remote_spi_send_command(struct context *ctx, unsigned int writecnt,
+				   unsigned int readcnt,
+				   const unsigned char *writearr,
+				   unsigned char *readarr)
+{
+	struct spi_command cmds[] = {
+		{
+			.writecnt = writecnt,
+			.readcnt = readcnt,
+			.writearr = writearr,
+			.readarr = readarr,
+		},
+		{ 0 },
+	};
+
+	return remote_spi_send_multicommand(ctx, cmds);
+}
+
+/*
+ * The transfer is cut in REMOTE_CHUNK aligned requests, all streamed before
+ * the first answer is waited for.
+ */
+static int remote_transfer(struct context *ctx, uint8_t type,
+			   const uint8_t *wbuf, uint8_t *rbuf, off_t start,
+			   size_t len)
+{
+	struct remote_data *rd = ctx->programmer_data;
+	off_t pos = start, end = start + len;
+	size_t n;
+	int ret;
+
+	ret = remote_queue_chip(ctx);
+	while (!ret && pos < end) {
+		n = REMOTE_CHUNK - pos % REMOTE_CHUNK;
+		if (n > end - pos)
+			n = end - pos;
+		ret = remote_queue_range(rd, type, pos, n,
+					 wbuf ? wbuf + pos - start : NULL,
+					 rbuf ? rbuf + pos - start : NULL);
+		pos += n;
+	}
+	if (!ret)
+		ret = remote_complete_all(rd);
+	if (ret) {
+		pr_err("Remote transfer of 0x%06lx..0x%06lx failed: %d\n",
+		       (long)start, (long)end, ret);
+		return ret;
+	}
+	return len;
+}
+
+static int remote_spi_read(struct context *ctx, uint8_t *buf, off_t start,
+			   size_t len)
+{
+	return remote_transfer(ctx, REMOTE_READ, NULL, buf, start, len);
+}
+
+static int remote_spi_write_256(struct context *ctx, const uint8_t *buf,
+				off_t start, size_t len)
+{
+	return remote_transfer(ctx, REMOTE_WRITE_256, buf, NULL, start, len);
+}
+
+static int remote_spi_write_aai(struct context *ctx, const uint8_t *buf,
+				off_t start, size_t len)
+{
+	return remote_transfer(ctx, REMOTE_WRITE_AAI, buf, NULL, start, len);
+}
+
+static int remote_chip_setup(struct context *ctx)
+{
+	struct remote_data *rd = ctx->programmer_data;
+	int ret;
+
+	rd->chip = NULL;
+	ret = remote_queue_chip(ctx);
+	if (!ret)
+		ret = remote_complete_all(rd);
+	if (ret) {
+		pr_err("The remote programmer didn't find the %s chip: %d\n",
+		       ctx->chip->name, ret);
+		rd->chip = NULL;
+	}
+	return ret;
+}
+
+static int remote_select_target(struct context *ctx, int target)
+{
+	struct remote_data *rd = ctx->programmer_data;
+	uint32_t value = htonl(target);
+	unsigned char *p;
+
+	rd->chip = NULL;
+	p = remote_queue(rd, REMOTE_SET_TARGET, sizeof(value), NULL, 0);
+	if (!p)
+		return -EIO;
+	memcpy(p, &value, sizeof(value));
+	return remote_complete_all(rd);
+}
+
+static unsigned int remote_spi_max_data(struct context *ctx,
+					enum spi_transfer dir)
+{
+	struct remote_data *rd = ctx->programmer_data;
+
+	return dir == SPI_TRANSFER_READ ? rd->max_data_read :
+		rd->max_data_write;
+}
+
+static int remote_hello(struct remote_data *rd)
+{
+	struct remote_hello hello;
+	struct remote_info info;
+	unsigned char *p;
+	int ret;
+
+	hello.magic = htonl(REMOTE_MAGIC);
+	hello.version = htonl(REMOTE_VERSION);
+	p = remote_queue(rd, REMOTE_HELLO, sizeof(hello), &info, sizeof(info));
+	if (!p)
+		return -EIO;
+	memcpy(p, &hello, sizeof(hello));
+	ret = remote_complete_all(rd);
+	if (ret) {
+		pr_err("The remote programmer refused the connection: %d\n",
+		       ret);
+		return ret;
+	}
+
+	rd->max_data_read = ntohl(info.max_data_read);
+	rd->max_data_write = ntohl(info.max_data_write);
+	pr_dbg("remote max read %u, max write %u\n", rd->max_data_read,
+	       rd->max_data_write);
+	return 0;
+}
+
+static void remote_release(struct remote_data *rd)
+{
+	if (rd->fd >= 0)
+		close(rd->fd);
+	free(rd->out);
+	free(rd);
+}
+
+static int remote_probe(const char *programmer_args, void **data)
+{
+	struct remote_data *rd;
+	char *socket_path, *ip, *port;
+	int ret;
+
+	socket_path = extract_programmer_param(programmer_args, "socket");
+	ip = extract_programmer_param(programmer_args, "ip");
+	port = extract_programmer_param(programmer_args, "port");
+
+	rd = calloc(1, sizeof(*rd));
+	ret = -ENOMEM;
+	if (!rd)
+		goto out;
+	rd->fd = -1;
+	ret = -EINVAL;
+	if (!socket_path == !ip || !ip != !port) {
+		pr_dbg("remote needs one of socket=, or ip= and port=\n");
+		goto out;
+	}
+
+	rd->fd = socket_path ? unix_connect(socket_path) : tcp_connect(ip, port);
+	ret = rd->fd;
+	if (ret >= 0)
+		ret = remote_hello(rd);
+out:
+	if (ret < 0 && rd) {
+		remote_release(rd);
+		rd = NULL;
+	}
+	*data = rd;
+	free(socket_path);
+	free(ip);
+	free(port);
+	return ret < 0 ? ret : 0;
+}
+
+static void remote_shutdown(void *data)
+{
+	remote_release(data);
+}
+
+static struct programmer remote = {
+	.buses_supported = BUS_SPI,
+	.spi = {
+		.max_data_read = MAX_DATA_UNSPECIFIED,
+		.max_data_write = MAX_DATA_UNSPECIFIED,
+		.max_data = remote_spi_max_data,
+		.command = remote_spi_send_command,
+		.multicommand = remote_spi_send_multicommand,
+		.read = remote_spi_read,
+		.write_256 = remote_spi_write_256,
+		.write_aai = remote_spi_write_aai,
+	},
+	.probe = remote_probe,
+	.shutdown = remote_shutdown,
+	.chip_setup = remote_chip_setup,
+	.select_target = remote_select_target,
+	.desc = "{socket=<path>,ip=<host> port=<port>} : a programmer lent by --serve",
+};
+
+DECLARE_PROGRAMMER(remote);
@@ -0,0 +1,601 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * It is heavily inspired from flashrom project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "serprog"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <bus_spi.h>
+#include <chip.h>
+#include <debug.h>
+#include <programmer.h>
+#include <serprog.h>
+#include <socket.h>
+#include <spi_nor.h>
+#include <spi_programmer.h>
+
+#define SERPROG_TIMEOUT_MS	2000
+#define SERPROG_SYNC_TRIES	8
+#define SERPROG_DEFAULT_BAUD	115200
+/* The device serial buffer, if it doesn't tell */
+#define SERPROG_DEFAULT_SERBUF	16
+/* Lengths are 24 bits, keep them 64 kB aligned */
+#define SERPROG_MAX_NLEN	0xff0000
+/* Most commands sent and not acknowledged yet */
+#define SERPROG_MAX_PENDING	1024
+
+struct serprog_pending {
+	unsigned int len;
+	unsigned int readcnt;
+	unsigned char *readarr;
+};
+
+struct serprog_data {
+	int fd;
+	unsigned char cmdmap[S_CMDMAP_LEN];
+	unsigned int serbuf;
+	unsigned int opbuf;
+	unsigned int max_data_read;
+	unsigned int max_data_write;
+
+	/*
+	 * The commands are queued in out, and sent when an answer is needed.
+	 * The commands sent and not acknowledged yet, inflight bytes long,
+	 * are in the pending ring.
+	 */
+	unsigned char *out;
+	size_t out_len, out_size;
+	struct serprog_pending pending[SERPROG_MAX_PENDING];
+	unsigned int first_pending, nb_pending, inflight;
+
+	struct serprog_standin *standin;
+};
+
+static const struct {
+	int baud;
+	speed_t speed;
+} serprog_bauds[] = {
+	{ 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 },
+	{ 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 },
+	{ 460800, B460800 }, { 500000, B500000 }, { 921600, B921600 },
+	{ 1000000, B1000000 }, { 2000000, B2000000 }, { 3000000, B3000000 },
+	{ 4000000, B4000000 },
+};
+
+static int serprog_cmd_supported(struct serprog_data *sp, unsigned char cmd)
+{
+	return sp->cmdmap[cmd / 8] & (1 << (cmd % 8));
+}
+
+static void put_le(unsigned char *p, uint32_t v, int nb)
+{
+	while (nb--) {
+		*p++ = v & 0xff;
+		v >>= 8;
+	}
+}
+
+static uint32_t get_le(const unsigned char *p, int nb)
+{
+	uint32_t v = 0;
+
+	while (nb--)
+		v = (v << 8) | p[nb];
+	return v;
+}
+
+static int serprog_recv(struct serprog_data *sp, void *buf, size_t len,
+			int timeout_ms)
+{
+	struct pollfd pfd = { .fd = sp->fd, .events = POLLIN };
+	unsigned char *p = buf;
+	ssize_t n;
+	int ret;
+
+	while (len) {
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return ret < 0 ? -errno : -ETIMEDOUT;
+		n = read(sp->fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n < 0 ? -errno : -EPIPE;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int serprog_flush(struct serprog_data *sp)
+{
+	int ret;
+
+	if (!sp->out_len)
+		return 0;
+	ret = write_full(sp->fd, sp->out, sp->out_len);
+	sp->out_len = 0;
+	return ret;
+}
+
+/*
+ * Wait for the answer of the oldest command sent.
+ */
+static int serprog_complete_one(struct serprog_data *sp)
+{
+	struct serprog_pending *p = &sp->pending[sp->first_pending];
+	unsigned char ack;
+	int ret;
+
+	ret = serprog_flush(sp);
+	if (!ret)
+		ret = serprog_recv(sp, &ack, 1, SERPROG_TIMEOUT_MS);
+	if (!ret && ack != S_ACK)
+		ret = -EIO;
+	if (!ret && p->readcnt)
+		ret = serprog_recv(sp, p->readarr, p->readcnt,
+				   SERPROG_TIMEOUT_MS);
+
+	sp->first_pending = (sp->first_pending + 1) % SERPROG_MAX_PENDING;
+	sp->nb_pending--;
+	sp->inflight -= p->len;
+	return ret;
+}
+
+static int serprog_complete_all(struct serprog_data *sp)
+{
+	int ret = 0;
+
+	while (!ret && sp->nb_pending)
+		ret = serprog_complete_one(sp);
+	return ret;
+}
+
+/*
+ * Queue a command, without waiting for its answer. The commands sent and not
+ * acknowledged yet must fit in the device serial buffer, a bigger command
+ * being sent alone.
+ */
+static int serprog_queue(struct serprog_data *sp, unsigned char cmd,
+			 const unsigned char *params, size_t plen,
+			 const unsigned char *data, size_t dlen,
+			 unsigned int readcnt, unsigned char *readarr)
+{
+	struct serprog_pending *p;
+	size_t len = 1 + plen + dlen;
+	unsigned char *out;
+	int ret;
+
+	while (sp->nb_pending == SERPROG_MAX_PENDING ||
+	       (sp->inflight && sp->inflight + len > sp->serbuf)) {
+		ret = serprog_complete_one(sp);
+		if (ret)
+			return ret;
+	}
+
+	if (sp->out_len + len > sp->out_size) {
+		out = realloc(sp->out, sp->out_len + len);
+		if (!out)
+			return -ENOMEM;
+		sp->out = out;
+		sp->out_size = sp->out_len + len;
+	}
+	out = sp->out + sp->out_len;
+	out[0] = cmd;
+	memcpy(out + 1, params, plen);
+	memcpy(out + 1 + plen, data, dlen);
+	sp->out_len += len;
+
+	p = &sp->pending[(sp->first_pending + sp->nb_pending) %
+			 SERPROG_MAX_PENDING];
+	p->len = len;
+	p->readcnt = readcnt;
+	p->readarr = readarr;
+	sp->nb_pending++;
+	sp->inflight += len;
+	return 0;
+}
+
+static int serprog_docommand(struct serprog_data *sp, unsigned char cmd,
+			     const unsigned char *params, size_t plen,
+			     unsigned char *retbuf, unsigned int retlen)
+{
+	int ret;
+
+	ret = serprog_queue(sp, cmd, params, plen, NULL, 0, retlen, retbuf);
+	if (!ret)
+		ret = serprog_complete_all(sp);
+	if (ret)
+		pr_dbg("Command 0x%02x failed: %d\n", cmd, ret);
+	return ret;
+}
+
+/*
+ * Drop whatever is in transit, and wait for the answer of a SYNCNOP, NAK and
+ * ACK, to be sure the next byte read answers the next command sent.
+ */
+static int serprog_sync(struct serprog_data *sp)
+{
+	unsigned char c = S_CMD_SYNCNOP;
+	int i;
+
+	sp->out_len = 0;
+	sp->nb_pending = 0;
+	sp->inflight = 0;
+	tcflush(sp->fd, TCIOFLUSH);
+	for (i = 0; i < SERPROG_SYNC_TRIES; i++) {
+		if (write_full(sp->fd, &c, 1))
+			return -EIO;
+		while (!serprog_recv(sp, &c, 1, 100)) {
+			if (c != S_NAK)
+				continue;
+			if (!serprog_recv(sp, &c, 1, 100) && c == S_ACK)
+				return 0;
+		}
+		c = S_CMD_SYNCNOP;
+	}
+	pr_err("Couldn't synchronize with the serprog device\n");
+	return -EIO;
+}
+
+static int serprog_queue_spiop(struct serprog_data *sp, unsigned int writecnt,
+			       unsigned int readcnt,
+			       const unsigned char *writearr,
+			       unsigned char *readarr)
+{
+	unsigned char params[6];
+
+	put_le(params, writecnt, 3);
+	put_le(params + 3, readcnt, 3);
+	return serprog_queue(sp, S_CMD_O_SPIOP, params, sizeof(params),
+			     writearr, writecnt, readcnt, readarr);
+}
+
+/*
+ * The delay is carried out by the device from its operation buffer, so that
+ * it doesn't break the stream of commands. Otherwise, the host waits for all
+ * the commands to be done before waiting.
+ */
+static int serprog_queue_delay(struct serprog_data *sp, unsigned int usecs)
+{
+	unsigned char params[4];
+	int ret;
+
+	if (sp->opbuf >= 5 && serprog_cmd_supported(sp, S_CMD_O_DELAY) &&
+	    serprog_cmd_supported(sp, S_CMD_O_EXEC)) {
+		put_le(params, usecs, 4);
+		ret = serprog_queue(sp, S_CMD_O_DELAY, params, 4, NULL, 0, 0,
+				    NULL);
+		if (!ret)
+			ret = serprog_queue(sp, S_CMD_O_EXEC, NULL, 0, NULL, 0,
+					    0, NULL);
+		return ret;
+	}
+
+	ret = serprog_complete_all(sp);
+	if (!ret)
+		programmer_delay(usecs);
+	return ret;
+}
+
+static int serprog_spi_send_multicommand(struct context *ctxt,
+					 struct spi_command *cmds)
+{
+	struct serprog_data *sp = ctxt->programmer_data;
+	int ret = 0;
+
+	for (; !ret && (cmds->writecnt || cmds->readcnt); cmds++) {
+		ret = serprog_queue_spiop(sp, cmds->writecnt, cmds->readcnt,
+					  cmds->writearr, cmds->readarr);
+		if (!ret && cmds->delay_us)
+			ret = serprog_queue_delay(sp, cmds->delay_us);
+	}
+	if (!ret)
+		ret = serprog_complete_all(sp);
+	if (ret) {
+		pr_err("serprog SPI operation failed: %d\n", ret);
+		serprog_sync(sp);
+	}
+	return ret;
+}
+
+static int serprog_spi_send_command(struct context *ctxt,
+				    unsigned int writecnt,
+				    unsigned int readcnt,
+				    const unsigned char *writearr,
+				    unsigned char *readarr)
+{
+	struct spi_command cmds[] = {
+		{
+			.writecnt = writecnt,
+			.readcnt = readcnt,
+			.writearr = writearr,
+			.readarr = readarr,
+		},
+		{ 0 },
+	};
+
+	return serprog_spi_send_multicommand(ctxt, cmds);
+}
+
+/*
+ * The read commands, as big as the device allows, are streamed without
+ * waiting for each answer.
+ */
+static int serprog_spi_read(struct context *ctxt, unsigned char *buf,
+			    off_t start, size_t len)
+{
+	struct serprog_data *sp = ctxt->programmer_data;
+	unsigned char cmd[JEDEC_READ_OUTSIZE];
+	off_t pos = start, end = start + len;
+	size_t toread;
+	int ret = 0;
+
+	while (!ret && pos < end) {
+		toread = spi_transfer_len(ctxt, SPI_TRANSFER_READ, pos, end);
+		cmd[0] = JEDEC_READ;
+		cmd[1] = (pos >> 16) & 0xff;
+		cmd[2] = (pos >> 8) & 0xff;
+		cmd[3] = pos & 0xff;
+		ret = serprog_queue_spiop(sp, sizeof(cmd), toread, cmd,
+					  buf + pos - start);
+		pos += toread;
+	}
+	if (!ret)
+		ret = serprog_complete_all(sp);
+	if (ret) {
+		pr_err("serprog read error at 0x%06lx: %d\n", (long)pos, ret);
+		serprog_sync(sp);
+		return ret;
+	}
+	return len;
+}
+
+static unsigned int serprog_spi_max_data(struct context *ctxt,
+					 enum spi_transfer dir)
+{
+	struct serprog_data *sp = ctxt->programmer_data;
+
+	return dir == SPI_TRANSFER_READ ? sp->max_data_read :
+		sp->max_data_write;
+}
+
+static int serprog_open_tty(const char *path, int baud)
+{
+	struct termios tio;
+	int i, fd;
+
+	for (i = 0; i < sizeof(serprog_bauds) / sizeof(serprog_bauds[0]); i++)
+		if (serprog_bauds[i].baud == baud)
+			break;
+	if (i == sizeof(serprog_bauds) / sizeof(serprog_bauds[0])) {
+		pr_err("Unsupported baud rate %d\n", baud);
+		return -EINVAL;
+	}
+
+	fd = open(path, O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		fd = -errno;
+		pr_err("Cannot open %s: %s\n", path, strerror(errno));
+		return fd;
+	}
+	if (!isatty(fd))
+		return fd;
+
+	if (tcgetattr(fd, &tio)) {
+		close(fd);
+		return -EIO;
+	}
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, serprog_bauds[i].speed);
+	cfsetospeed(&tio, serprog_bauds[i].speed);
+	if (tcsetattr(fd, TCSANOW, &tio)) {
+		pr_err("Cannot set up the serial port: %s\n", strerror(errno));
+		close(fd);
+		return -EIO;
+	}
+	return fd;
+}
+
+/*
+ * Find out what the device can do, and the biggest transfers it takes.
+ */
+static int serprog_setup(struct serprog_data *sp, int speed_hz)
+{
+	unsigned char buf[S_PGMNAME_LEN + 1];
+	uint32_t v;
+	int ret;
+
+	ret = serprog_sync(sp);
+	if (ret)
+		return ret;
+	if (serprog_docommand(sp, S_CMD_Q_IFACE, NULL, 0, buf, 2) ||
+	    get_le(buf, 2) != S_IFACE_VERSION) {
+		pr_err("Unsupported serprog interface version\n");
+		return -EPROTO;
+	}
+	if (serprog_docommand(sp, S_CMD_Q_CMDMAP, NULL, 0, sp->cmdmap,
+			      S_CMDMAP_LEN))
+		return -EPROTO;
+	if (!serprog_cmd_supported(sp, S_CMD_O_SPIOP)) {
+		pr_err("The serprog device has no SPI support\n");
+		return -ENODEV;
+	}
+
+	memset(buf, 0, sizeof(buf));
+	if (serprog_cmd_supported(sp, S_CMD_Q_PGMNAME) &&
+	    !serprog_docommand(sp, S_CMD_Q_PGMNAME, NULL, 0, buf,
+			       S_PGMNAME_LEN))
+		pr_info("serprog device %s\n", buf);
+	if (serprog_cmd_supported(sp, S_CMD_S_BUSTYPE)) {
+		buf[0] = S_BUS_SPI;
+		if (serprog_docommand(sp, S_CMD_S_BUSTYPE, buf, 1, NULL, 0)) {
+			pr_err("The serprog device refused the SPI bus\n");
+			return -ENODEV;
+		}
+	}
+
+	sp->serbuf = SERPROG_DEFAULT_SERBUF;
+	if (serprog_cmd_supported(sp, S_CMD_Q_SERBUF) &&
+	    !serprog_docommand(sp, S_CMD_Q_SERBUF, NULL, 0, buf, 2) &&
+	    get_le(buf, 2))
+		sp->serbuf = get_le(buf, 2);
+	sp->opbuf = 0;
+	if (serprog_cmd_supported(sp, S_CMD_Q_OPBUF) &&
+	    !serprog_docommand(sp, S_CMD_Q_OPBUF, NULL, 0, buf, 2))
+		sp->opbuf = get_le(buf, 2);
+	if (serprog_cmd_supported(sp, S_CMD_O_INIT) &&
+	    serprog_docommand(sp, S_CMD_O_INIT, NULL, 0, NULL, 0))
+		sp->opbuf = 0;
+
+	v = 0;
+	if (serprog_cmd_supported(sp, S_CMD_Q_RDNMAXLEN) &&
+	    !serprog_docommand(sp, S_CMD_Q_RDNMAXLEN, NULL, 0, buf, 3))
+		v = get_le(buf, 3);
+	sp->max_data_read = v && v < SERPROG_MAX_NLEN ? v :
+		SERPROG_MAX_NLEN;
+	v = 0;
+	if (serprog_cmd_supported(sp, S_CMD_Q_WRNMAXLEN) &&
+	    !serprog_docommand(sp, S_CMD_Q_WRNMAXLEN, NULL, 0, buf, 3))
+		v = get_le(buf, 3);
+	sp->max_data_write = v > JEDEC_BYTE_PROGRAM_OUTSIZE - 1 ?
+		v - (JEDEC_BYTE_PROGRAM_OUTSIZE - 1) : MAX_DATA_UNSPECIFIED;
+	pr_dbg("serial buffer %u, operation buffer %u, max read %u, max write %u\n",
+	       sp->serbuf, sp->opbuf, sp->max_data_read, sp->max_data_write);
+
+	if (speed_hz > 0 && serprog_cmd_supported(sp, S_CMD_S_SPI_FREQ)) {
+		put_le(buf, speed_hz, 4);
+		if (serprog_docommand(sp, S_CMD_S_SPI_FREQ, buf, 4, buf, 4))
+			pr_warn("The serprog device refused %d Hz\n", speed_hz);
+		else
+			pr_info("SPI speed set to %u Hz\n", get_le(buf, 4));
+	}
+	if (serprog_cmd_supported(sp, S_CMD_S_PIN_STATE)) {
+		buf[0] = 1;
+		serprog_docommand(sp, S_CMD_S_PIN_STATE, buf, 1, NULL, 0);
+	}
+	return 0;
+}
+
+static void serprog_release(struct serprog_data *sp)
+{
+	if (sp->fd >= 0)
+		close(sp->fd);
+	if (sp->standin)
+		serprog_standin_stop(sp->standin);
+	free(sp->out);
+	free(sp);
+}
+
+static int serprog_probe(const char *programmer_args, void **data)
+{
+	struct serprog_data *sp;
+	char *dev, *baud, *ip, *port, *standin, *latency;
+	int ret, speed_hz = -1, millivolts = -1;
+
+	dev = extract_programmer_param(programmer_args, "dev");
+	baud = extract_programmer_param(programmer_args, "baud");
+	ip = extract_programmer_param(programmer_args, "ip");
+	port = extract_programmer_param(programmer_args, "port");
+	standin = extract_programmer_param(programmer_args, "standin");
+	latency = extract_programmer_param(programmer_args, "latency");
+	spi_programmer_extract_params(programmer_args, &speed_hz, &millivolts);
+
+	sp = calloc(1, sizeof(*sp));
+	ret = -ENOMEM;
+	if (!sp)
+		goto out;
+	sp->fd = -1;
+	ret = -EINVAL;
+	if (!!dev + !!ip + !!standin != 1 || !ip != !port) {
+		pr_dbg("serprog needs one of dev=, ip= and port=, or standin=\n");
+		goto out;
+	}
+
+	if (standin) {
+		sp->standin = serprog_standin_start(standin,
+						    latency ? atoi(latency) : 0);
+		if (!sp->standin)
+			goto out;
+		sp->fd = serprog_open_tty(serprog_standin_tty(sp->standin),
+					  SERPROG_DEFAULT_BAUD);
+	} else if (dev) {
+		sp->fd = serprog_open_tty(dev, baud ? atoi(baud) :
+					  SERPROG_DEFAULT_BAUD);
+	} else {
+		sp->fd = tcp_connect(ip, port);
+	}
+	ret = sp->fd;
+	if (ret < 0)
+		goto out;
+
+	ret = serprog_setup(sp, speed_hz);
+out:
+	if (ret < 0 && sp) {
+		serprog_release(sp);
+		sp = NULL;
+	}
+	*data = sp;
+	free(dev);
+	free(baud);
+	free(ip);
+	free(port);
+	free(standin);
+	free(latency);
+	return ret < 0 ? ret : 0;
+}
+
+static void serprog_shutdown(void *data)
+{
+	struct serprog_data *sp = data;
+	unsigned char off = 0;
+
+	if (serprog_cmd_supported(sp, S_CMD_S_PIN_STATE))
+		serprog_docommand(sp, S_CMD_S_PIN_STATE, &off, 1, NULL, 0);
+	serprog_release(sp);
+}
+
+static struct programmer serprog = {
+	.buses_supported = BUS_SPI,
+	.spi = {
+		.max_data_read = MAX_DATA_UNSPECIFIED,
+		.max_data_write = MAX_DATA_UNSPECIFIED,
+		.max_data = serprog_spi_max_data,
+		.command = serprog_spi_send_command,
+		.multicommand = serprog_spi_send_multicommand,
+		.read = serprog_spi_read,
+		.write_256 = default_spi_write_256,
+	},
+	.probe = serprog_probe,
+	.shutdown = serprog_shutdown,
+	.desc = "{dev=<tty> [baud=<baud>],ip=<host> port=<port>,standin=<image> [latency=<us>]} [hz=<freq>]",
+};
+
+DECLARE_PROGRAMMER(serprog);
@@ -0,0 +1,341 @@
+/*
+ * This file is part of the flashrom2 project.
+ *
+ * Copyright (C) 2015 Robert Jarzmik
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define DEBUG_MODULE "serprog-standin"
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <debug.h>
+#include <flash_emulator.h>
+#include <serprog.h>
+#include <socket.h>
+
+/* What the stand-in tells of itself, a small MCU */
+#define STANDIN_SERBUF		4096
+#define STANDIN_OPBUF		256
+#define STANDIN_RDNMAXLEN	(64 * 1024)
+#define STANDIN_WRNMAXLEN	(4 + 256)
+
+static const unsigned char standin_cmds[] = {
+	S_CMD_NOP, S_CMD_Q_IFACE, S_CMD_Q_CMDMAP, S_CMD_Q_PGMNAME,
+	S_CMD_Q_SERBUF, S_CMD_Q_BUSTYPE, S_CMD_Q_OPBUF, S_CMD_Q_WRNMAXLEN,
+	S_CMD_O_INIT, S_CMD_O_DELAY, S_CMD_O_EXEC, S_CMD_SYNCNOP,
+	S_CMD_Q_RDNMAXLEN, S_CMD_S_BUSTYPE, S_CMD_O_SPIOP, S_CMD_S_SPI_FREQ,
+	S_CMD_S_PIN_STATE,
+};
+
+struct serprog_standin {
+	int master;
+	int stop[2];
+	pthread_t thread;
+	char *image;
+	unsigned int latency_us;
+	struct flash_emulator emu;
+
+	unsigned char in[STANDIN_SERBUF];
+	size_t in_len, in_pos;
+	unsigned char *out, *data;
+	size_t out_len, out_size, data_size;
+	unsigned int opbuf_delay_us;
+
+	unsigned long nb_commands, nb_turnarounds;
+};
+
+static int standin_reserve(unsigned char **buf, size_t *size, size_t len)
+{
+	unsigned char *p;
+
+	if (len <= *size)
+		return 0;
+	p = realloc(*buf, len);
+	if (!p)
+		return -ENOMEM;
+	*buf = p;
+	*size = len;
+	return 0;
+}
+
+static int standin_reply(struct serprog_standin *sp, unsigned char ack,
+			 const void *ret, size_t len)
+{
+	if (standin_reserve(&sp->out, &sp->out_size, sp->out_len + 1 + len))
+		return -ENOMEM;
+	sp->out[sp->out_len++] = ack;
+	memcpy(sp->out + sp->out_len, ret, len);
+	sp->out_len += len;
+	return 0;
+}
+
+/*
+ * Get more commands from the host. The answers are sent only once all the
+ * commands received are executed, after the turnaround latency.
+ */
+static int standin_fill(struct serprog_standin *sp)
+{
+	struct pollfd fds[2] = {
+		{ .fd = sp->master, .events = POLLIN },
+		{ .fd = sp->stop[0], .events = POLLIN },
+	};
+	ssize_t n;
+	int ret;
+
+	if (sp->out_len) {
+		if (sp->latency_us)
+			usleep(sp->latency_us);
+		sp->nb_turnarounds++;
+		ret = write_full(sp->master, sp->out, sp->out_len);
+		if (ret)
+			return ret;
+		sp->out_len = 0;
+	}
+
+	memmove(sp->in, sp->in + sp->in_pos, sp->in_len - sp->in_pos);
+	sp->in_len -= sp->in_pos;
+	sp->in_pos = 0;
+	do {
+		ret = poll(fds, 2, -1);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0 || fds[1].revents)
+		return -EPIPE;
+	n = read(sp->master, sp->in + sp->in_len, sizeof(sp->in) - sp->in_len);
+	if (n <= 0)
+		return -EPIPE;
+	sp->in_len += n;
+	return 0;
+}
+
+static int standin_get(struct serprog_standin *sp, void *buf, size_t len)
+{
+	unsigned char *p = buf;
+	size_t n;
+	int ret;
+
+	while (len) {
+		if (sp->in_pos == sp->in_len) {
+			ret = standin_fill(sp);
+			if (ret)
+				return ret;
+		}
+		n = sp->in_len - sp->in_pos;
+		if (n > len)
+			n = len;
+		memcpy(p, sp->in + sp->in_pos, n);
+		sp->in_pos += n;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static uint32_t le_value(const unsigned char *p, int nb)
+{
+	uint32_t v = 0;
+
+	while (nb--)
+		v = (v << 8) | p[nb];
+	return v;
+}
+
+static int standin_spiop(struct serprog_standin *sp)
+{
+	unsigned char params[6];
+	uint32_t slen, rlen;
+	int ret;
+
+	ret = standin_get(sp, params, sizeof(params));
+	if (ret)
+		return ret;
+	slen = le_value(params, 3);
+	rlen = le_value(params + 3, 3);
+	if (standin_reserve(&sp->data, &sp->data_size, slen) ||
+	    standin_reserve(&sp->out, &sp->out_size, sp->out_len + 1 + rlen))
+		return -ENOMEM;
+	ret = standin_get(sp, sp->data, slen);
+	if (ret)
+		return ret;
+
+	if (flash_emulator_command(&sp->emu, slen, rlen, sp->data,
+				   sp->out + sp->out_len + 1))
+		return standin_reply(sp, S_NAK, NULL, 0);
+	sp->out[sp->out_len] = S_ACK;
+	sp->out_len += 1 + rlen;
+	return 0;
+}
+
+static int standin_command(struct serprog_standin *sp, unsigned char cmd)
+{
+	unsigned char ret[S_CMDMAP_LEN], params[4];
+	uint32_t v;
+	int i, err;
+
+	memset(ret, 0, sizeof(ret));
+	switch (cmd) {
+	case S_CMD_NOP:
+	case S_CMD_O_INIT:
+		sp->opbuf_delay_us = 0;
+		return standin_reply(sp, S_ACK, NULL, 0);
+	case S_CMD_Q_IFACE:
+		ret[0] = S_IFACE_VERSION;
+		return standin_reply(sp, S_ACK, ret, 2);
+	case S_CMD_Q_CMDMAP:
+		for (i = 0; i < sizeof(standin_cmds); i++)
+			ret[standin_cmds[i] / 8] |= 1 << (standin_cmds[i] % 8);
+		return standin_reply(sp, S_ACK, ret, S_CMDMAP_LEN);
+	case S_CMD_Q_PGMNAME:
+		strncpy((char *)ret, "fr2-standin", S_PGMNAME_LEN);
+		return standin_reply(sp, S_ACK, ret, S_PGMNAME_LEN);
+	case S_CMD_Q_SERBUF:
+		ret[0] = STANDIN_SERBUF & 0xff;
+		ret[1] = STANDIN_SERBUF >> 8;
+		return standin_reply(sp, S_ACK, ret, 2);
+	case S_CMD_Q_BUSTYPE:
+		ret[0] = S_BUS_SPI;
+		return standin_reply(sp, S_ACK, ret, 1);
+	case S_CMD_Q_OPBUF:
+		ret[0] = STANDIN_OPBUF & 0xff;
+		ret[1] = STANDIN_OPBUF >> 8;
+		return standin_reply(sp, S_ACK, ret, 2);
+	case S_CMD_Q_WRNMAXLEN:
+	case S_CMD_Q_RDNMAXLEN:
+		v = cmd == S_CMD_Q_WRNMAXLEN ? STANDIN_WRNMAXLEN :
+			STANDIN_RDNMAXLEN;
+		for (i = 0; i < 3; i++)
+			ret[i] = (v >> (8 * i)) & 0xff;
+		return standin_reply(sp, S_ACK, ret, 3);
+	case S_CMD_O_DELAY:
+		err = standin_get(sp, params, 4);
+		if (err)
+			return err;
+		sp->opbuf_delay_us += le_value(params, 4);
+		return standin_reply(sp, S_ACK, NULL, 0);
+	case S_CMD_O_EXEC:
+		if (sp->opbuf_delay_us)
+			usleep(sp->opbuf_delay_us);
+		sp->opbuf_delay_us = 0;
+		return standin_reply(sp, S_ACK, NULL, 0);
+	case S_CMD_SYNCNOP:
+		err = standin_reply(sp, S_NAK, NULL, 0);
+		return err ? err : standin_reply(sp, S_ACK, NULL, 0);
+	case S_CMD_S_BUSTYPE:
+	case S_CMD_S_PIN_STATE:
+		err = standin_get(sp, params, 1);
+		if (err)
+			return err;
+		if (cmd == S_CMD_S_BUSTYPE && params[0] != S_BUS_SPI)
+			return standin_reply(sp, S_NAK, NULL, 0);
+		return standin_reply(sp, S_ACK, NULL, 0);
+	case S_CMD_S_SPI_FREQ:
+		err = standin_get(sp, params, 4);
+		if (err)
+			return err;
+		return standin_reply(sp, S_ACK, params, 4);
+	case S_CMD_O_SPIOP:
+		return standin_spiop(sp);
+	default:
+		pr_dbg("Unsupported command 0x%02x\n", cmd);
+		return standin_reply(sp, S_NAK, NULL, 0);
+	}
+}
+
+static void *standin_thread(void *arg)
+{
+	struct serprog_standin *sp = arg;
+	unsigned char cmd;
+
+	while (!standin_get(sp, &cmd, 1)) {
+		sp->nb_commands++;
+		if (standin_command(sp, cmd))
+			break;
+	}
+	return NULL;
+}
+
+static void standin_free(struct serprog_standin *sp)
+{
+	free(sp->image);
+	free(sp->out);
+	free(sp->data);
+	free(sp);
+}
+
+struct serprog_standin *serprog_standin_start(const char *image,
+					      unsigned int latency_us)
+{
+	struct serprog_standin *sp;
+
+	sp = calloc(1, sizeof(*sp));
+	if (!sp)
+		return NULL;
+	sp->image = strdup(image);
+	sp->latency_us = latency_us;
+	if (!sp->image || flash_emulator_load(&sp->emu, image)) {
+		standin_free(sp);
+		return NULL;
+	}
+
+	sp->master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (sp->master < 0 || grantpt(sp->master) || unlockpt(sp->master))
+		goto err_pty;
+	if (pipe(sp->stop))
+		goto err_pty;
+	if (pthread_create(&sp->thread, NULL, standin_thread, sp))
+		goto err_pipe;
+	pr_dbg("serprog stand-in on %s\n", ptsname(sp->master));
+	return sp;
+
+err_pipe:
+	close(sp->stop[0]);
+	close(sp->stop[1]);
+err_pty:
+	pr_err("Cannot create the serprog stand-in terminal: %s\n",
+	       strerror(errno));
+	if (sp->master >= 0)
+		close(sp->master);
+	flash_emulator_release(&sp->emu);
+	standin_free(sp);
+	return NULL;
+}
+
+const char *serprog_standin_tty(struct serprog_standin *sp)
+{
+	return ptsname(sp->master);
+}
+
+int serprog_standin_stop(struct serprog_standin *sp)
+{
+	int ret;
+
+	if (write(sp->stop[1], "", 1) < 0)
+		pr_warn("Couldn't wake up the serprog stand-in\n");
+	pthread_join(sp->thread, NULL);
+	close(sp->stop[0]);
+	close(sp->stop[1]);
+	close(sp->master);
+	pr_info("serprog stand-in: %lu commands in %lu turnarounds\n",
+		sp->nb_commands, sp->nb_turnarounds);
+
+	ret = flash_emulator_save(&sp->emu, sp->image);
+	flash_emulator_release(&sp->emu);
+	standin_free(sp);
+	return ret;
+}
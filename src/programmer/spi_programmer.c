@@ -18,6 +18,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <programmer.h>
@@ -40,24 +41,28 @@ static int parse_voltage(const char *s)
 	return -1;
 }
 
+/* A frequency rounded to 0 Hz would be taken for auto, and is refused */
 static int parse_freq(const char *s)
 {
-	float f = -1;
+	double f = -1;
 	char unit[4];
+	int hz;
 
 	memset(unit, 0, sizeof(unit));
 
-	if (sscanf(s, "%f%2c", &f, unit) < 2)
+	if (!strcasecmp(s, "auto"))
+		return SPI_HZ_AUTO;
+	if (sscanf(s, "%lf%3c", &f, unit) < 1 || f <= 0)
 		return -1;
-	if (!strcasecmp(unit, "mhz"))
-		return (int)(f * 1000 * 1000);
-	if (!strcasecmp(unit, "khz"))
-		return (int)(f *  1000);
-	if (!strcasecmp(unit, "hz"))
-		return (int)(f);
-	if (!strlen(unit))
-		return (int)f;
-	return -1;
+	if (!strcasecmp(unit, "mhz") || !strcasecmp(unit, "m"))
+		hz = (int)(f * MHz + 0.5);
+	else if (!strcasecmp(unit, "khz") || !strcasecmp(unit, "k"))
+		hz = (int)(f * kHz + 0.5);
+	else if (!strcasecmp(unit, "hz") || !strlen(unit))
+		hz = (int)(f + 0.5);
+	else
+		return -1;
+	return hz ? hz : -1;
 }
 
 void spi_programmer_extract_params(const char *programmer_args,
@@ -70,12 +75,14 @@ void spi_programmer_extract_params(const char *programmer_args,
 	s = extract_programmer_param(programmer_args, "hz");
 	if (s)
 		speed_hz = parse_freq(s);
-	if (speed_hz > 0)
+	free(s);
+	if (speed_hz > 0 || speed_hz == SPI_HZ_AUTO)
 		*spi_speed_hz = speed_hz;
 
 	s = extract_programmer_param(programmer_args, "voltage");
 	if (s)
 		voltage_mv = parse_voltage(s);
+	free(s);
 	if (voltage_mv > 0)
 		*spi_voltage_mv = voltage_mv;
 }
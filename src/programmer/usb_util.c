@@ -18,39 +18,269 @@
 #define DEBUG_MODULE "usb"
 
 #include <errno.h>
-#include <usb.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include <debug.h>
 #include <hexdump.h>
 #include <usb_util.h>
 
-struct usb_device *get_device_by_vid_pid(uint16_t vid, uint16_t pid,
-					 unsigned int device)
+static pthread_mutex_t usb_scan_lock = PTHREAD_MUTEX_INITIALIZER;
+static int usb_scan_frozen;
+static libusb_context *usb_ctx;
+static libusb_device **usb_devices;
+static __thread int usb_last_error;
+
+/*
+ * The drivers handle errno values, the libusb error is kept for
+ * usb_strerror(), by thread as the programmers are probed concurrently.
+ */
+static int usb_errno(int ret)
+{
+	if (ret >= 0)
+		return ret;
+	usb_last_error = ret;
+	switch (ret) {
+	case LIBUSB_ERROR_TIMEOUT:
+		return -ETIMEDOUT;
+	case LIBUSB_ERROR_NO_DEVICE:
+		return -ENODEV;
+	case LIBUSB_ERROR_ACCESS:
+		return -EACCES;
+	case LIBUSB_ERROR_BUSY:
+		return -EBUSY;
+	case LIBUSB_ERROR_PIPE:
+		return -EPIPE;
+	case LIBUSB_ERROR_NO_MEM:
+		return -ENOMEM;
+	default:
+		return -EIO;
+	}
+}
+
+const char *usb_strerror(void)
+{
+	return libusb_error_name(usb_last_error);
+}
+
+static int libusb_backend_control_msg(usb_dev_handle *dev, int requesttype,
+				      int request, int value, int idx,
+				      unsigned char *bytes, size_t size,
+				      int timeout)
+{
+	return usb_errno(libusb_control_transfer(dev, requesttype, request,
+						 value, idx, bytes, size,
+						 timeout));
+}
+
+static int libusb_backend_bulk(usb_dev_handle *dev, int endpoint,
+			       unsigned char *buf, size_t len, int timeout)
+{
+	int ret, transferred = 0;
+
+	ret = libusb_bulk_transfer(dev, endpoint, buf, len, &transferred,
+				   timeout);
+	/* A timeout may still have moved some bytes */
+	if (ret == LIBUSB_ERROR_TIMEOUT && transferred)
+		ret = 0;
+	return ret ? usb_errno(ret) : transferred;
+}
+
+static int libusb_backend_bulk_read(usb_dev_handle *dev, int endpoint,
+				    unsigned char *buf, size_t len, int timeout)
+{
+	return libusb_backend_bulk(dev, endpoint | USB_ENDPOINT_IN, buf, len,
+				   timeout);
+}
+
+static int libusb_backend_bulk_write(usb_dev_handle *dev, int endpoint,
+				     unsigned char *buf, size_t len,
+				     int timeout)
+{
+	return libusb_backend_bulk(dev, endpoint | USB_ENDPOINT_OUT, buf, len,
+				   timeout);
+}
+
+/* The usbfs memory came with libusb 1.0.21 */
+#if LIBUSB_API_VERSION >= 0x01000105
+static unsigned char *libusb_backend_mem_alloc(usb_dev_handle *dev,
+					       size_t len)
+{
+	return libusb_dev_mem_alloc(dev, len);
+}
+
+static void libusb_backend_mem_free(usb_dev_handle *dev, unsigned char *buf,
+				    size_t len)
+{
+	libusb_dev_mem_free(dev, buf, len);
+}
+#else
+#define libusb_backend_mem_alloc NULL
+#define libusb_backend_mem_free NULL
+#endif
+
+static const struct usb_backend libusb_backend = {
+	.name = "libusb",
+	.control_msg = libusb_backend_control_msg,
+	.bulk_read = libusb_backend_bulk_read,
+	.bulk_write = libusb_backend_bulk_write,
+	.mem_alloc = libusb_backend_mem_alloc,
+	.mem_free = libusb_backend_mem_free,
+};
+
+/*
+ * The handles of the devices modelled in-process, each with its backend. All
+ * the other handles are libusb ones.
+ */
+struct usb_handle_backend {
+	usb_dev_handle *dev;
+	const struct usb_backend *backend;
+	struct usb_handle_backend *next;
+};
+
+static pthread_mutex_t usb_backends_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct usb_handle_backend *usb_backends;
+
+int usb_set_backend(usb_dev_handle *dev, const struct usb_backend *backend)
 {
-	struct usb_bus *bus;
-	struct usb_device *dev;
+	struct usb_handle_backend *hb, **prev;
+	int ret = 0;
 
-	for (bus = usb_get_busses(); bus; bus = bus->next)
-		for (dev = bus->devices; dev; dev = dev->next)
-			if ((dev->descriptor.idVendor == vid) &&
-			    (dev->descriptor.idProduct == pid)) {
-				if (device == 0)
-					return dev;
-				device--;
+	pthread_mutex_lock(&usb_backends_lock);
+	for (prev = &usb_backends; (hb = *prev); prev = &hb->next)
+		if (hb->dev == dev)
+			break;
+	if (hb && !backend) {
+		*prev = hb->next;
+		free(hb);
+	} else if (backend) {
+		if (!hb) {
+			hb = calloc(1, sizeof(*hb));
+			if (hb) {
+				hb->dev = dev;
+				hb->next = usb_backends;
+				usb_backends = hb;
 			}
+		}
+		if (hb)
+			hb->backend = backend;
+		else
+			ret = -ENOMEM;
+	}
+	pthread_mutex_unlock(&usb_backends_lock);
+	if (!ret)
+		pr_dbg("USB transfers of %p carried by %s\n", dev,
+		       backend ? backend->name : libusb_backend.name);
+	return ret;
+}
+
+static const struct usb_backend *usb_get_backend(usb_dev_handle *dev)
+{
+	const struct usb_backend *backend = &libusb_backend;
+	struct usb_handle_backend *hb;
+
+	pthread_mutex_lock(&usb_backends_lock);
+	for (hb = usb_backends; hb; hb = hb->next)
+		if (hb->dev == dev)
+			backend = hb->backend;
+	pthread_mutex_unlock(&usb_backends_lock);
+	return backend;
+}
+
+void usb_scan(void)
+{
+	ssize_t ret;
+
+	pthread_mutex_lock(&usb_scan_lock);
+	if (!usb_scan_frozen) {
+		if (!usb_ctx && libusb_init(&usb_ctx))
+			usb_ctx = NULL;
+		if (usb_devices)
+			libusb_free_device_list(usb_devices, 1);
+		usb_devices = NULL;
+		ret = usb_ctx ? libusb_get_device_list(usb_ctx, &usb_devices) :
+			LIBUSB_ERROR_OTHER;
+		if (ret < 0) {
+			pr_err("Could not enumerate USB devices: %s\n",
+			       libusb_error_name(ret));
+			usb_devices = NULL;
+		}
+	}
+	pthread_mutex_unlock(&usb_scan_lock);
+}
+
+void usb_scan_freeze(int freeze)
+{
+	pthread_mutex_lock(&usb_scan_lock);
+	usb_scan_frozen = freeze;
+	pthread_mutex_unlock(&usb_scan_lock);
+}
+
+libusb_device *get_device_by_vid_pid(uint16_t vid, uint16_t pid,
+				     unsigned int device)
+{
+	struct libusb_device_descriptor desc;
+	libusb_device **dev;
+
+	for (dev = usb_devices; dev && *dev; dev++)
+		if (!libusb_get_device_descriptor(*dev, &desc) &&
+		    desc.idVendor == vid && desc.idProduct == pid) {
+			if (device == 0)
+				return *dev;
+			device--;
+		}
 
 	return NULL;
 }
 
+usb_dev_handle *usb_open_device(libusb_device *dev, int configuration,
+				int interface)
+{
+	usb_dev_handle *handle;
+	int ret;
+
+	ret = libusb_open(dev, &handle);
+	if (ret) {
+		usb_last_error = ret;
+		pr_err("Could not open USB device: %s\n", usb_strerror());
+		return NULL;
+	}
+	ret = libusb_set_configuration(handle, configuration);
+	if (ret) {
+		usb_last_error = ret;
+		pr_err("Could not set USB device configuration %d: %s\n",
+		       configuration, usb_strerror());
+		goto err;
+	}
+	ret = libusb_claim_interface(handle, interface);
+	if (ret) {
+		usb_last_error = ret;
+		pr_err("Could not claim USB device interface %d: %s\n",
+		       interface, usb_strerror());
+		goto err;
+	}
+	return handle;
+err:
+	libusb_close(handle);
+	return NULL;
+}
+
+void usb_close_device(usb_dev_handle *dev, int interface)
+{
+	libusb_release_interface(dev, interface);
+	libusb_close(dev);
+}
+
 int do_usb_control_msg(usb_dev_handle *dev, int requesttype, int request,
 		       int value, int idx, unsigned char *bytes, size_t size,
 		       int timeout)
 {
 	int ret;
 
-	ret = usb_control_msg(dev, requesttype, request, value, idx,
-			      (char *)bytes, size, timeout);
+	ret = usb_get_backend(dev)->control_msg(dev, requesttype, request,
+						value, idx, bytes, size,
+						timeout);
 	pr_vdbg("\tusb_control_msg(rqtype=0x%x, request=0x%x, value=0x%x, idx=0x%0x, buflen=%d): %d\n",
 	       requesttype, request, value, idx, size, ret);
 	hexdump_vdbg("\t\t Buf=[", bytes, size, "]\n");
@@ -90,8 +320,8 @@ int do_usb_bulk_read(usb_dev_handle *dev, int endpoint, unsigned char *buf,
 {
 	int ret;
 
-	ret = usb_bulk_read(dev, endpoint | USB_ENDPOINT_IN, (char *)buf,
-			    len, timeout);
+	ret = usb_get_backend(dev)->bulk_read(dev, endpoint, buf, len,
+					     timeout);
 	pr_vdbg("\tusb_bulk_read(endpoint=%d, buflen=%zu): %d\n",
 		endpoint, len, ret);
 	hexdump_vdbg("\t\t Buf=[", buf, len, "]\n");
@@ -103,10 +333,34 @@ int do_usb_bulk_write(usb_dev_handle *dev, int endpoint, unsigned char *buf,
 {
 	int ret;
 
-	ret = usb_bulk_write(dev, endpoint | USB_ENDPOINT_OUT, (char *)buf,
-			     len, timeout);
+	ret = usb_get_backend(dev)->bulk_write(dev, endpoint, buf, len,
+					      timeout);
 	pr_vdbg("\tusb_bulk_write(endpoint=%d, buflen=%zu): %d\n", endpoint,
 	       len, ret);
 	hexdump_vdbg("\t\t Buf=[", buf, len, "]\n");
 	return ret;
 }
+
+int usb_buffer_alloc(usb_dev_handle *dev, struct usb_buffer *ubuf, size_t len)
+{
+	ubuf->backend = usb_get_backend(dev);
+	ubuf->data = NULL;
+	if (ubuf->backend->mem_alloc)
+		ubuf->data = ubuf->backend->mem_alloc(dev, len);
+	ubuf->dma = ubuf->data != NULL;
+	if (!ubuf->dma)
+		ubuf->data = malloc(len);
+	ubuf->len = len;
+	pr_dbg("Allocated a %zu bytes bulk buffer in %s memory\n", len,
+	       ubuf->dma ? "usbfs" : "process");
+	return ubuf->data ? 0 : -ENOMEM;
+}
+
+void usb_buffer_free(usb_dev_handle *dev, struct usb_buffer *ubuf)
+{
+	if (ubuf->dma)
+		ubuf->backend->mem_free(dev, ubuf->data, ubuf->len);
+	else
+		free(ubuf->data);
+	ubuf->data = NULL;
+}